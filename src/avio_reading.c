@@ -8,70 +8,248 @@
  * @update  [id] [yy-mm-dd] [author] [description] 
  */
 
+#include <sys/resource.h>
+
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
+#include <libavutil/cpu.h>
 #include <libavutil/file.h>
+#include <libavutil/time.h>
+
+#include "mmap_io.h"
+#include "batch_probe.h"
+#include "fast_probe.h"
+#include "probe_cache.h"
+#include "ring_io.h"
+#include "pipe_io.h"
+#include "uring_io.h"
+
+enum io_mode {
+    IO_COPY, /* copy small chunks out of av_file_map(), not seekable */
+    IO_MMAP, /* seekable mmap_io backend */
+    IO_RING, /* ring_io backend prefetching on a reader thread */
+    IO_PIPE, /* pipe_io backend, bounded chunks from stdin or a FIFO */
+    IO_URING,/* uring_io backend, several aligned reads in flight */
+};
 
 struct buffer_data {
     uint8_t *ptr;
     size_t size; /* size left in the buffer */
+    int64_t bytes_copied;
+    int verbose;
 };
 
 static int read_packet(void *, uint8_t *, int);
 
+static int demux_all(AVFormatContext *, int64_t *);
+
+static double cpu_seconds(void);
+
 int main(int argc, char **argv) {
-    int ret = 0;
+    int i, ret = 0;
     char *infilename = NULL;
+    const char *batch_source = NULL;
+    const char *cache_file   = NULL;
+    const char *invalidate   = NULL;
+    int cache_hash  = 0;
+    int nb_jobs     = 0;
+    enum io_mode io_mode = IO_COPY;
+    int stats       = 0;
+    int window_size = 0;
+    int readahead   = 0;
+    int depth       = 0;
+    int direct      = 0;
+    int demux       = 0;
+    int fast        = 0;
     uint8_t *buffer          = NULL;
     uint8_t *avio_ctx_buffer = NULL;
     AVFormatContext *fmt_ctx  = NULL;
     AVIOContext     *avio_ctx = NULL;
+    struct probe_cache *cache = NULL;
+    AVDictionary    *open_opts = NULL;
     size_t buffer_size          = 0;
     size_t avio_ctx_buffer_size = 4096;
     struct buffer_data bd = {0};
+    int64_t t_start, t_opened, t_probed, t_demuxed;
+    int64_t nb_packets = 0;
+    double  cpu_start;
     
     av_register_all();
 
-    if (argc != 2) {
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-io") && i + 1 < argc) {
+            if (!strcmp(argv[++i], "copy"))
+                io_mode = IO_COPY;
+            else if (!strcmp(argv[i], "mmap"))
+                io_mode = IO_MMAP;
+            else if (!strcmp(argv[i], "ring"))
+                io_mode = IO_RING;
+            else if (!strcmp(argv[i], "pipe"))
+                io_mode = IO_PIPE;
+            else if (!strcmp(argv[i], "uring"))
+                io_mode = IO_URING;
+            else
+                break;
+        } else if (!strcmp(argv[i], "-window") && i + 1 < argc) {
+            window_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-readahead") && i + 1 < argc) {
+            readahead = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-depth") && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-direct")) {
+            direct = 1;
+        } else if (!strcmp(argv[i], "-demux")) {
+            demux = 1;
+        } else if (!strcmp(argv[i], "-fast")) {
+            fast = 1;
+        } else if (!strcmp(argv[i], "-stats")) {
+            stats = 1;
+        } else if (!strcmp(argv[i], "-v")) {
+            bd.verbose = 1;
+        } else if (!strcmp(argv[i], "-batch") && i + 1 < argc) {
+            batch_source = argv[++i];
+        } else if (!strcmp(argv[i], "-jobs") && i + 1 < argc) {
+            nb_jobs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-cache") && i + 1 < argc) {
+            cache_file = argv[++i];
+        } else if (!strcmp(argv[i], "-cache-hash")) {
+            cache_hash = 1;
+        } else if (!strcmp(argv[i], "-invalidate") && i + 1 < argc) {
+            invalidate = argv[++i];
+        } else {
+            break;
+        }
+    }
+
+    if (i != argc - !(batch_source || invalidate) ||
+        (invalidate && !cache_file)) {
         fprintf(stderr,
-                "Usage: %s <input file>\n"
+                "Usage: %s [-io copy|mmap|ring|pipe|uring] [-window bytes] "
+                "[-readahead bytes]\n"
+                "       [-depth n] [-direct] [-demux] [-fast] [-stats] [-v]\n"
+                "       [-cache file [-cache-hash]] <input file>\n"
+                "       %s -batch <directory | file list> [-jobs n]\n"
+                "       %s -cache file -invalidate <input file | all>\n"
                 "API example program to show how to read from a custom "
-                "buffer accessed through AVIOContext.\n", argv[0]);
+                "buffer accessed through AVIOContext.\n\n"
+                "-io copy   copy 4096-byte chunks out of av_file_map(), "
+                "no seeking (default)\n"
+                "-io mmap   seekable memory-mapped input handing the "
+                "demuxer 'window' bytes per read\n"
+                "-io ring   reader thread prefetching up to 'readahead' "
+                "bytes into a ring buffer\n"
+                "-io pipe   read 'window' bytes at a time from a FIFO or "
+                "stdin ('-', the default for it),\n"
+                "           memory use does not grow with the input\n"
+                "-io uring  keep 'depth' reads of 'window' bytes in flight "
+                "with io_uring,\n"
+                "           -direct opens the input with O_DIRECT\n"
+                "-demux     read every packet after probing and report "
+                "throughput and CPU time per GB\n"
+                "-fast      cap probesize / analyzeduration and skip the "
+                "analysis when the\n"
+                "           container headers are complete\n"
+                "-stats     print bytes copied and open / stream info "
+                "latency to stderr\n"
+                "-v         print every chunk handed out by the copy "
+                "read callback\n"
+                "-batch     probe every file of a directory or list on "
+                "'jobs' threads (default: one per CPU)\n"
+                "           and print one JSON line per file\n"
+                "-cache     reuse stream parameters of inputs probed "
+                "before (key: path, size, mtime)\n"
+                "-cache-hash  also key the cache on a hash of the head "
+                "and tail of the input\n",
+                argv[0], argv[0], argv[0]);
         return 1;
     }
-    infilename = argv[1];
 
-    /* slurp file content into buffer and the buffer must be released with
-     * av_file_unmap() */
-    ret = av_file_map(infilename, &buffer, &buffer_size, 0, NULL);
-    if (ret < 0)
-        goto end;
+    if (batch_source) {
+        ret = batch_probe_run(batch_source,
+                              nb_jobs > 0 ? nb_jobs : av_cpu_count(), stdout);
+        return ret < 0;
+    }
 
-    /* fill opaque structure used by the AVIOContext read callback */
-    bd.ptr  = buffer;
-    bd.size = buffer_size;
-    
-    /* allocate an AVFormatContext, avformat_free_context() can be used to
-     * release the context and everything allocated by the framework */
-    if (!(fmt_ctx = avformat_alloc_context())) {
-        ret = AVERROR(ENOMEM);
-        goto end;
+    if (cache_file) {
+        ret = probe_cache_open(&cache, cache_file, cache_hash);
+        if (ret < 0)
+            goto end;
     }
-    
-    /* allocate a memory block with alignment suitable for all memory
-     * accesses */
-    avio_ctx_buffer = av_malloc(avio_ctx_buffer_size);
-    if (!avio_ctx_buffer) {
-        ret = AVERROR(ENOMEM);
+
+    if (invalidate) {
+        ret = probe_cache_invalidate(cache,
+                                     strcmp(invalidate, "all") ?
+                                     invalidate : NULL);
+        if (ret >= 0)
+            fprintf(stderr, "Dropped %d probe cache entries\n", ret);
         goto end;
     }
 
-    /* allocate and initialize an AVIOContext for buffered I/O, it must be
-     * later freed with avio_context_free() */
-    avio_ctx = avio_alloc_context(avio_ctx_buffer, avio_ctx_buffer_size,
-                                  0, &bd, &read_packet, NULL, NULL);
-    if (!avio_ctx) {
+    infilename = argv[i];
+    if (!strcmp(infilename, "-"))
+        io_mode = IO_PIPE;
+
+    t_start   = av_gettime_relative();
+    cpu_start = cpu_seconds();
+
+    if (io_mode == IO_MMAP) {
+        /* the mapping, the AVIOContext and its buffer are all owned by
+         * mmap_io and released with mmap_io_close() */
+        ret = mmap_io_open(&avio_ctx, infilename, window_size);
+        if (ret < 0)
+            goto end;
+    } else if (io_mode == IO_PIPE) {
+        /* neither seekable nor mapped, the demuxer sees the input front
+         * to back through a single window-sized buffer */
+        ret = pipe_io_open(&avio_ctx, infilename, window_size);
+        if (ret < 0)
+            goto end;
+    } else if (io_mode == IO_URING) {
+        /* the ring, the aligned blocks and the AVIOContext are owned by
+         * uring_io and released with uring_io_close() */
+        ret = uring_io_open(&avio_ctx, infilename,
+                            depth, window_size, direct);
+        if (ret < 0)
+            goto end;
+    } else if (io_mode == IO_RING) {
+        /* the file, the reader thread and the AVIOContext are owned by
+         * ring_io and released with ring_io_close() */
+        ret = ring_io_open(&avio_ctx, infilename, readahead);
+        if (ret < 0)
+            goto end;
+    } else {
+        /* slurp file content into buffer and the buffer must be released
+         * with av_file_unmap() */
+        ret = av_file_map(infilename, &buffer, &buffer_size, 0, NULL);
+        if (ret < 0)
+            goto end;
+
+        /* fill opaque structure used by the AVIOContext read callback */
+        bd.ptr  = buffer;
+        bd.size = buffer_size;
+
+        /* allocate a memory block with alignment suitable for all memory
+         * accesses */
+        avio_ctx_buffer = av_malloc(avio_ctx_buffer_size);
+        if (!avio_ctx_buffer) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+
+        /* allocate and initialize an AVIOContext for buffered I/O, it must
+         * be later freed with avio_context_free() */
+        avio_ctx = avio_alloc_context(avio_ctx_buffer, avio_ctx_buffer_size,
+                                      0, &bd, &read_packet, NULL, NULL);
+        if (!avio_ctx) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+
+    /* allocate an AVFormatContext, avformat_free_context() can be used to
+     * release the context and everything allocated by the framework */
+    if (!(fmt_ctx = avformat_alloc_context())) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
@@ -87,30 +265,99 @@ int main(int argc, char **argv) {
      */
     fmt_ctx->pb = avio_ctx;
 
-    ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL);
+    if (fast && (ret = fast_probe_open_options(&open_opts)) < 0)
+        goto end;
+
+    ret = avformat_open_input(&fmt_ctx, NULL, NULL, &open_opts);
     if (ret < 0) {
         fprintf(stderr, "Could not open input\n");
         goto end;
     }
+    t_opened = av_gettime_relative();
 
-    ret = avformat_find_stream_info(fmt_ctx, NULL);
+    /* with a cache, a hit fills the codec parameters and skips the
+     * analysis, a miss analyses the input and remembers the result */
+    if (cache)
+        ret = probe_cache_find_stream_info(cache, infilename, fmt_ctx);
+    else if (fast)
+        ret = fast_probe_find_stream_info(fmt_ctx);
+    else
+        ret = avformat_find_stream_info(fmt_ctx, NULL);
     if (ret < 0) {
         fprintf(stderr, "Could not find stream information\n");
         goto end;
     }
+    t_probed = av_gettime_relative();
 
     av_dump_format(fmt_ctx, 0, infilename, 0);
+    if (fast)
+        fast_probe_report_incomplete(fmt_ctx, stderr);
+
+    if (demux && (ret = demux_all(fmt_ctx, &nb_packets)) < 0) {
+        fprintf(stderr, "Could not read packets\n");
+        goto end;
+    }
+    t_demuxed = av_gettime_relative();
+
+    if (stats) {
+        if (io_mode == IO_COPY)
+            fprintf(stderr,
+                    "copy io: %"PRId64" bytes copied, window %d bytes\n",
+                    bd.bytes_copied, avio_ctx->buffer_size);
+        else if (io_mode == IO_MMAP)
+            mmap_io_dump_stats(avio_ctx, stderr);
+        else if (io_mode == IO_RING)
+            ring_io_dump_stats(avio_ctx, stderr);
+        else if (io_mode == IO_URING)
+            uring_io_dump_stats(avio_ctx, stderr);
+        else
+            pipe_io_dump_stats(avio_ctx, stderr);
+        fprintf(stderr,
+                "open: %.3f ms, find stream info: %.3f ms, "
+                "total: %.3f ms\n",
+                (t_opened - t_start) / 1000.0,
+                (t_probed - t_opened) / 1000.0,
+                (t_probed - t_start) / 1000.0);
+        if (cache)
+            probe_cache_dump_stats(cache, stderr);
+        if (demux) {
+            /* bytes_read counts what went through the read callback,
+             * CPU time covers every thread (reader threads included) */
+            double mb  = avio_ctx->bytes_read / (1024.0 * 1024.0);
+            double sec = FFMAX(t_demuxed - t_start, 1) / 1e6;
+            double cpu = cpu_seconds() - cpu_start;
+
+            fprintf(stderr,
+                    "demux: %"PRId64" packets, %.1f MiB in %.3f s, "
+                    "%.1f MiB/s, cpu %.3f s, %.3f cpu s/GiB\n",
+                    nb_packets, mb, sec, mb / sec, cpu,
+                    mb > 0 ? cpu * 1024.0 / mb : 0.0);
+        }
+    }
 
 end:
+    av_dict_free(&open_opts);
     avformat_close_input(&fmt_ctx);
 
-    /* note: the internal buffer could have changed,
-     * and be != avio_ctx_buffer */
-    if (avio_ctx)
-        av_freep(&avio_ctx->buffer);
-    avio_context_free(&avio_ctx);
+    if (io_mode == IO_COPY) {
+        /* note: the internal buffer could have changed,
+         * and be != avio_ctx_buffer */
+        if (avio_ctx)
+            av_freep(&avio_ctx->buffer);
+        avio_context_free(&avio_ctx);
+
+        av_file_unmap(buffer, buffer_size);
+    } else if (io_mode == IO_MMAP) {
+        mmap_io_close(&avio_ctx);
+    } else if (io_mode == IO_RING) {
+        ring_io_close(&avio_ctx);
+    } else if (io_mode == IO_URING) {
+        uring_io_close(&avio_ctx);
+    } else {
+        pipe_io_close(&avio_ctx);
+    }
 
-    av_file_unmap(buffer, buffer_size);
+    probe_cache_close(&cache);
 
     if (ret < 0) {
         fprintf(stderr, "Error occurred (%s)\n", av_err2str(ret));
@@ -128,13 +375,39 @@ static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
 
     if (!buf_size)
         return AVERROR_EOF;
-    printf("ptr:%p size:%zu\n", bd->ptr, bd->size);
+    if (bd->verbose)
+        printf("ptr:%p size:%zu\n", bd->ptr, bd->size);
 
     /* copy internal buffer data to buf */
     memcpy(buf, bd->ptr, buf_size);
     bd->ptr  += buf_size;
     bd->size -= buf_size;
+    bd->bytes_copied += buf_size;
 
     return buf_size;
 }
 
+
+static int demux_all(AVFormatContext *fmt_ctx, int64_t *nb_packets) {
+    int ret;
+    AVPacket pkt;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    while ((ret = av_read_frame(fmt_ctx, &pkt)) >= 0) {
+        (*nb_packets)++;
+        av_packet_unref(&pkt);
+    }
+
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static double cpu_seconds(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
@@ -0,0 +1,277 @@
+/**
+ * @file batch_decode.c
+ * demux and decode many inputs, one session each, on a work-stealing
+ * worker pool, and report how the throughput scales with the workers
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/common.h>
+
+#include "batch_decode.h"
+#include "batch_probe.h"
+#include "frame_pool.h"
+
+/* the inputs still to be decoded by a worker, [head, tail) of the input
+ * indices; the owner takes from the head, thieves from the tail, so the
+ * ranges of all the workers stay disjoint */
+struct worker {
+    struct batch   *b;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    int             head, tail;
+    int             nb_decoded;
+    int             nb_steals;
+};
+
+struct batch {
+    char **paths;
+    int    nb_paths;
+    const struct demux_options *opts;
+    const char *out_dir;
+
+    /* one round */
+    struct frame_pool *pool;  /* shared by the sessions of the round */
+    struct worker     *workers;
+    int                nb_workers;
+    _Atomic int        nb_failed;
+    _Atomic int64_t    nb_frames;
+    _Atomic int64_t    bytes_read;
+};
+
+static int   run_round(struct batch *, int, int64_t *);
+
+static void *worker(void *);
+
+static int   pop(struct worker *);
+
+static int   steal(struct worker *);
+
+static int   decode_input(struct batch *, int);
+
+int batch_decode_run(const char *source, const struct demux_options *opts,
+                     int max_workers, const char *out_dir, FILE *report) {
+    int i, n, ret = 0;
+    int log_level = av_log_get_level();
+    int64_t elapsed_us, base_us = 0;
+    struct demux_options quiet = *opts;
+    struct batch b = {0};
+
+    if ((ret = batch_probe_list(source, &b.paths, &b.nb_paths)) < 0)
+        return ret;
+    if (!b.nb_paths) {
+        fprintf(stderr, "No input files in '%s'\n", source);
+        goto end;
+    }
+
+    /* thousands of per-frame lines would only measure the terminal */
+    quiet.quiet  = 1;
+    b.opts       = &quiet;
+    b.out_dir    = out_dir;
+    max_workers  = FFMAX(1, FFMIN(max_workers, b.nb_paths));
+    if (!(b.workers = av_mallocz_array(max_workers, sizeof(*b.workers)))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < max_workers; i++) {
+        b.workers[i].b = &b;
+        pthread_mutex_init(&b.workers[i].lock, NULL);
+    }
+
+    /* decoder warnings of concurrent sessions would interleave */
+    av_log_set_level(AV_LOG_ERROR);
+
+    for (n = 1; ; n = FFMIN(n * 2, max_workers)) {
+        int nb_steals = 0, min_decoded = INT_MAX, max_decoded = 0;
+
+        if ((ret = run_round(&b, n, &elapsed_us)) < 0)
+            break;
+        if (n == 1)
+            base_us = elapsed_us;
+        for (i = 0; i < n; i++) {
+            nb_steals  += b.workers[i].nb_steals;
+            min_decoded = FFMIN(min_decoded, b.workers[i].nb_decoded);
+            max_decoded = FFMAX(max_decoded, b.workers[i].nb_decoded);
+        }
+
+        fprintf(report,
+                "batch decode: %2d workers, %d inputs (%d failed) in "
+                "%.3f s, %.2f inputs/s, %.1f frames/s, %.1f MiB/s read, "
+                "speedup %.2fx (%.0f%% efficiency), %d steals, "
+                "%d-%d inputs per worker\n",
+                n, b.nb_paths, atomic_load(&b.nb_failed), elapsed_us / 1e6,
+                b.nb_paths * 1e6 / elapsed_us,
+                atomic_load(&b.nb_frames) * 1e6 / elapsed_us,
+                atomic_load(&b.bytes_read) / (double)(1 << 20) * 1e6 /
+                elapsed_us,
+                (double)base_us / elapsed_us,
+                100.0 * base_us / elapsed_us / n, nb_steals,
+                min_decoded, max_decoded);
+        fflush(report);
+
+        if (n == max_workers)
+            break;
+    }
+
+    av_log_set_level(log_level);
+
+end:
+    for (i = 0; b.workers && i < max_workers; i++)
+        pthread_mutex_destroy(&b.workers[i].lock);
+    av_free(b.workers);
+    batch_probe_free_list(&b.paths, b.nb_paths);
+
+    return ret;
+}
+
+/* every input once on nb_workers threads, *elapsed_us is at least 1 */
+static int run_round(struct batch *b, int nb_workers, int64_t *elapsed_us) {
+    int i, ret = 0;
+    int nb_started = 0;
+    int64_t t_start;
+
+    if ((ret = frame_pool_init(&b->pool)) < 0)
+        return ret;
+    b->nb_workers = nb_workers;
+    atomic_store(&b->nb_failed, 0);
+    atomic_store(&b->nb_frames, 0);
+    atomic_store(&b->bytes_read, 0);
+
+    /* contiguous chunks to begin with, stealing evens out the rest */
+    for (i = 0; i < nb_workers; i++) {
+        struct worker *w = &b->workers[i];
+
+        w->head       = (int64_t)b->nb_paths * i / nb_workers;
+        w->tail       = (int64_t)b->nb_paths * (i + 1) / nb_workers;
+        w->nb_decoded = 0;
+        w->nb_steals  = 0;
+    }
+
+    t_start = av_gettime_relative();
+    for (i = 0; i < nb_workers; i++) {
+        if ((ret = pthread_create(&b->workers[i].thread, NULL, worker,
+                                  &b->workers[i]))) {
+            ret = AVERROR(ret);
+            break;
+        }
+        nb_started++;
+    }
+    /* the workers that did start steal the inputs of the others */
+    for (i = 0; i < nb_started; i++)
+        pthread_join(b->workers[i].thread, NULL);
+    *elapsed_us = FFMAX(av_gettime_relative() - t_start, 1);
+
+    /* every session is gone, and so is every frame of the pool */
+    frame_pool_free(&b->pool);
+
+    return ret;
+}
+
+static void *worker(void *arg) {
+    struct worker *w = arg;
+    int i;
+
+    while ((i = pop(w)) >= 0 || (i = steal(w)) >= 0) {
+        if (decode_input(w->b, i) < 0)
+            atomic_fetch_add(&w->b->nb_failed, 1);
+        w->nb_decoded++;
+    }
+
+    return NULL;
+}
+
+static int pop(struct worker *w) {
+    int i = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->head < w->tail)
+        i = w->head++;
+    pthread_mutex_unlock(&w->lock);
+
+    return i;
+}
+
+/* take the back half of the fullest other range and decode its first
+ * input; no inputs show up later, so once every range is empty the worker
+ * is done */
+static int steal(struct worker *w) {
+    int i, left, head, tail;
+    struct batch  *b = w->b;
+    struct worker *v;
+
+    for (;;) {
+        v    = NULL;
+        tail = 0;
+        for (i = 0; i < b->nb_workers; i++) {
+            if (&b->workers[i] == w)
+                continue;
+            pthread_mutex_lock(&b->workers[i].lock);
+            left = b->workers[i].tail - b->workers[i].head;
+            pthread_mutex_unlock(&b->workers[i].lock);
+            if (left > tail) {
+                v    = &b->workers[i];
+                tail = left;
+            }
+        }
+        if (!v)
+            return -1;
+
+        /* the victim may have moved on since, look again if it is empty */
+        pthread_mutex_lock(&v->lock);
+        tail = v->tail;
+        head = v->tail -= (v->tail - v->head + 1) / 2;
+        pthread_mutex_unlock(&v->lock);
+        if (head < tail)
+            break;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->head = head + 1;
+    w->tail = tail;
+    w->nb_steals++;
+    pthread_mutex_unlock(&w->lock);
+
+    return head;
+}
+
+static int decode_input(struct batch *b, int i) {
+    int ret;
+    char video_dst[PATH_MAX], audio_dst[PATH_MAX];
+    struct demux_session *s = NULL;
+    const struct demux_session_stats *stats;
+
+    if (b->out_dir) {
+        snprintf(video_dst, sizeof(video_dst), "%s/%d.video", b->out_dir, i);
+        snprintf(audio_dst, sizeof(audio_dst), "%s/%d.audio", b->out_dir, i);
+    } else {
+        snprintf(video_dst, sizeof(video_dst), "/dev/null");
+        snprintf(audio_dst, sizeof(audio_dst), "/dev/null");
+    }
+
+    /* the probe cache is not thread safe, the frame pool is */
+    if ((ret = demux_session_create(&s, b->paths[i], video_dst, audio_dst,
+                                    b->opts, b->pool, NULL)) < 0 ||
+        (ret = demux_session_run(s)) < 0)
+        fprintf(stderr, "Could not decode '%s' (%s)\n",
+                b->paths[i], av_err2str(ret));
+
+    if (s) {
+        stats = demux_session_get_stats(s);
+        atomic_fetch_add(&b->nb_frames,
+                         stats->video_frames + stats->audio_frames);
+        atomic_fetch_add(&b->bytes_read, stats->bytes_read);
+    }
+    demux_session_destroy(&s);
+
+    return ret;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file batch_decode.h
+ * demux and decode many inputs, one session each, on a work-stealing
+ * worker pool, and report how the throughput scales with the workers
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef BATCH_DECODE_H
+#define BATCH_DECODE_H
+
+#include <stdio.h>
+
+#include "demux_session.h"
+
+/* decode every file named in 'source' (see batch_probe_list()) in rounds
+ * of 1, 2, 4, ... up to max_workers threads, the last round on exactly
+ * max_workers; raw outputs go to out_dir as '<n>.video' / '<n>.audio', n
+ * being the index of the input, or to /dev/null if out_dir is NULL; one
+ * throughput line per round goes to report */
+int batch_decode_run(const char *source, const struct demux_options *opts,
+                     int max_workers, const char *out_dir, FILE *report);
+
+#endif /* BATCH_DECODE_H */
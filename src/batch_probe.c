@@ -0,0 +1,333 @@
+/**
+ * @file batch_probe.c
+ * probe many media files on a fixed-size worker pool and print one JSON
+ * line per file
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <dirent.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/bprint.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+#include <libavformat/avformat.h>
+
+#include "batch_probe.h"
+
+struct file_list {
+    char **paths;
+    int    nb_paths;
+    int    nb_alloc;
+};
+
+struct batch {
+    struct file_list files;
+    int64_t   *latency_us; /* per file, indexed like files.paths */
+    _Atomic int next;      /* next file to hand out to a worker */
+    _Atomic int nb_failed;
+    FILE *out;
+    pthread_mutex_t out_lock;
+};
+
+static int   list_add(struct file_list *, const char *);
+
+static int   list_dir(struct file_list *, const char *);
+
+static int   list_file(struct file_list *, const char *);
+
+static void *worker(void *);
+
+static int   probe_file(const char *, AVBPrint *, int64_t *);
+
+static void  json_string(AVBPrint *, const char *);
+
+static int   cmp_int64(const void *, const void *);
+
+int batch_probe_run(const char *source, int nb_workers, FILE *out) {
+    int i, ret = 0;
+    int nb_started = 0;
+    int log_level  = av_log_get_level();
+    struct batch b = {{0}};
+    pthread_t *threads = NULL;
+    int64_t t_start, t_end;
+
+    if ((ret = batch_probe_list(source, &b.files.paths,
+                                &b.files.nb_paths)) < 0)
+        return ret;
+    if (!b.files.nb_paths) {
+        fprintf(stderr, "No input files in '%s'\n", source);
+        goto end;
+    }
+
+    b.out = out;
+    pthread_mutex_init(&b.out_lock, NULL);
+    nb_workers   = FFMAX(1, FFMIN(nb_workers, b.files.nb_paths));
+    b.latency_us = av_mallocz_array(b.files.nb_paths, sizeof(*b.latency_us));
+    threads      = av_mallocz_array(nb_workers, sizeof(*threads));
+    if (!b.latency_us || !threads) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* the log messages of the workers are discarded, a failed file only
+     * gets the text of its error code in the JSON error field */
+    av_log_set_level(AV_LOG_QUIET);
+
+    t_start = av_gettime_relative();
+    for (i = 0; i < nb_workers; i++) {
+        if ((ret = pthread_create(&threads[i], NULL, worker, &b))) {
+            ret = AVERROR(ret);
+            break;
+        }
+        nb_started++;
+    }
+    for (i = 0; i < nb_started; i++)
+        pthread_join(threads[i], NULL);
+    t_end = av_gettime_relative();
+
+    av_log_set_level(log_level);
+    if (nb_started < nb_workers)
+        goto end;
+
+    qsort(b.latency_us, b.files.nb_paths, sizeof(*b.latency_us), cmp_int64);
+#define PERCENTILE(p) \
+    (b.latency_us[(int)((b.files.nb_paths - 1) * (p) / 100.0)] / 1000.0)
+    fprintf(stderr,
+            "batch probe: %d files (%d failed) on %d workers in %.3f s, "
+            "%.1f files/s\n"
+            "probe latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+            "max %.3f ms\n",
+            b.files.nb_paths, atomic_load(&b.nb_failed), nb_workers,
+            (t_end - t_start) / 1e6,
+            b.files.nb_paths * 1e6 / FFMAX(t_end - t_start, 1),
+            PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), PERCENTILE(100));
+#undef PERCENTILE
+
+end:
+    if (b.out)
+        pthread_mutex_destroy(&b.out_lock);
+    batch_probe_free_list(&b.files.paths, b.files.nb_paths);
+    av_free(b.latency_us);
+    av_free(threads);
+
+    return ret;
+}
+
+int batch_probe_list(const char *source, char ***paths, int *nb_paths) {
+    int ret;
+    struct stat st;
+    struct file_list list = {0};
+
+    if (stat(source, &st) < 0) {
+        fprintf(stderr, "Could not stat '%s'\n", source);
+        return AVERROR(errno);
+    }
+    ret = S_ISDIR(st.st_mode) ? list_dir(&list, source)
+                              : list_file(&list, source);
+    if (ret < 0) {
+        batch_probe_free_list(&list.paths, list.nb_paths);
+        return ret;
+    }
+
+    *paths    = list.paths;
+    *nb_paths = list.nb_paths;
+    return 0;
+}
+
+void batch_probe_free_list(char ***paths, int nb_paths) {
+    int i;
+
+    for (i = 0; i < nb_paths && *paths; i++)
+        av_free((*paths)[i]);
+    av_freep(paths);
+}
+
+static int list_add(struct file_list *list, const char *path) {
+    if (list->nb_paths == list->nb_alloc) {
+        int nb_alloc = FFMAX(64, list->nb_alloc * 2);
+        char **paths = av_realloc_array(list->paths, nb_alloc,
+                                        sizeof(*paths));
+        if (!paths)
+            return AVERROR(ENOMEM);
+        list->paths    = paths;
+        list->nb_alloc = nb_alloc;
+    }
+    if (!(list->paths[list->nb_paths] = av_strdup(path)))
+        return AVERROR(ENOMEM);
+    list->nb_paths++;
+
+    return 0;
+}
+
+static int list_dir(struct file_list *list, const char *dirname) {
+    int ret = 0;
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    char path[4096];
+
+    if (!(dir = opendir(dirname))) {
+        fprintf(stderr, "Could not open directory '%s'\n", dirname);
+        return AVERROR(errno);
+    }
+
+    while (ret >= 0 && (entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+        if (stat(path, &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            ret = list_dir(list, path);
+        else if (S_ISREG(st.st_mode))
+            ret = list_add(list, path);
+    }
+    closedir(dir);
+
+    return ret;
+}
+
+static int list_file(struct file_list *list, const char *filename) {
+    int ret = 0;
+    FILE *fp;
+    char line[4096];
+
+    if (!(fp = fopen(filename, "r"))) {
+        fprintf(stderr, "Could not open file list '%s'\n", filename);
+        return AVERROR(errno);
+    }
+
+    /* one path per line, empty lines and '#' comments are skipped */
+    while (ret >= 0 && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] && line[0] != '#')
+            ret = list_add(list, line);
+    }
+    fclose(fp);
+
+    return ret;
+}
+
+static void *worker(void *arg) {
+    struct batch *b = arg;
+    AVBPrint bp;
+    int i;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    while ((i = atomic_fetch_add(&b->next, 1)) < b->files.nb_paths) {
+        av_bprint_clear(&bp);
+        if (probe_file(b->files.paths[i], &bp, &b->latency_us[i]) < 0)
+            atomic_fetch_add(&b->nb_failed, 1);
+
+        /* whole lines only, so the output stays one JSON object per line */
+        pthread_mutex_lock(&b->out_lock);
+        fwrite(bp.str, 1, bp.len, b->out);
+        pthread_mutex_unlock(&b->out_lock);
+    }
+
+    av_bprint_finalize(&bp, NULL);
+    return NULL;
+}
+
+static int probe_file(const char *path, AVBPrint *bp, int64_t *latency_us) {
+    int i, ret;
+    AVFormatContext *fmt_ctx = NULL;
+    int64_t t = av_gettime_relative();
+
+    ret = avformat_open_input(&fmt_ctx, path, NULL, NULL);
+    if (ret >= 0)
+        ret = avformat_find_stream_info(fmt_ctx, NULL);
+    *latency_us = av_gettime_relative() - t;
+
+    av_bprintf(bp, "{\"file\":");
+    json_string(bp, path);
+    if (ret < 0) {
+        av_bprintf(bp, ",\"error\":");
+        json_string(bp, av_err2str(ret));
+        goto end;
+    }
+
+    av_bprintf(bp, ",\"format\":");
+    json_string(bp, fmt_ctx->iformat->name);
+    if (fmt_ctx->duration != AV_NOPTS_VALUE)
+        av_bprintf(bp, ",\"duration\":%.6f",
+                   fmt_ctx->duration / (double)AV_TIME_BASE);
+    else
+        av_bprintf(bp, ",\"duration\":null");
+    av_bprintf(bp, ",\"bit_rate\":%"PRId64, fmt_ctx->bit_rate);
+
+    av_bprintf(bp, ",\"streams\":[");
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        const char *type = av_get_media_type_string(par->codec_type);
+
+        av_bprintf(bp, "%s{\"index\":%d,\"type\":", i ? "," : "", i);
+        json_string(bp, type ? type : "unknown");
+        av_bprintf(bp, ",\"codec\":");
+        json_string(bp, avcodec_get_name(par->codec_id));
+        av_bprintf(bp, ",\"bit_rate\":%"PRId64, par->bit_rate);
+        if (st->duration != AV_NOPTS_VALUE)
+            av_bprintf(bp, ",\"duration\":%.6f",
+                       st->duration * av_q2d(st->time_base));
+
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+            const char *pix_fmt = av_get_pix_fmt_name(par->format);
+
+            av_bprintf(bp, ",\"width\":%d,\"height\":%d,\"pix_fmt\":",
+                       par->width, par->height);
+            json_string(bp, pix_fmt ? pix_fmt : "unknown");
+            av_bprintf(bp, ",\"frame_rate\":%.3f",
+                       st->avg_frame_rate.den ?
+                       av_q2d(st->avg_frame_rate) : 0.0);
+        } else if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+            const char *sample_fmt = av_get_sample_fmt_name(par->format);
+
+            av_bprintf(bp, ",\"sample_rate\":%d,\"channels\":%d,"
+                       "\"sample_fmt\":", par->sample_rate, par->channels);
+            json_string(bp, sample_fmt ? sample_fmt : "unknown");
+        }
+        av_bprintf(bp, "}");
+    }
+    av_bprintf(bp, "]");
+
+end:
+    av_bprintf(bp, ",\"probe_ms\":%.3f}\n", *latency_us / 1000.0);
+    avformat_close_input(&fmt_ctx);
+
+    return ret;
+}
+
+static void json_string(AVBPrint *bp, const char *s) {
+    av_bprint_chars(bp, '"', 1);
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\')
+            av_bprintf(bp, "\\%c", c);
+        else if (c < 0x20)
+            av_bprintf(bp, "\\u%04x", c);
+        else
+            av_bprint_chars(bp, c, 1);
+    }
+    av_bprint_chars(bp, '"', 1);
+}
+
+static int cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,27 @@
+/**
+ * @file batch_probe.h
+ * probe many media files on a fixed-size worker pool and print one JSON
+ * line per file
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef BATCH_PROBE_H
+#define BATCH_PROBE_H
+
+#include <stdio.h>
+
+/* probe every file named in 'source', a directory (walked recursively) or
+ * a text file with one path per line, on nb_workers threads; JSON lines go
+ * to out, throughput and latency percentiles go to stderr */
+int  batch_probe_run(const char *source, int nb_workers, FILE *out);
+
+/* the files named in 'source' the way batch_probe_run() finds them, an
+ * array of *nb_paths strings for batch_probe_free_list() */
+int  batch_probe_list(const char *source, char ***paths, int *nb_paths);
+
+void batch_probe_free_list(char ***paths, int nb_paths);
+
+#endif /* BATCH_PROBE_H */
@@ -17,17 +17,23 @@
 
 #include <libavcodec/avcodec.h>
 
+#include "frame_pool.h"
+#include "interleave.h"
+#include "trace.h"
+
 #define AUDIO_INBUF_SIZE    20480
 #define AUDIO_REFILL_THRESH 4096
 
 static int get_format_from_sample_fmt(const char **, enum AVSampleFormat);
 
-static int decode(AVCodecContext *, AVPacket *, AVFrame *, FILE *);
+static int decode(AVCodecContext *, AVPacket *, AVFrame *,
+                  struct interleaver *, FILE *);
 
 int main(int argc, char **argv) {
-    int len, ret;
+    int i = 1, len, ret;
     const char *infilename;
     const char *outfilename; 
+    const char *trace_file = NULL;
     FILE *infile  = NULL;
     FILE *outfile = NULL;
     const AVCodec  *codec;
@@ -38,6 +44,8 @@ int main(int argc, char **argv) {
     size_t    data_size;
     AVPacket *pkt;
     AVFrame  *decoded_frame = NULL;
+    struct interleaver *il  = NULL;
+    struct frame_pool *pool = NULL;
 
 /*
 
@@ -54,19 +62,30 @@ audio decoding
 
 */
 
-    if (argc <= 2) {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n"
-                "And check your input file is encoded by AAC please.\n",
+    if (argc - i > 2 && !strcmp(argv[i], "-trace")) {
+        trace_file = argv[i + 1];
+        i += 2;
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "Usage: %s [-trace file] <input file> <output file>\n"
+                "And check your input file is encoded by AAC please.\n\n"
+                "-trace  time every read, parse, decode, interleave and "
+                "write, print their\n"
+                "        latency percentiles and write a Chrome trace to "
+                "'file' (make TRACE=1)\n",
                 argv[0]);
         exit(0);
     }
-    infilename  = argv[1];
-    outfilename = argv[2];
+    infilename  = argv[i];
+    outfilename = argv[i + 1];
 
     avcodec_register_all();
 
-    pkt = av_packet_alloc();
-    if(!pkt) {
+    if (trace_file && trace_init(trace_file) < 0)
+        fprintf(stderr, "Tracing is not compiled in, build with 'make "
+                "TRACE=1', -trace ignored\n");
+
+    if (frame_pool_init(&pool) < 0 || !(pkt = frame_pool_get_packet(pool))) {
         fprintf(stderr, "Cannot allocate packet\n");
         exit(1);
     }
@@ -91,6 +110,9 @@ audio decoding
         goto end;
     }
 
+    /* decoded samples go to recycled buffers */
+    frame_pool_attach(pool, codec_ctx);
+
     /* open the audio decoder */
     if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
         fprintf(stderr, "Cannot open codec\n");
@@ -108,24 +130,32 @@ audio decoding
         goto end;
     }
 
+    /* planar frames are interleaved into a buffer and written at once */
+    if (interleaver_init(&il) < 0) {
+        fprintf(stderr, "Cannot allocate interleaver\n");
+        goto end;
+    }
+
     /* read audio data */
     data      = inbuf;
     data_size = fread(inbuf, 1, AUDIO_INBUF_SIZE, infile);
 
     while (data_size > 0) {
         if (!decoded_frame) {
-            if (!(decoded_frame = av_frame_alloc())) {
+            if (!(decoded_frame = frame_pool_get_frame(pool))) {
                 fprintf(stderr, "Cannot allocate audio frame\n");
                 exit(1);
             }
         }
        
+        TRACE_BEGIN(t_parse);
         /* AV_NOPTS_VALUE, undefined timestamp value, usually reported by 
          * demuxer that work on containers that do not provide either pts
          * or dts */
         ret = av_parser_parse2(parser_ctx, codec_ctx, &pkt->data,
                                &pkt->size, data, data_size,
                                AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        TRACE_END(TRACE_PARSE, t_parse);
         if (ret < 0) {
             fprintf(stderr, "Error while parsing\n");
             exit(1);
@@ -134,16 +164,19 @@ audio decoding
         data_size -= ret;
 
         if (pkt->size)
-            if (decode(codec_ctx, pkt, decoded_frame, outfile) < 0)
+            if (decode(codec_ctx, pkt, decoded_frame, il, outfile) < 0)
                 goto end;
         
         /* remaining undecoded size of data < 4096, refill from input to 
          * inbuf */
         if (data_size < AUDIO_REFILL_THRESH) {
+            TRACE_BEGIN(t_read);
+
             memmove(inbuf, data, data_size); /* is safer than memcpy() */
             data = inbuf;
             len = fread(data + data_size, 1,
                         AUDIO_INBUF_SIZE - data_size, infile);
+            TRACE_END(TRACE_READ, t_read);
             if (len > 0)
                 data_size += len;
         }
@@ -152,8 +185,10 @@ audio decoding
     /* flush the decoder */
     pkt->data = NULL;
     pkt->size = 0;
-    if (decode(codec_ctx, pkt, decoded_frame, outfile) < 0)
+    if (decode(codec_ctx, pkt, decoded_frame, il, outfile) < 0)
         goto end;
+    interleaver_dump_stats(il, stderr);
+    frame_pool_dump_stats(pool, stderr);
 
     /* print output pcm info, because there have no metadata of pcm */
     enum AVSampleFormat sfmt = codec_ctx->sample_fmt;
@@ -161,12 +196,12 @@ audio decoding
     const char *fmt;
 
     if (av_sample_fmt_is_planar(sfmt)) { /* packed data & planar data */
-        const char *packed = av_get_sample_fmt_name(sfmt);
-        fprintf(stdout, 
-                "Warning: the sample format the decoder produced is planar "
-                "(%s). This example will output the first channel only.\n",
-                packed ? packed : "?");
+        const char *planar = av_get_sample_fmt_name(sfmt);
         sfmt = av_get_packed_sample_fmt(sfmt);
+        fprintf(stdout, 
+                "The sample format the decoder produced is planar (%s), "
+                "it was written interleaved (%s).\n",
+                planar ? planar : "?", av_get_sample_fmt_name(sfmt));
     }
 
     n_channels = codec_ctx->channels;
@@ -178,12 +213,15 @@ audio decoding
             "ffplay -f %s -ac %d -ar %d %s\n",
             fmt, n_channels, codec_ctx->sample_rate, outfilename);
 end:
-    av_frame_free(&decoded_frame);
+    interleaver_free(&il);
+    frame_pool_put_frame(pool, &decoded_frame);
     if (outfile) fclose(outfile);                    
     if (infile) fclose(infile);
     avcodec_free_context(&codec_ctx);   
     av_parser_close(parser_ctx);
-    av_packet_free(&pkt);         
+    frame_pool_put_packet(pool, &pkt);
+    frame_pool_free(&pool);
+    trace_dump(stderr);
 
     return 0;
 }
@@ -217,15 +255,16 @@ static int get_format_from_sample_fmt(const char **fmt,
     return -1;
 }
 
-static int decode(AVCodecContext *dec_ctx,
-                  AVPacket *pkt, AVFrame *frame, FILE *outfile) {
-    int i, ch;
+static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
+                  struct interleaver *il, FILE *outfile) {
     int ret, data_size;
 
     /* send the packet with the compressed data to the decoder (an AVPacket 
      * with data set to NULL and size set to 0, it is considered a flush 
      * packet, which signals the end of the stream) */
+    TRACE_BEGIN(t_send);
     ret = avcodec_send_packet(dec_ctx, pkt);
+    TRACE_END(TRACE_SEND, t_send);
     if (ret < 0) {
         fprintf(stderr, "Error submitting the packet to the decoder\n");
         fprintf(stderr, "%s\n", av_err2str(ret));
@@ -234,7 +273,10 @@ static int decode(AVCodecContext *dec_ctx,
 
     /* read all output frames (in general there may be any number of them) */
     while (ret >= 0) {
+        TRACE_BEGIN(t_receive);
+
         ret = avcodec_receive_frame(dec_ctx, frame);
+        TRACE_END(TRACE_RECEIVE, t_receive);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             return 0;
         else if (ret < 0) {
@@ -275,9 +317,14 @@ data[0] |__C0__|__C1__|__C2__|__C0__|__C1__|__C2__|__C0__|__C1__|__C2__|__
 
 */
 
-        for (i = 0; i < frame->nb_samples; i++) /* planar fmt to packed fmt */
-            for (ch = 0; ch < dec_ctx->channels; ch++) 
-                fwrite(frame->data[ch] + data_size * i, 1, data_size, outfile);
+        /* planar fmt to packed fmt, the whole frame with one fwrite()
+         * instead of one per sample and channel */
+        if ((ret = interleaver_write(il, frame, outfile)) < 0) {
+            fprintf(stderr,
+                    "Error writing audio samples (%s)\n",
+                    av_err2str(ret));
+            return -1;
+        }
     }
     return 0;
 }
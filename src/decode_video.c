@@ -12,17 +12,74 @@
 #include <string.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+#include <libavutil/time.h>
+#include <libavutil/imgutils.h>
+
+#include "downscale.h"
+#include "gop_index.h"
+#include "thumbnail.h"
+#include "luma_stats.h"
+#include "frame_pool.h"
+#include "frame_queue.h"
+#include "frame_writer.h"
+#include "trace.h"
 
 #define INBUF_SIZE 4096
 
-static void pgm_save(unsigned char *, int, int, int, char *);
-
-static int  decode(AVCodecContext *, AVFrame *, AVPacket *, const char *);
+struct decode_state {
+    struct frame_writer *fw;
+    struct frame_queue  *queue; /* to the writer thread, NULL: write inline */
+    struct thumbnailer  *th;    /* key frames only, instead of fw */
+    struct luma_analyzer *la;   /* per-frame luma statistics, or NULL */
+    struct frame_pool   *pool;  /* decoder buffers, frames and packets */
+    const struct downscale_kernels *dk; /* box downscaling, or NULL */
+    AVFrame *scaled; /* the downscaled frame, when dk is set */
+    int scale;       /* dk downscaling factor */
+    int frame_count; /* frames received so far, i.e. in output order */
+    int bench;       /* decode only, no frames are written */
+    int range_first; /* output frame numbers (1 based) to keep, */
+    int range_last;  /* range_last 0 keeps every frame */
+    int indexed;     /* frame->pts carries the output number from the index */
+    int done;        /* range_last has come out */
+    int64_t t_first; /* when range_first came out */
+    int64_t scale_us;  /* time spent downscaling */
+    int64_t out_bytes; /* of the output frames, written or not */
+    int out_width, out_height;
+};
+
+static int  decode(AVCodecContext *, AVFrame *, AVPacket *,
+                   struct decode_state *);
+
+static int  analyze_frame(struct luma_analyzer *, const AVFrame *, int);
+
+static int  write_frame(void *, AVFrame *);
+
+static const char *thread_type_name(int);
 
 int main(int argc, char **argv) {
-    int ret;
+    int i, ret;
+    int thread_count = 1;
+    int thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    int format       = FRAME_WRITER_PGM;
+    int copy         = 0;
+    int pipeline     = 0;
+    int queue_frames = 0;
+    int queue_mem    = 0;
+    int noindex      = 0;
+    int thumbs       = 0;
+    int thumb_width  = 0;
+    int analyze      = 0;
+    int scale        = 0;
+    int scale_box    = 0;
+    double scene_threshold = 0;
+    int coded_n      = 0;
+    int index_built  = 0;
+    struct gop_index *index = NULL;
     const char *infilename  = NULL;
     const char *outfilename = NULL;
+    const char *trace_file  = NULL;
+    struct decode_state state = {0};
     FILE *fd = NULL;
     const AVCodec  *codec     = NULL;
     AVCodecContext *codec_ctx = NULL;
@@ -32,6 +89,9 @@ int main(int argc, char **argv) {
     size_t    data_size;
     AVPacket *pkt = NULL;
     AVFrame  *decoded_frame = NULL;
+    int64_t pos = 0;
+    int64_t t_start, t_indexed = 0, t_end;
+    char scale_desc[64];
 
 /*
 
@@ -48,20 +108,132 @@ video decoding
 
 */
 
-    if (argc != 3) {
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-thread-type") && i + 1 < argc) {
+            if (!strcmp(argv[++i], "frame"))
+                thread_type = FF_THREAD_FRAME;
+            else if (!strcmp(argv[i], "slice"))
+                thread_type = FF_THREAD_SLICE;
+            else if (!strcmp(argv[i], "auto"))
+                thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            else
+                break;
+        } else if (!strcmp(argv[i], "-format") && i + 1 < argc) {
+            if ((format = frame_writer_mode_from_name(argv[++i])) < 0)
+                break;
+        } else if (!strcmp(argv[i], "-copy")) {
+            copy = 1;
+        } else if (!strcmp(argv[i], "-pipeline")) {
+            pipeline = 1;
+        } else if (!strcmp(argv[i], "-queue-frames") && i + 1 < argc) {
+            queue_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-queue-mem") && i + 1 < argc) {
+            queue_mem = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-range") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d:%d", &state.range_first,
+                       &state.range_last) != 2 ||
+                state.range_first < 1 ||
+                state.range_last < state.range_first)
+                break;
+        } else if (!strcmp(argv[i], "-noindex")) {
+            noindex = 1;
+        } else if (!strcmp(argv[i], "-thumbs")) {
+            thumbs = 1;
+        } else if (!strcmp(argv[i], "-thumb-width") && i + 1 < argc) {
+            thumb_width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-scale") && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+            if (scale != 2 && scale != 4)
+                break;
+        } else if (!strcmp(argv[i], "-scale-box")) {
+            scale_box = 1;
+        } else if (!strcmp(argv[i], "-analyze")) {
+            analyze = 1;
+        } else if (!strcmp(argv[i], "-scene-threshold") && i + 1 < argc) {
+            scene_threshold = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-bench")) {
+            state.bench = 1;
+        } else if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else {
+            break;
+        }
+    }
+
+    if (argc - i != 2 - state.bench) {
         fprintf(stderr, 
-                "Usage: %s <input file> <output file>\n"
-                "And check your input file is encoded by MPEG-1 Video please.\n",
-                argv[0]);
+                "Usage: %s [-threads n] [-thread-type frame|slice|auto] "
+                "[-format pgm|y4m|raw [-copy]]\n"
+                "       [-pipeline [-queue-frames n] [-queue-mem MiB]] "
+                "[-range first:last [-noindex]]\n"
+                "       [-thumbs [-thumb-width w]] "
+                "[-analyze [-scene-threshold t]] [-scale 2|4 [-scale-box]]\n"
+                "       [-trace file] <input file> <output file>\n"
+                "       %s [-threads n] [-thread-type frame|slice|auto] "
+                "[-analyze] [-scale 2|4 [-scale-box]] -bench <input file>\n"
+                "And check your input file is encoded by MPEG-1 Video "
+                "please.\n\n"
+                "-threads      decoder threads, 0 picks one per CPU "
+                "(default: 1)\n"
+                "-thread-type  threading methods the decoder may use "
+                "(default: auto)\n"
+                "-format       pgm: one '<output file>-<n>' luma picture "
+                "per frame (default),\n"
+                "              y4m / raw: every frame into the single "
+                "stream '<output file>'\n"
+                "-copy         pack y4m / raw frames into a staging "
+                "buffer before writing them,\n"
+                "              instead of writing the planes straight "
+                "from the decoded frame\n"
+                "-pipeline     write frames on a separate thread, fed "
+                "through a queue bounded by\n"
+                "              'queue-frames' frames (default: %d) and "
+                "'queue-mem' MiB (default: %d)\n"
+                "-range        only output frames first to last (1 based, "
+                "output order), starting\n"
+                "              at the intra frame before 'first' found in "
+                "the '<input file>.idx'\n"
+                "              index, which is built when missing or stale\n"
+                "-noindex      decode from the start of the stream and drop "
+                "frames up to 'first'\n"
+                "-thumbs       decode I-frames only, without loop filter, "
+                "into 'thumb-width' (default: %d)\n"
+                "              pixels wide '<output file>-<n>.ppm' "
+                "thumbnails\n"
+                "-analyze      luma histogram, mean, variance and scene "
+                "change score of every\n"
+                "              frame, a cut is reported above "
+                "'scene-threshold' (default: %.0f)\n"
+                "-scale        output frames at 1/2 or 1/4 of the size, "
+                "decoded at reduced\n"
+                "              resolution (lowres) where the decoder can, "
+                "box filtered otherwise\n"
+                "-scale-box    always decode at full resolution and box "
+                "filter\n"
+                "-bench        decode without writing frames and print "
+                "frames per second\n"
+                "-trace        time every read, parse, decode, copy and "
+                "write, print their\n"
+                "              latency percentiles and write a Chrome "
+                "trace to 'file' (make TRACE=1)\n",
+                argv[0], argv[0], FRAME_QUEUE_MAX_FRAMES,
+                FRAME_QUEUE_MAX_BYTES >> 20, THUMBNAIL_WIDTH,
+                LUMA_SCENE_THRESHOLD);
         exit(0);
     }
-    infilename  = argv[1];
-    outfilename = argv[2];
+    infilename  = argv[i];
+    outfilename = state.bench ? NULL : argv[i + 1];
 
     avcodec_register_all();
 
-    pkt = av_packet_alloc();
-    if (!pkt) {
+    if (trace_file && trace_init(trace_file) < 0)
+        fprintf(stderr, "Tracing is not compiled in, build with 'make "
+                "TRACE=1', -trace ignored\n");
+
+    if (frame_pool_init(&state.pool) < 0 ||
+        !(pkt = frame_pool_get_packet(state.pool))) {
         fprintf(stderr, "Cannot allocate packet\n");   
         exit(1);
     }
@@ -93,13 +265,52 @@ video decoding
      * initialized there because this information is not available in the 
      * bitstream. */
 
+    /* With frame threading the decoder works on several frames at once and
+     * hands them out thread_count - 1 packets late, but in the same order
+     * as a single thread would; the last ones come out while flushing. A
+     * decoder without the requested capability (MPEG-1 has slice threads
+     * only) falls back to whatever it supports, see active_thread_type
+     * after opening. */
+    codec_ctx->thread_count = thread_count;
+    codec_ctx->thread_type  = thread_type;
+
+    /* lowres skips most of the IDCT and motion compensation work, the
+     * box filter only saves on the output side */
+    if (scale) {
+        int lowres = scale == 4 ? 2 : 1;
+
+        if (!scale_box && codec->max_lowres >= lowres) {
+            codec_ctx->lowres = lowres;
+            snprintf(scale_desc, sizeof(scale_desc), "1/%d by lowres %d",
+                     scale, lowres);
+        } else {
+            state.scale = scale;
+            state.dk    = downscale_kernels_best(av_get_cpu_flags());
+            if (!(state.scaled = frame_pool_get_frame(state.pool))) {
+                fprintf(stderr, "Cannot allocate video frame\n");
+                goto end;
+            }
+            snprintf(scale_desc, sizeof(scale_desc), "1/%d by %s box filter",
+                     scale, state.dk->name);
+        }
+    } else {
+        snprintf(scale_desc, sizeof(scale_desc), "full resolution");
+    }
+
+    /* decoded pictures go to recycled buffers, none is allocated once
+     * as many as the decoder and the queue hold at a time exist */
+    frame_pool_attach(state.pool, codec_ctx);
+
     /* open it */
     if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
         fprintf(stderr, "Cannot open codec\n");
         goto end;
     }
 
-    decoded_frame = av_frame_alloc();
+    if (thumbs)
+        thumbnail_setup_decoder(codec_ctx);
+
+    decoded_frame = frame_pool_get_frame(state.pool);
     if (!decoded_frame) {
         fprintf(stderr, "Cannot allocate video frame\n");
         goto end;
@@ -111,19 +322,85 @@ video decoding
         goto end;
     }
 
-    while (!feof(fd)) {
+    if (!state.bench &&
+        (thumbs ? thumbnailer_open(&state.th, outfilename, thumb_width) :
+                  frame_writer_open(&state.fw, outfilename, format)) < 0)
+        goto end;
+    if (state.fw)
+        frame_writer_set_copy(state.fw, copy);
+
+    /* the decode loop only queues references to the decoded frames, the
+     * writer thread writes them out and releases them */
+    if (!state.bench && !thumbs && pipeline &&
+        (frame_queue_init(&state.queue, queue_frames,
+                          (int64_t)queue_mem << 20) < 0 ||
+         frame_queue_start_consumer(state.queue, write_frame,
+                                    state.fw) < 0)) {
+        fprintf(stderr, "Cannot start the writer thread\n");
+        goto end;
+    }
+
+    if (analyze && luma_analyzer_init(&state.la, scene_threshold) < 0) {
+        fprintf(stderr, "Cannot allocate luma analyzer\n");
+        goto end;
+    }
+
+    t_start = av_gettime_relative();
+
+    /* jump to the intra frame the range depends on; packets are then
+     * numbered from the index, so frames leaking out of the previous GOP
+     * (B-frames of an open GOP) are told apart from the wanted ones */
+    if (state.range_last && !noindex) {
+        if (gop_index_load(&index, infilename) < 0) {
+            if (gop_index_build(&index, infilename, codec->id) < 0) {
+                fprintf(stderr, "Cannot index %s\n", infilename);
+                goto end;
+            }
+            gop_index_save(index, infilename);
+            index_built = 1;
+        }
+        t_indexed = av_gettime_relative();
+
+        coded_n = gop_index_seek_point(index, state.range_first - 1);
+        if (coded_n < 0) {
+            fprintf(stderr, "Frame %d is not in %s (%d frames)\n",
+                    state.range_first, infilename, index->nb_entries);
+            goto end;
+        }
+        pos = index->entries[coded_n].offset;
+        if (fseeko(fd, pos, SEEK_SET) < 0) {
+            fprintf(stderr, "Cannot seek in %s\n", infilename);
+            goto end;
+        }
+
+        /* the decoder needs the sequence header before the first
+         * picture, it only repeats in front of some GOPs (if at all) */
+        if (coded_n > 0 && index->header_size)
+            av_parser_parse2(parser_ctx, codec_ctx, &pkt->data, &pkt->size,
+                             index->header, index->header_size,
+                             AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        state.indexed = 1;
+    }
+
+    while (!feof(fd) && !state.done) {
+        TRACE_BEGIN(t_read);
+
         /* read raw data from the input file */
         data_size = fread(inbuf, 1, INBUF_SIZE, fd);
+        TRACE_END(TRACE_READ, t_read);
         if (!data_size)
             break;
 
         /* use the parser to split the data into frames 
          * (IS 'frames' the same as ENCODED PACKETS?? YES) */
         data = inbuf;
-        while (data_size > 0) {
+        while (data_size > 0 && !state.done) {
+            TRACE_BEGIN(t_parse);
+
             ret = av_parser_parse2(parser_ctx, codec_ctx, &pkt->data, 
                                    &pkt->size, data, data_size, 
                                    AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            TRACE_END(TRACE_PARSE, t_parse);
             if (ret < 0) {
                 fprintf(stderr, "Error while parsing\n");
                 exit(1);
@@ -131,44 +408,95 @@ video decoding
             data      += ret;
             data_size -= ret;
 
-            if (pkt->size)
-                if (decode(codec_ctx, decoded_frame, pkt, outfilename) < 0)
-                    goto end;
+            if (!pkt->size)
+                continue;
+            if (state.indexed)
+                pkt->pts = coded_n < index->nb_entries ?
+                           index->entries[coded_n++].display_n :
+                           AV_NOPTS_VALUE;
+            /* the decoder would drop them anyway, but only after
+             * decoding their headers */
+            if (thumbs && parser_ctx->pict_type != AV_PICTURE_TYPE_I)
+                continue;
+            if (decode(codec_ctx, decoded_frame, pkt, &state) < 0)
+                goto end;
         }
     }
 
     /* flush the decoder */
-    if (decode(codec_ctx, decoded_frame, NULL, outfilename) < 0)
+    if (!state.done && decode(codec_ctx, decoded_frame, NULL, &state) < 0)
         goto end;
+    if (state.queue) {
+        frame_queue_finish(state.queue);
+        if (frame_queue_join_consumer(state.queue) < 0)
+            goto end;
+    }
+    t_end = av_gettime_relative();
+
+    /* with frames written, the time covers the writer draining too */
+    fprintf(stderr,
+            "decode: %d frames in %.3f s, %.1f fps, "
+            "threads %d, thread type %s\n",
+            state.frame_count, (t_end - t_start) / 1e6,
+            state.frame_count * 1e6 / FFMAX(t_end - t_start, 1),
+            codec_ctx->thread_count,
+            thread_type_name(codec_ctx->active_thread_type));
+    fprintf(stderr,
+            "output: %dx%d, %s, %"PRId64" bytes, %.1f MiB/s",
+            state.out_width, state.out_height, scale_desc, state.out_bytes,
+            state.out_bytes / 1.048576 / FFMAX(t_end - t_start, 1));
+    if (state.dk)
+        fprintf(stderr, ", %.3f ms/frame downscaling",
+                state.scale_us / 1000.0 / FFMAX(state.frame_count, 1));
+    fprintf(stderr, "\n");
+    if (state.la)
+        luma_analyzer_dump_stats(state.la, t_end - t_start, stderr);
+    if (state.th)
+        thumbnailer_dump_stats(state.th, stderr);
+    else if (!state.bench)
+        frame_writer_dump_stats(state.fw, stderr);
+    if (index)
+        fprintf(stderr,
+                "index: %d pictures, %s in %.3f ms, decoding from picture "
+                "%d at byte %"PRId64"\n",
+                index->nb_entries, index_built ? "built" : "loaded",
+                (t_indexed - t_start) / 1000.0, coded_n, pos);
+    if (state.range_last && state.t_first)
+        fprintf(stderr, "range %d:%d: frame %d reached after %.3f ms (%s)\n",
+                state.range_first, state.range_last, state.range_first,
+                (state.t_first - t_start) / 1000.0,
+                index ? "index" : "no index");
+    if (state.queue)
+        frame_queue_dump_stats(state.queue, "video", stderr);
+    frame_pool_dump_stats(state.pool, stderr);
 
 end:
     if (fd) fclose(fd);
-    av_frame_free(&decoded_frame);
+    frame_queue_free(&state.queue);
+    frame_writer_close(&state.fw);
+    thumbnailer_close(&state.th);
+    gop_index_free(&index);
+    luma_analyzer_free(&state.la);
+    frame_pool_put_frame(state.pool, &state.scaled);
+    frame_pool_put_frame(state.pool, &decoded_frame);
     avcodec_free_context(&codec_ctx);
     av_parser_close(parser_ctx);
-    av_packet_free(&pkt);
+    frame_pool_put_packet(state.pool, &pkt);
+    frame_pool_free(&state.pool);
+    /* the writer thread is gone */
+    trace_dump(stderr);
 
     return 0;
 }
 
-static void pgm_save(unsigned char *buf, int wrap,
-                     int xsize, int ysize, char *filename) {
-    int i;
-    FILE *fd;
-
-    fd = fopen(filename,"w");
-    fprintf(fd, "P5\n%d %d\n%d\n", xsize, ysize, 255);
-    for (i = 0; i < ysize; i++)
-        fwrite(buf + i * wrap, 1, xsize, fd);
-    fclose(fd);
-}
-
 static int decode(AVCodecContext *dec_ctx, AVFrame *frame,
-                  AVPacket *pkt, const char *filename) {
-    int ret;
-    char buf[1024];
+                  AVPacket *pkt, struct decode_state *state) {
+    int n, ret;
+    AVFrame *out;
+    TRACE_BEGIN(t_send);
 
     ret = avcodec_send_packet(dec_ctx, pkt);
+    TRACE_END(TRACE_SEND, t_send);
     if (ret < 0) {
         fprintf(stderr,
                 "Error sending a packet for decoding (%s)\n",
@@ -177,7 +505,10 @@ static int decode(AVCodecContext *dec_ctx, AVFrame *frame,
     }
 
     while (ret >= 0) {
+        TRACE_BEGIN(t_receive);
+
         ret = avcodec_receive_frame(dec_ctx, frame);
+        TRACE_END(TRACE_RECEIVE, t_receive);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             return 0;
         else if (ret < 0) {
@@ -187,15 +518,101 @@ static int decode(AVCodecContext *dec_ctx, AVFrame *frame,
             return -1;
         }
 
-        fprintf(stdout, "saving frame %3d\n", dec_ctx->frame_number);
+        /* count frames as they come out instead of using
+         * dec_ctx->frame_number, so numbering follows the output order
+         * whatever the threading */
+        state->frame_count++;
+        n = state->indexed && frame->pts != AV_NOPTS_VALUE ?
+            frame->pts + 1 : state->frame_count;
+        if (state->range_last) {
+            if (n < state->range_first || state->done)
+                continue;
+            if (!state->t_first)
+                state->t_first = av_gettime_relative();
+            state->done = n >= state->range_last;
+        }
+        /* inline, on the frame still hot in cache from decoding */
+        if (state->la && analyze_frame(state->la, frame, n) < 0)
+            return -1;
+
+        out = frame;
+        if (state->dk) {
+            int64_t t = av_gettime_relative();
+            TRACE_BEGIN(t_copy);
+
+            /* a new buffer each time, the queue may still hold the last;
+             * a recycled one, from the pool */
+            av_frame_unref(state->scaled);
+            downscale_geometry(state->scaled, frame, state->scale);
+            if ((ret = frame_pool_get_frame_buffer(state->pool,
+                                                   state->scaled)) < 0 ||
+                (ret = downscale_frame(state->scaled, frame, state->scale,
+                                       state->dk)) < 0) {
+                fprintf(stderr, "Cannot downscale frame %d (%s)\n", n,
+                        av_err2str(ret));
+                return -1;
+            }
+            state->scale_us += av_gettime_relative() - t;
+            TRACE_END(TRACE_COPY, t_copy);
+            out = state->scaled;
+        }
+        state->out_width  = out->width;
+        state->out_height = out->height;
+        state->out_bytes += av_image_get_buffer_size(out->format, out->width,
+                                                     out->height, 1);
+        if (state->bench)
+            continue;
+
+        fprintf(stdout, "saving frame %3d\n", n);
         fflush(stdout);
 
-        /* The picture is allocated by the decoder, no need to free it */
-        snprintf(buf, sizeof(buf), "%s-%d",
-                 filename, dec_ctx->frame_number);
-        pgm_save(frame->data[0], frame->linesize[0], 
-                 frame->width, frame->height, buf);
+        if (state->th) {
+            if (thumbnailer_write(state->th, out) < 0)
+                return -1;
+            continue;
+        }
+
+        /* The picture is allocated by the decoder, no need to free it;
+         * the frame rate only matters until the first frame is written */
+        frame_writer_set_frame_rate(state->fw, dec_ctx->framerate);
+        if (state->queue) {
+            if (frame_queue_push(state->queue, out) < 0)
+                return -1;
+        } else if (frame_writer_write(state->fw, out) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int analyze_frame(struct luma_analyzer *la, const AVFrame *frame,
+                         int n) {
+    int ret;
+    struct luma_stats stats;
+
+    if ((ret = luma_analyzer_run(la, frame, &stats)) < 0) {
+        fprintf(stderr, "Cannot analyse frame %d (%s)\n", n,
+                av_err2str(ret));
+        return -1;
+    }
+    if (stats.scene_cut) {
+        fprintf(stdout, "scene cut at frame %3d, score %.1f, mean %.1f, "
+                "variance %.1f\n",
+                n, stats.scene_score, stats.mean, stats.variance);
+        fflush(stdout);
     }
     return 0;
 }
 
+static int write_frame(void *opaque, AVFrame *frame) {
+    return frame_writer_write(opaque, frame);
+}
+
+static const char *thread_type_name(int type) {
+    switch (type) {
+        case FF_THREAD_FRAME: return "frame";
+        case FF_THREAD_SLICE: return "slice";
+        case 0:               return "none";
+        default:              return "frame+slice";
+    }
+}
@@ -0,0 +1,1310 @@
+/**
+ * @file demux_session.c
+ * demux one input and decode its best video and audio streams into raw
+ * output files (or key frame thumbnails), all state in one session so
+ * that a process can run many of them, one after the other or at once
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+
+#include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/time.h>
+#include <libavutil/timestamp.h>
+
+#include <libavformat/avformat.h>
+
+#include "demux_session.h"
+#include "fast_probe.h"
+#include "frame_queue.h"
+#include "frame_writer.h"
+#include "interleave.h"
+#include "packet_queue.h"
+#include "shm_ring.h"
+#include "thumbnail.h"
+#include "trace.h"
+#include "luma_stats.h"
+
+/*
+
+demuxing & decoding
+ ____________________________________________________________
+| avcodec_register_all();                                    |
+|                                                            |
+| - Register all the codecs, parsers and bitstream filters.  |
+|____________________________________________________________|
+| avformat_open_input(&fmt_ctx, src_filename, NULL, NULL);   | 
+|                                                            |
+| - Allocate AVFormatContext.                                |
+| - Open an input stream.                                    |
+|____________________________________________________________|
+| avformat_find_stream_info(fmt_ctx, NULL);                  |
+|                                                            |
+| - Get stream information.                                  |
+|____________________________________________________________|
+                              |
+                              |
+ _____________________________v______________________________
+| open_codec_context(&video_stream_idx, &video_dec_ctx,      |
+|                    fmt_ctx, AVMEDIA_TYPE_VIDEO);           |
+|                                                            |
+| open_codec_context(&audio_stream_idx, &audio_dec_ctx,      |
+|                    fmt_ctx, AVMEDIA_TYPE_AUDIO);           |
+|    ________________________________________________________|___
+|   | av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);       |
+|   |                                                            |
+|   | - Get AVPacket::stream_index.                              |
+|   | - Get AVStream.                                            |
+|   |____________________________________________________________|
+|   | avcodec_find_decoder(st->codecpar->codec_id);              |
+|   |                                                            |
+|   | - Find AVCodec.                                            |
+|   |____________________________________________________________|
+|   | avcodec_alloc_context3(dec);                               |
+|   |                                                            |
+|   | - Allocate AVCodecContext.                                 |
+|   |____________________________________________________________|
+|   | avcodec_parameters_to_context(*dec_ctx, st->codecpar);     |
+|   |                                                            |
+|   | - Fill AVCodecContext using parameters of AVCodec.         |
+|   |____________________________________________________________|
+|   | avcodec_open2(*dec_ctx, dec, &opts);                       |
+|   |                                                            |
+|   | - Open AVCodec with AVDictionary.                          |
+|   |____________________________________________________________|
+|                                                            |
+| - Get AVPacket::width, AVPacket::height.                   |
+| - Get AVPixelFormat.                                       |
+|____________________________________________________________|
+                              |
+                              |
+ _____________________________v______________________________
+| frame_writer_open(&video_writer, video_dst_filename,       |
+|                   FRAME_WRITER_RAW);                       |
+|                                                            |
+| fopen(audio_dst_filename, "wb");                           |
+|                                                            |
+| - Open video / audio output stream.                        |
+|____________________________________________________________|
+| frame_pool_get_frame(pool);                                |
+|                                                            |
+| - Allocate AVFrame, or reuse a recycled one.               |
+|____________________________________________________________|
+| av_init_packet(&pkt);                                      |
+|                                                            |
+| - Initialize some fields of AVPacket with default values.  |
+|____________________________________________________________|
+                              |
+                              |
+ _____________________________v______________________________
+| av_read_frame(fmt_ctx, &pkt);                              |
+|                                                            |
+| - Get next encoded AVPacket from AVFormatContext::Stream.  |
+|____________________________________________________________|
+| decode_packet(dec_ctx, &pkt, frame, 0);                    |
+|    ________________________________________________________|___
+|   | avcodec_send_packet(video_dec_ctx, &pkt);                  |
+|   |                                                            | 
+|   | avcodec_send_packet(audio_dec_ctx, &pkt);                  |
+|   |                                                            |
+|   | - Send encoded AVPacket to AVCodec.                        | 
+|   |____________________________________________________________|
+|   | avcodec_receive_frame(video_dec_ctx, frame);               |
+|   |                                                            | 
+|   | avcodec_receive_frame(video_dec_ctx, frame);               |
+|   |                                                            |
+|   | - Receive decoded AVFrame from AVCodec.                    | 
+|   |____________________________________________________________|
+|   | frame_writer_write(video_writer, frame);                   |
+|   |                                                            |
+|   | - Write AVFrame::data without the AVFrame::linesize        |
+|   |   padding, whole planes or row by row in one writev().     |
+|   |                                                            |
+|   | fwrite(frame->extended_data[0], 1,                         |
+|   |        unpadded_linesize, audio_dst_file);                 |
+|   |                                                            |
+|   | - Write decoded AVFrame to video/audio output stream.      |
+|   |____________________________________________________________|
+|                                                            | 
+|____________________________________________________________|
+                              |
+                              |
+                              v
+
+*/
+
+struct demux_session {
+    struct demux_options opts;
+    char *src_filename;
+    char *video_dst_filename;
+    char *audio_dst_filename;
+
+    struct frame_pool  *pool;   /* decoder buffers and frames, recycled */
+    int                 own_pool;
+    struct probe_cache *cache;  /* shared, or NULL */
+
+    AVFormatContext *fmt_ctx;
+    AVCodecContext  *video_dec_ctx;
+    AVCodecContext  *audio_dec_ctx;
+    int       video_stream_idx;
+    int       audio_stream_idx;
+    AVStream *video_stream;
+    AVStream *audio_stream;
+
+    /* with -pipeline decoded frames go through these to the writer
+     * threads */
+    struct frame_queue *video_queue;
+    struct frame_queue *audio_queue;
+
+    /* demux loop to per-stream decoder threads, with -parallel */
+    struct packet_queue *video_packets;
+    struct packet_queue *audio_packets;
+
+    /* per-frame luma statistics of the video, or NULL */
+    struct luma_analyzer *analyzer;
+
+    /* unpadded raw video, written straight from the decoded planes */
+    struct frame_writer *video_writer;
+    /* the same frames for another process, or NULL */
+    struct shm_ring     *video_ring;
+    /* planar audio to packed samples, one write per frame */
+    struct interleaver  *audio_il;
+    FILE *audio_dst_file;
+
+    int width, height;
+    enum AVPixelFormat pix_fmt;
+
+    /* with a remux output: the muxer, and the output stream of every
+     * input stream known when it was opened (-1: dropped); streams added
+     * later on (FLV, AVFMTCTX_NOHEADER) lie past nb_mapped, dropped too */
+    AVFormatContext *ofmt_ctx;
+    int             *stream_map;
+    int              nb_mapped;
+    int              nb_remuxed_streams;
+
+    AVPacket pkt; /* sizeof(AVPacket) is public ABI */
+    AVFrame *frame;
+    AVFrame *audio_frame; /* the audio thread's, with -parallel */
+
+    /* start_time / duration in AV_TIME_BASE units, the start of the input
+     * included; a stream is done once its packets pass range_end */
+    int64_t range_start;
+    int64_t range_end;
+    int     video_done;
+    int     audio_done;
+    int64_t t_start;
+
+    struct demux_session_stats stats;
+};
+
+static int open_outputs(struct demux_session *);
+static int start_threads(struct demux_session *);
+static int decode_packet(struct demux_session *, AVCodecContext *,
+                         const AVPacket *, AVFrame *, int);
+static int read_packet(AVFormatContext *, AVPacket *);
+static int past_end(struct demux_session *, const AVPacket *);
+static int in_range(struct demux_session *, AVStream *, const AVFrame *,
+                    int64_t);
+static int decode_queued_video(void *, AVPacket *);
+static int decode_queued_audio(void *, AVPacket *);
+static int write_video_frame(void *, AVFrame *);
+static int write_audio_frame(void *, AVFrame *);
+static int extract_thumbnails(struct demux_session *);
+static int open_remux(struct demux_session *);
+static int remux_packets(struct demux_session *);
+static int64_t estimate_video_frames(struct demux_session *);
+static int open_codec_context(struct demux_session *, int *,
+                              AVCodecContext **, enum AVMediaType, int);
+static int get_format_from_sample_fmt(const char **, enum AVSampleFormat);
+
+int demux_session_create(struct demux_session **s, const char *src_filename,
+                         const char *video_dst_filename,
+                         const char *audio_dst_filename,
+                         const struct demux_options *opts,
+                         struct frame_pool *pool, struct probe_cache *cache) {
+    int ret;
+    struct demux_session *ds;
+    AVDictionary *open_opts = NULL;
+
+    if (!(ds = av_mallocz(sizeof(*ds))))
+        return AVERROR(ENOMEM);
+    *s = ds;
+    ds->opts             = *opts;
+    ds->cache            = cache;
+    ds->video_stream_idx = -1;
+    ds->audio_stream_idx = -1;
+    if (!(ds->src_filename = av_strdup(src_filename)) ||
+        (video_dst_filename &&
+         !(ds->video_dst_filename = av_strdup(video_dst_filename))) ||
+        (audio_dst_filename &&
+         !(ds->audio_dst_filename = av_strdup(audio_dst_filename)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (!(ds->pool = pool)) {
+        if ((ret = frame_pool_init(&ds->pool)) < 0)
+            goto fail;
+        ds->own_pool = 1;
+    }
+
+    /* open input file, and allocate format context (fmt_ctx point to NULL,
+     * in which case an AVFormatContext is allocated by this function) */
+    if (opts->fast && (ret = fast_probe_open_options(&open_opts)) < 0)
+        goto fail;
+    ret = avformat_open_input(&ds->fmt_ctx, src_filename, NULL, &open_opts);
+    av_dict_free(&open_opts);
+    if (ret < 0) {
+        fprintf(stderr,
+                "Could not open source file '%s' (%s)\n",
+                src_filename, av_err2str(ret));
+        goto fail;
+    }
+
+    /* retrieve stream information, or take it from the probe cache */
+    if ((ret = cache ?
+               probe_cache_find_stream_info(cache, src_filename,
+                                            ds->fmt_ctx) :
+               opts->fast ? fast_probe_find_stream_info(ds->fmt_ctx) :
+               avformat_find_stream_info(ds->fmt_ctx, NULL)) < 0) {
+        fprintf(stderr,
+                "Could not find stream information (%s)\n",
+                av_err2str(ret));
+        goto fail;
+    }
+
+    /* thumbnails set their decoder up when they run */
+    if (opts->thumb_prefix)
+        return 0;
+
+    if (opts->remux_filename) {
+        if ((ret = open_remux(ds)) < 0)
+            goto fail;
+        return 0;
+    }
+
+    if ((ret = open_outputs(ds)) < 0 || (ret = start_threads(ds)) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    demux_session_destroy(s);
+    return ret;
+}
+
+int demux_session_run(struct demux_session *s) {
+    int i, ret = 0;
+    int64_t t_start = s->t_start = av_gettime_relative();
+
+    if (s->opts.thumb_prefix) {
+        ret = extract_thumbnails(s);
+        goto end;
+    } else if (s->ofmt_ctx) {
+        ret = remux_packets(s);
+        goto end;
+    }
+
+    s->range_start = (int64_t)(s->opts.start_time * AV_TIME_BASE);
+    if (s->fmt_ctx->start_time != AV_NOPTS_VALUE)
+        s->range_start += s->fmt_ctx->start_time;
+    s->range_end = s->opts.duration > 0 ?
+                   s->range_start + (int64_t)(s->opts.duration *
+                                              AV_TIME_BASE) : INT64_MAX;
+
+    /* land on the last key frame at or before the start, the decoders
+     * run up from there and the frames before the start are cut */
+    if (s->opts.start_time > 0) {
+        if ((ret = avformat_seek_file(s->fmt_ctx, -1, INT64_MIN,
+                                      s->range_start, s->range_start,
+                                      0)) < 0) {
+            fprintf(stderr, "Could not seek to %.3f s in '%s' (%s)\n",
+                    s->opts.start_time, s->src_filename, av_err2str(ret));
+            goto end;
+        }
+        s->stats.seek_us = av_gettime_relative() - t_start;
+    }
+
+    /* read frames (encoded packets) from the file */
+    while (read_packet(s->fmt_ctx, &s->pkt) >= 0) {
+        int idx = s->pkt.stream_index;
+
+        s->stats.nb_packets++;
+        /* avcodec_send_packet() always takes the whole packet, a queue
+         * takes the references */
+        if (idx == s->video_stream_idx && !s->video_done &&
+            !(s->video_done = past_end(s, &s->pkt)))
+            ret = s->video_packets ?
+                  packet_queue_push(s->video_packets, &s->pkt) :
+                  decode_packet(s, s->video_dec_ctx, &s->pkt, s->frame, 0);
+        else if (idx == s->audio_stream_idx && !s->audio_done &&
+                 !(s->audio_done = past_end(s, &s->pkt)))
+            ret = s->audio_packets ?
+                  packet_queue_push(s->audio_packets, &s->pkt) :
+                  decode_packet(s, s->audio_dec_ctx, &s->pkt, s->frame, 0);
+        else if (idx == s->video_stream_idx || idx == s->audio_stream_idx)
+            s->stats.nb_past_end++;
+        else
+            s->stats.nb_dropped++;
+        /* unreference the buffer referenced by the packet and reset the
+         * remaining packet fields to their default values, the demuxer
+         * hands out a new reference each time whatever the frame mode */
+        av_packet_unref(&s->pkt);
+        if (ret < 0)
+            break;
+        /* every stream past the end of the range, the rest is not read */
+        if ((!s->video_stream || s->video_done) &&
+            (!s->audio_stream || s->audio_done))
+            break;
+    }
+
+    if (s->opts.parallel) {
+        /* the decoder threads flush at the end of their queues; a failed
+         * push only means one of them gave up, report its error */
+        for (i = 0; i < 2; i++) {
+            struct packet_queue *q = i ? s->audio_packets : s->video_packets;
+            int err;
+
+            if (!q)
+                continue;
+            packet_queue_finish(q);
+            err = packet_queue_join_consumer(q);
+            if (err < 0 && (ret >= 0 || ret == AVERROR_EXIT))
+                ret = err;
+        }
+    } else if (ret >= 0) {
+        /* flush cached frames, each decoder on its own */
+        for (i = 0; i < 2; i++) {
+            AVCodecContext *dec_ctx = i ? s->audio_dec_ctx :
+                                          s->video_dec_ctx;
+
+            if (dec_ctx &&
+                (ret = decode_packet(s, dec_ctx, NULL, s->frame, 1)) < 0) {
+                fprintf(stderr, "Error sending the flush packet\n");
+                break;
+            }
+        }
+    }
+    if (ret < 0)
+        goto end;
+
+    /* let the writers drain their queues */
+    for (i = 0; i < 2; i++) {
+        struct frame_queue *q = i ? s->audio_queue : s->video_queue;
+
+        if (!q)
+            continue;
+        frame_queue_finish(q);
+        if ((ret = frame_queue_join_consumer(q)) < 0)
+            goto end;
+    }
+
+end:
+    s->stats.run_us     = av_gettime_relative() - t_start;
+    s->stats.bytes_read = s->fmt_ctx->pb ? s->fmt_ctx->pb->bytes_read : 0;
+    if (s->ofmt_ctx && s->ofmt_ctx->pb)
+        s->stats.bytes_written = avio_tell(s->ofmt_ctx->pb);
+
+    return ret;
+}
+
+void demux_session_destroy(struct demux_session **s) {
+    struct demux_session *ds = *s;
+
+    if (!ds)
+        return;
+
+    /* stop the decoders and then the writers first, they still use the
+     * files and buffers */
+    packet_queue_free(&ds->video_packets);
+    packet_queue_free(&ds->audio_packets);
+    frame_queue_free(&ds->video_queue);
+    frame_queue_free(&ds->audio_queue);
+    luma_analyzer_free(&ds->analyzer);
+    avcodec_free_context(&ds->video_dec_ctx);
+    avcodec_free_context(&ds->audio_dec_ctx);
+    avformat_close_input(&ds->fmt_ctx);
+    if (ds->ofmt_ctx) {
+        if (!(ds->ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&ds->ofmt_ctx->pb);
+        avformat_free_context(ds->ofmt_ctx);
+    }
+    av_free(ds->stream_map);
+    frame_writer_close(&ds->video_writer);
+    shm_ring_close(&ds->video_ring);
+    if (ds->audio_dst_file) fclose(ds->audio_dst_file);
+    if (ds->pool) {
+        frame_pool_put_frame(ds->pool, &ds->frame);
+        frame_pool_put_frame(ds->pool, &ds->audio_frame);
+        if (ds->own_pool)
+            frame_pool_free(&ds->pool);
+    }
+    interleaver_free(&ds->audio_il);
+    av_free(ds->src_filename);
+    av_free(ds->video_dst_filename);
+    av_free(ds->audio_dst_filename);
+    av_freep(s);
+}
+
+const struct demux_session_stats *demux_session_get_stats(
+        struct demux_session *s) {
+    return &s->stats;
+}
+
+void demux_session_dump_stats(struct demux_session *s, FILE *fp) {
+    int i, nb_discarded = 0;
+
+    if (s->opts.thumb_prefix)
+        return;
+
+    for (i = 0; i < s->fmt_ctx->nb_streams; i++)
+        nb_discarded += s->fmt_ctx->streams[i]->discard == AVDISCARD_ALL;
+
+    if (s->ofmt_ctx) {
+        fprintf(fp,
+                "remux: %"PRId64" packets of %d streams copied (%"PRId64" "
+                "dropped) in %.3f s, %.1f MiB read, %.1f MiB written, "
+                "%.1f MiB/s\n",
+                s->stats.nb_packets - s->stats.nb_dropped,
+                s->nb_remuxed_streams, s->stats.nb_dropped,
+                s->stats.run_us / 1e6,
+                s->stats.bytes_read / (double)(1 << 20),
+                s->stats.bytes_written / (double)(1 << 20),
+                s->stats.bytes_read / (double)(1 << 20) * 1e6 /
+                FFMAX(s->stats.run_us, 1));
+        return;
+    }
+
+    fprintf(fp,
+            "decode and write: %d video / %d audio frames in %.3f s%s%s\n",
+            s->stats.video_frames, s->stats.audio_frames,
+            s->stats.run_us / 1e6,
+            s->opts.parallel ? " (parallel decoders)" : "",
+            s->opts.pipeline ? " (pipelined)" : "");
+    fprintf(fp,
+            "demux: %"PRId64" packets read (%"PRId64" dropped, %"PRId64" "
+            "past the end), %"PRId64" bytes (%.1f MiB) read from the "
+            "input, %d of %d streams discarded by the demuxer\n",
+            s->stats.nb_packets, s->stats.nb_dropped, s->stats.nb_past_end,
+            s->stats.bytes_read,
+            s->stats.bytes_read / (double)(1 << 20), nb_discarded,
+            s->fmt_ctx->nb_streams);
+    if (s->opts.start_time > 0 || s->opts.duration > 0)
+        fprintf(fp,
+                "range: from %.3f s for %.3f s, seek %.3f ms, first video "
+                "frame after %.3f ms, first audio frame after %.3f ms, %d "
+                "video / %d audio frames cut\n",
+                s->opts.start_time, s->opts.duration,
+                s->stats.seek_us / 1000.0, s->stats.first_video_us / 1000.0,
+                s->stats.first_audio_us / 1000.0,
+                s->stats.video_cut, s->stats.audio_cut);
+    if (s->video_writer)
+        frame_writer_dump_stats(s->video_writer, fp);
+    if (s->video_ring)
+        shm_ring_dump_stats(s->video_ring, fp);
+    if (s->audio_il)
+        interleaver_dump_stats(s->audio_il, fp);
+    if (s->video_packets)
+        packet_queue_dump_stats(s->video_packets, "video", fp);
+    if (s->audio_packets)
+        packet_queue_dump_stats(s->audio_packets, "audio", fp);
+    if (s->analyzer)
+        luma_analyzer_dump_stats(s->analyzer, s->stats.run_us, fp);
+    if (s->video_queue)
+        frame_queue_dump_stats(s->video_queue, "video", fp);
+    if (s->audio_queue)
+        frame_queue_dump_stats(s->audio_queue, "audio", fp);
+}
+
+int demux_session_print_play(struct demux_session *s, FILE *fp) {
+    int ret;
+
+    if (s->video_stream) {
+        fprintf(fp,
+                "Play the output video file with the command:\n"
+                "ffplay -f rawvideo -pix_fmt %s -video_size %dx%d %s\n",
+                av_get_pix_fmt_name(s->pix_fmt), s->width, s->height,
+                s->video_dst_filename);
+    }
+
+    if (s->audio_stream) {
+        enum AVSampleFormat sfmt = s->audio_dec_ctx->sample_fmt;
+        int n_channels = s->audio_dec_ctx->channels;
+        const char *fmt;
+
+        if (av_sample_fmt_is_planar(sfmt)) {
+            const char *planar = av_get_sample_fmt_name(sfmt);
+            sfmt = av_get_packed_sample_fmt(sfmt);
+            fprintf(fp, 
+                    "The sample format the decoder produced is planar "
+                    "(%s),\n"
+                    "all %d channels were written interleaved (%s).\n",
+                    planar ? planar : "?", n_channels,
+                    av_get_sample_fmt_name(sfmt));
+        }
+
+        if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0)
+            return ret;
+
+        fprintf(fp, 
+                "Play the output audio file with the command:\n"
+                "ffplay -f %s -ac %d -ar %d %s\n",
+                fmt, n_channels, s->audio_dec_ctx->sample_rate,
+                s->audio_dst_filename);
+    }
+
+    return 0;
+}
+
+static int open_outputs(struct demux_session *s) {
+    int i, ret;
+    int want_video = !s->opts.audio_only;
+    int want_audio = !s->opts.video_only;
+    int wanted     = s->opts.stream_index;
+
+    if (wanted >= (int)s->fmt_ctx->nb_streams) {
+        fprintf(stderr, "Stream #%d not found, '%s' has %d streams\n",
+                wanted, s->src_filename, s->fmt_ctx->nb_streams);
+        return AVERROR_STREAM_NOT_FOUND;
+    } else if (wanted >= 0) {
+        enum AVMediaType type = s->fmt_ctx->streams[wanted]->codecpar->
+                                codec_type;
+
+        want_video &= type == AVMEDIA_TYPE_VIDEO;
+        want_audio &= type == AVMEDIA_TYPE_AUDIO;
+    }
+
+    if (want_video &&
+        open_codec_context(s, &s->video_stream_idx, &s->video_dec_ctx,
+                           AVMEDIA_TYPE_VIDEO, wanted) >= 0) {
+        s->video_stream = s->fmt_ctx->streams[s->video_stream_idx];
+        if ((ret = frame_writer_open(&s->video_writer, s->video_dst_filename,
+                                     FRAME_WRITER_RAW)) < 0)
+            return ret;
+        frame_writer_set_copy(s->video_writer, s->opts.copy);
+        if (s->opts.mmap)
+            frame_writer_set_mmap(s->video_writer,
+                                  estimate_video_frames(s));
+        if (s->opts.shm_name &&
+            (ret = shm_ring_create(&s->video_ring, s->opts.shm_name,
+                                   s->opts.shm_slots, s->opts.shm_drop,
+                                   s->video_stream->time_base)) < 0)
+            return ret;
+
+        /* a fast probe may leave the geometry (width 0) to the first
+         * frame */
+        s->width   = s->video_dec_ctx->width;
+        s->height  = s->video_dec_ctx->height;
+        s->pix_fmt = s->video_dec_ctx->pix_fmt;
+        if (s->width <= 0 || s->height <= 0 || s->pix_fmt == AV_PIX_FMT_NONE)
+            s->width = 0;
+    }
+
+    if (want_audio &&
+        open_codec_context(s, &s->audio_stream_idx, &s->audio_dec_ctx,
+                           AVMEDIA_TYPE_AUDIO, wanted) >= 0) {
+        s->audio_stream = s->fmt_ctx->streams[s->audio_stream_idx];
+        s->audio_dst_file = fopen(s->audio_dst_filename, "wb");
+        if (!s->audio_dst_file) {
+            fprintf(stderr, 
+                    "Could not open destination file '%s'\n",
+                    s->audio_dst_filename);
+            return AVERROR(errno);
+        }
+        if ((ret = interleaver_init(&s->audio_il)) < 0)
+            return ret;
+    }
+
+    /* dump input information to stderr */
+    if (!s->opts.quiet) {
+        av_dump_format(s->fmt_ctx, 0, s->src_filename, 0);
+        if (s->opts.fast)
+            fast_probe_report_incomplete(s->fmt_ctx, stderr);
+    }
+
+    if (!s->audio_stream && !s->video_stream) {
+        fprintf(stderr, 
+                "Could not find audio or video "
+                "stream in the input, aborting\n");
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+
+    /* the demuxer skips the packets of every other stream (seeking over
+     * them where the container allows), they are never read into memory */
+    for (i = 0; !s->opts.no_discard && i < s->fmt_ctx->nb_streams; i++)
+        if (i != s->video_stream_idx && i != s->audio_stream_idx)
+            s->fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+
+    if (!(s->frame = frame_pool_get_frame(s->pool))) {
+        fprintf(stderr, "Could not allocate frame\n");
+        return AVERROR(ENOMEM);
+    }
+
+    /* initialize packet, set data to NULL, let the demuxer fill it */
+    av_init_packet(&s->pkt);
+    s->pkt.data = NULL;
+    s->pkt.size = 0;
+
+    if (s->opts.analyze && s->video_stream &&
+        (ret = luma_analyzer_init(&s->analyzer,
+                                  s->opts.scene_threshold)) < 0) {
+        fprintf(stderr, "Could not allocate luma analyzer\n");
+        return ret;
+    }
+
+    if (!s->opts.quiet) {
+        if (s->video_stream)
+            fprintf(stdout, 
+                    "Demuxing video from file '%s' into '%s'\n", 
+                    s->src_filename, s->video_dst_filename);
+        if (s->audio_stream)
+            fprintf(stdout, 
+                    "Demuxing audio from file '%s' into '%s'\n", 
+                    s->src_filename, s->audio_dst_filename);
+    }
+
+    return 0;
+}
+
+static int start_threads(struct demux_session *s) {
+    int ret = 0;
+    int64_t queue_mem = (int64_t)s->opts.queue_mem << 20;
+
+    /* the decode loop only queues references to the decoded frames, the
+     * writer threads copy them out to the files and release them */
+    if (s->opts.pipeline) {
+        if ((s->video_stream &&
+             ((ret = frame_queue_init(&s->video_queue, s->opts.queue_frames,
+                                      queue_mem)) < 0 ||
+              (ret = frame_queue_start_consumer(s->video_queue,
+                                                write_video_frame, s)) < 0)) ||
+            (s->audio_stream &&
+             ((ret = frame_queue_init(&s->audio_queue, s->opts.queue_frames,
+                                      queue_mem)) < 0 ||
+              (ret = frame_queue_start_consumer(s->audio_queue,
+                                                write_audio_frame, s)) < 0))) {
+            fprintf(stderr, "Could not start the writer threads\n");
+            return ret;
+        }
+    }
+
+    /* each decoder gets a thread and a frame of its own, the demux loop
+     * only routes packets */
+    if (s->opts.parallel) {
+        if (s->audio_stream &&
+            !(s->audio_frame = frame_pool_get_frame(s->pool))) {
+            fprintf(stderr, "Could not allocate frame\n");
+            return AVERROR(ENOMEM);
+        }
+        if ((s->video_stream &&
+             ((ret = packet_queue_init(&s->video_packets, 0)) < 0 ||
+              (ret = packet_queue_start_consumer(s->video_packets,
+                                                 decode_queued_video,
+                                                 s)) < 0)) ||
+            (s->audio_stream &&
+             ((ret = packet_queue_init(&s->audio_packets, 0)) < 0 ||
+              (ret = packet_queue_start_consumer(s->audio_packets,
+                                                 decode_queued_audio,
+                                                 s)) < 0))) {
+            fprintf(stderr, "Could not start the decoder threads\n");
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/* a NULL pkt flushes dec_ctx, cached only tags the frames that come out;
+ * with -parallel the video and audio threads run it concurrently, on
+ * their own decoder, frame, counter and output */
+static int decode_packet(struct demux_session *s, AVCodecContext *dec_ctx,
+                         const AVPacket *pkt, AVFrame *frame, int cached) {
+    int ret = 0;
+    // int got_frame;
+
+    if (dec_ctx == s->video_dec_ctx) {
+
+        /* WARNING: 'avcodec_decode_video2()' is deprecated, if enable the
+         * reference counting, the caller must release the frame using
+         * av_frame_unref() */
+
+        // ret = avcodec_decode_video2(video_dec_ctx,
+        //                             frame, &got_frame, &pkt);
+        
+        TRACE_BEGIN(t_send);
+        ret = avcodec_send_packet(dec_ctx, pkt);
+        TRACE_END(TRACE_SEND, t_send);
+        if (ret < 0) {
+            fprintf(stderr, 
+                    "Error sending a video packet for decoding (%s)\n",
+                    av_err2str(ret));
+            return ret;
+        } 
+        
+        while (ret >= 0) {
+            TRACE_BEGIN(t_receive);
+            ret = avcodec_receive_frame(dec_ctx, frame);
+            TRACE_END(TRACE_RECEIVE, t_receive);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                return 0;
+            } else if (ret < 0) {
+                fprintf(stderr,
+                        "Error during decoding video frames (%s)\n",
+                        av_err2str(ret));
+                return ret;
+            }
+
+            if (!in_range(s, s->video_stream, frame, 0)) {
+                s->stats.video_cut++;
+                av_frame_unref(frame);
+                continue;
+            }
+            if (!s->stats.first_video_us)
+                s->stats.first_video_us = av_gettime_relative() - s->t_start;
+
+            if (!s->width) {
+                s->width   = frame->width;
+                s->height  = frame->height;
+                s->pix_fmt = frame->format;
+            }
+
+            if (frame->width  != s->width  ||
+                frame->height != s->height || frame->format != s->pix_fmt) {
+                /* To handle this change, one could open another frame
+                 * writer and decode the following frames into another
+                 * rawvideo file. */
+                fprintf(stderr, 
+                        "Error: width, height and pixel format have to be "
+                        "constant in a rawvideo file, but the width, height "
+                        "or pixel format of the input video changed:\n"
+                        "old: width = %d, height = %d, format = %s\n"
+                        "new: width = %d, height = %d, format = %s\n",
+                        s->width, s->height, av_get_pix_fmt_name(s->pix_fmt),
+                        frame->width, frame->height,
+                        av_get_pix_fmt_name(frame->format));
+                return -1;
+            }
+
+            if (!s->opts.quiet)
+                fprintf(stdout, 
+                        "video_frame%s n:%d coded_n:%d\n",
+                        cached ? "(cached)" : "", s->stats.video_frames,
+                        frame->coded_picture_number);
+            s->stats.video_frames++;
+
+            if (s->analyzer) {
+                struct luma_stats stats;
+
+                if ((ret = luma_analyzer_run(s->analyzer, frame,
+                                             &stats)) < 0) {
+                    fprintf(stderr, "Could not analyse video frame (%s)\n",
+                            av_err2str(ret));
+                    return ret;
+                }
+                if (!s->opts.quiet)
+                    fprintf(stdout,
+                            "video_frame_luma mean:%.2f variance:%.2f "
+                            "scene_score:%.2f%s\n",
+                            stats.mean, stats.variance, stats.scene_score,
+                            stats.scene_cut ? " scene_cut" : "");
+            }
+
+            /* hand the references over to the writer thread, or write
+             * the frame out right here */
+            ret = s->video_queue ? frame_queue_push(s->video_queue, frame) :
+                                   write_video_frame(s, frame);
+            if (ret < 0)
+                return ret;
+        }
+    } else if (dec_ctx == s->audio_dec_ctx) {
+
+        /* WARNING: 'avcodec_decode_audio4()' is deprecated, if enable the
+         * reference counting, the caller must release the frame using
+         * av_frame_unref() */
+
+        // ret = avcodec_decode_audio4(audio_dec_ctx,
+        //                             frame, &got_frame, &pkt); */
+
+        TRACE_BEGIN(t_send);
+        ret = avcodec_send_packet(dec_ctx, pkt);
+        TRACE_END(TRACE_SEND, t_send);
+        if (ret < 0) {
+            fprintf(stderr, 
+                    "Error sending a audio packet for decoding (%s)\n",
+                    av_err2str(ret));
+            return ret;
+        }
+
+        /* Unlike avcodec_decode_audio4(), which could decode only part of
+         * the packet and had to be called again with the remainder,
+         * avcodec_send_packet() always consumes the whole packet. */
+
+        while (ret >= 0) {
+            TRACE_BEGIN(t_receive);
+            ret = avcodec_receive_frame(dec_ctx, frame);
+            TRACE_END(TRACE_RECEIVE, t_receive);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                return 0;
+            } else if (ret < 0) {
+                fprintf(stderr,
+                        "Error during decoding audio frames (%s)\n",
+                        av_err2str(ret));
+                return ret;
+            }
+
+            /* an audio frame is kept if any of its samples is in range */
+            if (!in_range(s, s->audio_stream, frame,
+                          frame->sample_rate > 0 ?
+                          av_rescale_q(frame->nb_samples,
+                                       (AVRational){1, frame->sample_rate},
+                                       s->audio_stream->time_base) : 0)) {
+                s->stats.audio_cut++;
+                av_frame_unref(frame);
+                continue;
+            }
+            if (!s->stats.first_audio_us)
+                s->stats.first_audio_us = av_gettime_relative() - s->t_start;
+
+            if (!s->opts.quiet)
+                fprintf(stdout, 
+                        "audio_frame%s n:%d nb_samples:%d pts:%s\n",
+                        cached ? "(cached)" : "", 
+                        s->stats.audio_frames, frame->nb_samples, 
+                        av_ts2timestr(frame->pts, &dec_ctx->time_base));
+            s->stats.audio_frames++;
+
+            ret = s->audio_queue ? frame_queue_push(s->audio_queue, frame) :
+                                   write_audio_frame(s, frame);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    /* If we use frame reference counting, we own the data and need to 
+     * de-reference it when we don't use it anymore.
+     * The function av_frame_unref() unreference all the buffers referenced
+     * by frame and reset the frame fields */
+
+    // if (refcount)
+    //     av_frame_unref(frame);
+
+    return 0;
+}
+
+/* av_read_frame(), timed as TRACE_READ */
+static int read_packet(AVFormatContext *fmt_ctx, AVPacket *pkt) {
+    int ret;
+    TRACE_BEGIN(t);
+
+    ret = av_read_frame(fmt_ctx, pkt);
+    TRACE_END(TRACE_READ, t);
+
+    return ret;
+}
+
+/* pkt starts at or after range_end: so does every later packet of its
+ * stream (dts only grows), and no frame of theirs is in range */
+static int past_end(struct demux_session *s, const AVPacket *pkt) {
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+
+    return s->range_end != INT64_MAX && ts != AV_NOPTS_VALUE &&
+           av_compare_ts(ts, s->fmt_ctx->streams[pkt->stream_index]->
+                         time_base, s->range_end, AV_TIME_BASE_Q) >= 0;
+}
+
+/* frame (of st, lasting duration in st->time_base) overlaps the range;
+ * frames without a timestamp are kept */
+static int in_range(struct demux_session *s, AVStream *st,
+                    const AVFrame *frame, int64_t duration) {
+    int64_t ts = frame->best_effort_timestamp;
+
+    if (ts == AV_NOPTS_VALUE)
+        return 1;
+    if (s->opts.start_time > 0 &&
+        (duration > 0 ?
+         av_compare_ts(ts + duration, st->time_base,
+                       s->range_start, AV_TIME_BASE_Q) <= 0 :
+         av_compare_ts(ts, st->time_base,
+                       s->range_start, AV_TIME_BASE_Q) < 0))
+        return 0;
+
+    return s->range_end == INT64_MAX ||
+           av_compare_ts(ts, st->time_base,
+                         s->range_end, AV_TIME_BASE_Q) < 0;
+}
+
+/* pkt is NULL at the end of the queue, which flushes the decoder */
+static int decode_queued_video(void *opaque, AVPacket *pkt) {
+    struct demux_session *s = opaque;
+
+    return decode_packet(s, s->video_dec_ctx, pkt, s->frame, !pkt);
+}
+
+static int decode_queued_audio(void *opaque, AVPacket *pkt) {
+    struct demux_session *s = opaque;
+
+    return decode_packet(s, s->audio_dec_ctx, pkt, s->audio_frame, !pkt);
+}
+
+static int write_video_frame(void *opaque, AVFrame *frame) {
+    int ret;
+    struct demux_session *s = opaque;
+
+    if (s->video_ring && (ret = shm_ring_publish(s->video_ring, frame)) < 0)
+        return ret;
+
+    /* rawvideo expects non aligned data, the writer leaves the linesize
+     * padding out by handing writev() whole planes when there is none,
+     * and the rows of each plane otherwise, no copy in between */
+    return frame_writer_write(s->video_writer, frame);
+}
+
+static int write_audio_frame(void *opaque, AVFrame *frame) {
+    struct demux_session *s = opaque;
+
+    /* Packed formats (e.g. AV_SAMPLE_FMT_S16) are written as they are.
+     * Most audio decoders output planar audio though, a separate plane of
+     * samples for each channel (e.g. AV_SAMPLE_FMT_S16P); those frames
+     * are interleaved into packed samples of every channel first, then
+     * written with a single fwrite() either way. */
+    return interleaver_write(s->audio_il, frame, s->audio_dst_file);
+}
+
+static int extract_thumbnails(struct demux_session *s) {
+    int i, ret;
+    int nb_decoded = 0;
+    int64_t step, next_ts = AV_NOPTS_VALUE, seek_ts = AV_NOPTS_VALUE;
+    int64_t t_start = av_gettime_relative();
+    struct thumbnailer *th = NULL;
+    AVFormatContext *fmt_ctx = s->fmt_ctx;
+    AVPacket *pkt = &s->pkt;
+
+    if ((ret = open_codec_context(s, &s->video_stream_idx, &s->video_dec_ctx,
+                                  AVMEDIA_TYPE_VIDEO,
+                                  s->opts.stream_index)) < 0)
+        return ret;
+    s->video_stream = fmt_ctx->streams[s->video_stream_idx];
+    thumbnail_setup_decoder(s->video_dec_ctx);
+
+    /* the demuxer may then skip the other streams without reading them */
+    for (i = 0; i < fmt_ctx->nb_streams; i++)
+        if (i != s->video_stream_idx)
+            fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+
+    step = s->opts.thumb_every > 0 ?
+           s->opts.thumb_every / av_q2d(s->video_stream->time_base) : 0;
+    if (!(s->frame = frame_pool_get_frame(s->pool)) ||
+        (ret = thumbnailer_open(&th, s->opts.thumb_prefix,
+                                s->opts.thumb_width)) < 0) {
+        ret = s->frame ? ret : AVERROR(ENOMEM);
+        goto end;
+    }
+
+    av_init_packet(pkt);
+    pkt->data = NULL;
+    pkt->size = 0;
+
+    for (;;) {
+        int eof = read_packet(fmt_ctx, pkt) < 0;
+
+        if (!eof) {
+            /* non-key packets never make it into a thumbnail, neither do
+             * key frames before the next due time */
+            if (pkt->stream_index != s->video_stream_idx ||
+                !(pkt->flags & AV_PKT_FLAG_KEY) ||
+                (next_ts != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE &&
+                 pkt->pts < next_ts)) {
+                /* far from due, let the demuxer jump to the first key
+                 * frame after it (once, an inexact seek must not loop) */
+                if (next_ts != AV_NOPTS_VALUE && seek_ts != next_ts &&
+                    pkt->stream_index == s->video_stream_idx &&
+                    pkt->pts != AV_NOPTS_VALUE &&
+                    next_ts - pkt->pts > step / 2) {
+                    seek_ts = next_ts;
+                    av_seek_frame(fmt_ctx, s->video_stream_idx, next_ts, 0);
+                }
+                av_packet_unref(pkt);
+                continue;
+            }
+        }
+
+        /* a NULL packet flushes the decoder at the end */
+        ret = avcodec_send_packet(s->video_dec_ctx, eof ? NULL : pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Error sending a video packet for decoding (%s)\n",
+                    av_err2str(ret));
+            goto end;
+        }
+
+        while ((ret = avcodec_receive_frame(s->video_dec_ctx,
+                                            s->frame)) >= 0) {
+            int64_t ts = s->frame->best_effort_timestamp;
+
+            nb_decoded++;
+            if (step && ts != AV_NOPTS_VALUE) {
+                if (next_ts != AV_NOPTS_VALUE && ts < next_ts)
+                    continue;
+                next_ts = ts + step;
+            }
+            if ((ret = thumbnailer_write(th, s->frame)) < 0)
+                goto end;
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+            fprintf(stderr, "Error during decoding video frames (%s)\n",
+                    av_err2str(ret));
+            goto end;
+        }
+        if (eof)
+            break;
+    }
+    ret = 0;
+
+    s->stats.video_frames = nb_decoded;
+    fprintf(stderr, "key frames: %d decoded in %.3f s\n",
+            nb_decoded, (av_gettime_relative() - t_start) / 1e6);
+    thumbnailer_dump_stats(th, stderr);
+
+end:
+    thumbnailer_close(&th);
+    return ret;
+}
+
+static int open_remux(struct demux_session *s) {
+    int i, ret;
+    const char *filename = s->opts.remux_filename;
+    AVFormatContext *ifmt_ctx = s->fmt_ctx;
+    AVFormatContext *ofmt_ctx;
+
+    if ((ret = avformat_alloc_output_context2(&s->ofmt_ctx, NULL, NULL,
+                                              filename)) < 0) {
+        fprintf(stderr, "Could not create output context for '%s' (%s)\n",
+                filename, av_err2str(ret));
+        return ret;
+    }
+    ofmt_ctx = s->ofmt_ctx;
+    if (!(s->stream_map = av_malloc_array(ifmt_ctx->nb_streams,
+                                          sizeof(*s->stream_map))))
+        return AVERROR(ENOMEM);
+    s->nb_mapped = ifmt_ctx->nb_streams;
+
+    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+        AVStream *in = ifmt_ctx->streams[i];
+        AVStream *out;
+        enum AVMediaType type = in->codecpar->codec_type;
+
+        s->stream_map[i] = -1;
+        if (s->opts.stream_index >= 0 ? i != s->opts.stream_index :
+            s->opts.audio_only ? type != AVMEDIA_TYPE_AUDIO :
+            s->opts.video_only ? type != AVMEDIA_TYPE_VIDEO :
+            type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_VIDEO &&
+            type != AVMEDIA_TYPE_SUBTITLE) {
+            if (!s->opts.no_discard)
+                in->discard = AVDISCARD_ALL;
+            continue;
+        }
+
+        if (!(out = avformat_new_stream(ofmt_ctx, NULL)))
+            return AVERROR(ENOMEM);
+        if ((ret = avcodec_parameters_copy(out->codecpar,
+                                           in->codecpar)) < 0) {
+            fprintf(stderr, "Failed to copy codec parameters (%s)\n",
+                    av_err2str(ret));
+            return ret;
+        }
+        /* the tag of the input container may mean nothing in the output
+         * one, let the muxer pick its own */
+        out->codecpar->codec_tag = 0;
+        s->stream_map[i] = s->nb_remuxed_streams++;
+    }
+
+    if (!s->opts.quiet)
+        av_dump_format(ofmt_ctx, 0, filename, 1);
+    if (!s->nb_remuxed_streams) {
+        fprintf(stderr, "No stream of '%s' selected for remuxing\n",
+                s->src_filename);
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+
+    if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&ofmt_ctx->pb, filename, AVIO_FLAG_WRITE)) < 0) {
+        fprintf(stderr, "Could not open output file '%s' (%s)\n",
+                filename, av_err2str(ret));
+        return ret;
+    }
+
+    /* the muxer may change the time bases of the output streams */
+    if ((ret = avformat_write_header(ofmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Error writing the header of '%s' (%s)\n",
+                filename, av_err2str(ret));
+        return ret;
+    }
+
+    av_init_packet(&s->pkt);
+    s->pkt.data = NULL;
+    s->pkt.size = 0;
+
+    if (!s->opts.quiet)
+        fprintf(stdout, "Remuxing %d streams from file '%s' into '%s'\n",
+                s->nb_remuxed_streams, s->src_filename, filename);
+
+    return 0;
+}
+
+/* the packets only change their stream index and time base on the way,
+ * the payload is never looked at */
+static int remux_packets(struct demux_session *s) {
+    int ret = 0;
+    AVPacket *pkt = &s->pkt;
+
+    while (read_packet(s->fmt_ctx, pkt) >= 0) {
+        int idx = pkt->stream_index;
+
+        s->stats.nb_packets++;
+        if (idx >= s->nb_mapped || s->stream_map[idx] < 0) {
+            s->stats.nb_dropped++;
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        pkt->stream_index = s->stream_map[idx];
+        av_packet_rescale_ts(pkt, s->fmt_ctx->streams[idx]->time_base,
+                             s->ofmt_ctx->streams[pkt->stream_index]->
+                             time_base);
+        pkt->pos = -1;
+
+        /* takes the reference, pkt is left blank */
+        if ((ret = av_interleaved_write_frame(s->ofmt_ctx, pkt)) < 0) {
+            fprintf(stderr, "Error muxing packet (%s)\n", av_err2str(ret));
+            av_packet_unref(pkt);
+            return ret;
+        }
+    }
+
+    if ((ret = av_write_trailer(s->ofmt_ctx)) < 0)
+        fprintf(stderr, "Error writing the trailer (%s)\n",
+                av_err2str(ret));
+
+    return ret;
+}
+
+/* frames to reserve raw output space for, from the frame count of the
+ * stream or the duration of the input (or range) and the frame rate; 0
+ * if neither is known */
+static int64_t estimate_video_frames(struct demux_session *s) {
+    double seconds = s->opts.duration;
+    AVRational rate = av_guess_frame_rate(s->fmt_ctx, s->video_stream,
+                                          NULL);
+
+    if (!seconds && !s->opts.start_time && s->video_stream->nb_frames > 0)
+        return s->video_stream->nb_frames;
+    if (!seconds && s->fmt_ctx->duration != AV_NOPTS_VALUE)
+        seconds = s->fmt_ctx->duration / (double)AV_TIME_BASE -
+                  s->opts.start_time;
+    if (seconds <= 0 || rate.num <= 0 || rate.den <= 0)
+        return 0;
+
+    /* one more for the rounding of the duration */
+    return (int64_t)(seconds * av_q2d(rate)) + 1;
+}
+
+/* wanted_stream is the stream to use if >= 0, or -1 for the best one */
+static int open_codec_context(struct demux_session *s, int *stream_idx,
+                              AVCodecContext **dec_ctx, 
+                              enum AVMediaType type, int wanted_stream) {
+    int ret;
+    int stream_index;
+    AVStream *st;
+    AVCodec  *dec = NULL;
+    AVDictionary *opts = NULL;
+
+    if ((ret = av_find_best_stream(s->fmt_ctx, type, wanted_stream, -1,
+                                   NULL, 0)) < 0) {
+        fprintf(stderr, 
+                "Could not find %s stream in input file '%s' (%s)\n",
+                av_get_media_type_string(type), s->src_filename,
+                av_err2str(ret));
+        return ret;
+    } else {
+        stream_index = ret;
+        st = s->fmt_ctx->streams[stream_index];
+
+        /* find decoder for the stream */
+        dec = avcodec_find_decoder(st->codecpar->codec_id);
+        if (!dec) {
+            fprintf(stderr, 
+                    "Failed to find %s codec\n",
+                    av_get_media_type_string(type));
+            return AVERROR(EINVAL);
+        }
+
+        /* allocate a codec context for the decoder */
+        *dec_ctx = avcodec_alloc_context3(dec);
+        if (!*dec_ctx) {
+            fprintf(stderr, 
+                    "Failed to allocate the %s codec context\n",
+                    av_get_media_type_string(type));
+            return AVERROR(ENOMEM);
+        }
+
+        /* copy codec parameters from input stream to output codec context */
+        if ((ret = avcodec_parameters_to_context(*dec_ctx,
+                                                 st->codecpar)) < 0) {
+            fprintf(stderr, 
+                    "Failed to copy %s codec parameters to decoder context\n",
+                    av_get_media_type_string(type));
+            return ret;
+        }
+
+        /* init the decoders, with or without reference counting; either
+         * way they decode into recycled buffers, so frames kept with
+         * -refcount need no new pool buffers once the pools are warm */
+        frame_pool_attach(s->pool, *dec_ctx);
+        av_dict_set(&opts, "refcounted_frames",
+                    s->opts.refcount ? "1" : "0", 0);
+        ret = avcodec_open2(*dec_ctx, dec, &opts);
+        av_dict_free(&opts);
+        if (ret < 0) {
+            fprintf(stderr, 
+                    "Failed to open %s codec\n",
+                    av_get_media_type_string(type));
+            return ret;
+        }
+        *stream_idx = stream_index;
+    }
+
+    return 0;
+}
+
+static int get_format_from_sample_fmt(const char **fmt,
+                                      enum AVSampleFormat sample_fmt) {
+    int i;
+    struct sample_fmt_entry {
+        enum AVSampleFormat sample_fmt;
+        const char *fmt_be, *fmt_le;
+    } sample_fmt_entries[] = {
+        { AV_SAMPLE_FMT_U8,  "u8",    "u8"    },
+        { AV_SAMPLE_FMT_S16, "s16be", "s16le" },
+        { AV_SAMPLE_FMT_S32, "s32be", "s32le" },
+        { AV_SAMPLE_FMT_FLT, "f32be", "f32le" },
+        { AV_SAMPLE_FMT_DBL, "f64be", "f64le" },
+    };
+    *fmt = NULL;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(sample_fmt_entries); i++) {
+        struct sample_fmt_entry *entry = &sample_fmt_entries[i];
+        if (sample_fmt == entry->sample_fmt) {
+            *fmt = AV_NE(entry->fmt_be, entry->fmt_le);
+            return 0;
+        }
+    }
+
+    fprintf(stderr,
+            "sample format %s is not supported as output format\n",
+            av_get_sample_fmt_name(sample_fmt));
+    return -1;
+}
+
@@ -0,0 +1,117 @@
+/**
+ * @file demux_session.h
+ * demux one input and decode its best video and audio streams into raw
+ * output files (or key frame thumbnails), all state in one session so
+ * that a process can run many of them, one after the other or at once
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef DEMUX_SESSION_H
+#define DEMUX_SESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "frame_pool.h"
+#include "probe_cache.h"
+
+struct demux_options {
+    int refcount;      /* refcounted_frames for the decoders */
+    int fast;          /* capped probing, see fast_probe.h */
+    int pipeline;      /* write frames on a thread per output */
+    int queue_frames;  /* bounds of the pipeline queues, 0: default */
+    int queue_mem;     /* MiB */
+    int parallel;      /* decode video and audio on a thread each */
+    int analyze;       /* luma statistics and scene cuts of the video */
+    double scene_threshold; /* cut above it, 0: LUMA_SCENE_THRESHOLD */
+    int copy;          /* stage video frames before writing them */
+    int mmap;          /* write the video through a mapping, see
+                        * frame_writer_set_mmap() */
+    int quiet;         /* no per-frame lines on stdout, no stream dump */
+
+    /* decode only the audio / only the video, or only stream_index (if
+     * >= 0); the demuxer discards every stream that is not decoded unless
+     * no_discard is set, then their packets are read and dropped */
+    int audio_only;
+    int video_only;
+    int stream_index;
+    int no_discard;
+
+    /* decode start_time seconds into the input (seeking to the key frame
+     * before it) up to duration seconds later, the frames outside of it
+     * are cut; 0: from the beginning / to the end; not for remuxing */
+    double start_time;
+    double duration;
+
+    /* copy the packets of the selected streams (all the audio, video and
+     * subtitle streams by default) into this file, muxer guessed from its
+     * name, instead of decoding them; no decoder is opened */
+    const char *remux_filename;
+
+    /* publish the decoded video into the shared memory ring '/shm_name'
+     * as well, see shm_ring.h; shm_slots frames (0: SHM_RING_SLOTS), the
+     * oldest overwritten when full with shm_drop, otherwise the decoder
+     * waits for the consumer */
+    const char *shm_name;
+    int         shm_slots;
+    int         shm_drop;
+
+    /* key frame thumbnails 'thumb_prefix-<n>.ppm' instead of raw output,
+     * one per thumb_every seconds if set, thumb_width pixels wide */
+    const char *thumb_prefix;
+    double      thumb_every;
+    int         thumb_width;
+};
+
+struct demux_session_stats {
+    int     video_frames;
+    int     audio_frames;
+    int64_t nb_packets;    /* returned by av_read_frame() */
+    int64_t nb_dropped;    /* of which belong to no decoded stream */
+    int64_t nb_past_end;   /* of which come after the end of the range */
+    int64_t bytes_read;    /* from the input, counted by its AVIOContext */
+    int64_t bytes_written; /* to the remux output */
+    int64_t run_us;        /* demux_session_run(), writers drained */
+
+    /* with start_time / duration: the frames decoded but cut, the time the
+     * seek took and the time from the start of the run to the first
+     * frame output of each stream (0 if none) */
+    int     video_cut;
+    int     audio_cut;
+    int64_t seek_us;
+    int64_t first_video_us;
+    int64_t first_audio_us;
+};
+
+struct demux_session;
+
+/* open src_filename, find its streams (through cache if not NULL) and set
+ * the decoders and outputs up; pool (decoder buffers and frames) and
+ * cache may be shared between sessions, NULL gives the session a pool of
+ * its own and no cache; cache is not thread safe */
+int  demux_session_create(struct demux_session **s, const char *src_filename,
+                          const char *video_dst_filename,
+                          const char *audio_dst_filename,
+                          const struct demux_options *opts,
+                          struct frame_pool *pool, struct probe_cache *cache);
+
+/* demux and decode everything, remux it, or extract the thumbnails */
+int  demux_session_run(struct demux_session *s);
+
+/* stop the threads of the session and free everything it owns */
+void demux_session_destroy(struct demux_session **s);
+
+const struct demux_session_stats *demux_session_get_stats(
+        struct demux_session *s);
+
+/* frame or packet counts and time, then the stats of every stage in
+ * use */
+void demux_session_dump_stats(struct demux_session *s, FILE *fp);
+
+/* the ffplay commands that play the raw outputs */
+int  demux_session_print_play(struct demux_session *s, FILE *fp);
+
+#endif /* DEMUX_SESSION_H */
@@ -8,55 +8,122 @@
  * @update  [id] [yy-mm-dd] [author] [description] 
  */
 
-#include <libavutil/imgutils.h>
-#include <libavutil/samplefmt.h>
-#include <libavutil/timestamp.h>
+#include <libavutil/cpu.h>
 
 #include <libavformat/avformat.h>
 
-static AVFormatContext *fmt_ctx = NULL;
-static AVCodecContext  *video_dec_ctx = NULL;
-static AVCodecContext  *audio_dec_ctx = NULL;
+#include "batch_decode.h"
+#include "demux_session.h"
+#include "frame_pool.h"
+#include "luma_stats.h"
+#include "frame_queue.h"
+#include "packet_queue.h"
+#include "probe_cache.h"
+#include "shm_ring.h"
+#include "thumbnail.h"
+#include "trace.h"
 
-static const char *src_filename = NULL;
-static const char *video_dst_filename = NULL;
-static const char *audio_dst_filename = NULL;
-static FILE *video_dst_file = NULL;
-static FILE *audio_dst_file = NULL;
-
-static int  width, height;
-static int  video_stream_idx = -1;
-static int  audio_stream_idx = -1;
-static enum AVPixelFormat pix_fmt;
-static AVStream *video_stream = NULL;
-static AVStream *audio_stream = NULL;
-
-static uint8_t *video_dst_data[4] = {NULL};
-static int      video_dst_linesize[4];
-static int      video_dst_bufsize;
-
-static AVPacket pkt; /* sizeof(AVPacket) is public ABI */
-static AVFrame *frame = NULL;
-/* Enable or disable frame reference counting. You are not supposed to 
- * support both paths in your application but pick the one most appropriate
- * to your needs. Look for the use of refcount in this example to see what
- * are the differences of API usage between them. */
-static int refcount = 0;
-static int video_frame_count = 0;
-static int audio_frame_count = 0;
-
-static int decode_packet(int);
-static int open_codec_context(int *, AVCodecContext **,
-                              AVFormatContext *, enum AVMediaType);
-static int get_format_from_sample_fmt(const char **, enum AVSampleFormat);
+/* all the demuxing and decoding state lives in a demux_session, see
+ * demux_session.c; this program runs one, or a batch of them */
 
 int main(int argc, char **argv) {
-    int ret = 0;
+    int i, ret = 0;
+    int nb_jobs = 0;
+    struct demux_options opts = {0};
+    const char *cache_file   = NULL;
+    const char *batch_source = NULL;
+    const char *out_dir      = NULL;
+    const char *trace_file   = NULL;
+    struct frame_pool    *pool  = NULL;
+    struct probe_cache   *cache = NULL;
+    struct demux_session *s     = NULL;
+
+    opts.stream_index = -1;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-refcount"))
+            opts.refcount = 1;
+        else if (!strcmp(argv[i], "-fast"))
+            opts.fast = 1;
+        else if (!strcmp(argv[i], "-cache") && i + 1 < argc)
+            cache_file = argv[++i];
+        else if (!strcmp(argv[i], "-pipeline"))
+            opts.pipeline = 1;
+        else if (!strcmp(argv[i], "-parallel"))
+            opts.parallel = 1;
+        else if (!strcmp(argv[i], "-queue-frames") && i + 1 < argc)
+            opts.queue_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-queue-mem") && i + 1 < argc)
+            opts.queue_mem = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-analyze"))
+            opts.analyze = 1;
+        else if (!strcmp(argv[i], "-scene-threshold") && i + 1 < argc)
+            opts.scene_threshold = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-copy"))
+            opts.copy = 1;
+        else if (!strcmp(argv[i], "-mmap"))
+            opts.mmap = 1;
+        else if (!strcmp(argv[i], "-shm") && i + 1 < argc)
+            opts.shm_name = argv[++i];
+        else if (!strcmp(argv[i], "-shm-slots") && i + 1 < argc)
+            opts.shm_slots = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-shm-drop"))
+            opts.shm_drop = 1;
+        else if (!strcmp(argv[i], "-audio-only"))
+            opts.audio_only = 1;
+        else if (!strcmp(argv[i], "-video-only"))
+            opts.video_only = 1;
+        else if (!strcmp(argv[i], "-stream") && i + 1 < argc)
+            opts.stream_index = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-no-discard"))
+            opts.no_discard = 1;
+        else if (!strcmp(argv[i], "-ss") && i + 1 < argc)
+            opts.start_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            opts.duration = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-remux") && i + 1 < argc)
+            opts.remux_filename = argv[++i];
+        else if (!strcmp(argv[i], "-thumbs") && i + 1 < argc)
+            opts.thumb_prefix = argv[++i];
+        else if (!strcmp(argv[i], "-thumb-every") && i + 1 < argc)
+            opts.thumb_every = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-thumb-width") && i + 1 < argc)
+            opts.thumb_width = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-batch") && i + 1 < argc)
+            batch_source = argv[++i];
+        else if (!strcmp(argv[i], "-jobs") && i + 1 < argc)
+            nb_jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-outdir") && i + 1 < argc)
+            out_dir = argv[++i];
+        else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+            trace_file = argv[++i];
+        else
+            break;
+    }
 
-    if (argc != 4 && argc != 5) {
+    if (argc - i != (batch_source ? 0 :
+                     opts.thumb_prefix || opts.remux_filename ? 1 : 3) ||
+        (batch_source && (opts.thumb_prefix || opts.remux_filename ||
+                          opts.shm_name)) ||
+        (opts.thumb_prefix && opts.remux_filename) ||
+        (opts.remux_filename && (opts.start_time || opts.duration)) ||
+        (opts.audio_only && opts.video_only) ||
+        (opts.copy && opts.mmap)) {
         fprintf(stderr, 
                 "Usage:\n"
-                "%s [-refcount] <infile> <video outfile> <audio outfile>\n\n"
+                "%s [-refcount] [-fast] [-cache file] "
+                "[-pipeline [-queue-frames n] [-queue-mem MiB]]\n"
+                "[-parallel] [-analyze [-scene-threshold t]] "
+                "[-copy | -mmap]\n"
+                "[-audio-only | -video-only | -stream index] [-no-discard] "
+                "[-ss seconds] [-t seconds] [-trace file]\n"
+                "[-shm name [-shm-slots n] [-shm-drop]]\n"
+                "<infile> <video outfile> <audio outfile>\n"
+                "%s [-fast] [-cache file] [-audio-only | -video-only | "
+                "-stream index] -remux outfile <infile>\n"
+                "%s [-fast] [-cache file] -thumbs prefix "
+                "[-thumb-every seconds] [-thumb-width w] <infile>\n"
+                "%s [options] -batch <directory | file list> "
+                "[-jobs n] [-outdir dir]\n\n"
                 "API example program to show how to read frames from an \n"
                 "input file.\n\n"
                 "This program reads frames from a file, decodes them, and \n"
@@ -65,525 +132,128 @@ int main(int argc, char **argv) {
                 "file named 'audio outfile'.\n\n"
                 "If the -refcount option is specified, the program use the \n"
                 "reference counting frame system which allows keeping a \n"
-                "copy of the data for longer than one decode call.\n",
-                argv[0]);
-        ret = 1;
-        goto end;
-    }
-    if (argc == 5 && !strcmp(argv[1], "-refcount")) {
-        refcount = 1;
-        argv++;
+                "copy of the data for longer than one decode call.\n\n"
+                "If the -cache option is specified, stream parameters are \n"
+                "kept in (and reused from) the given probe cache file, so \n"
+                "inputs probed before skip the stream info analysis.\n\n"
+                "If the -fast option is specified, probesize and \n"
+                "analyzeduration are capped and the analysis is skipped \n"
+                "when the container headers describe every stream.\n\n"
+                "If the -pipeline option is specified, video and audio \n"
+                "frames are written on a thread each, fed through queues \n"
+                "bounded by 'queue-frames' frames (default: %d) and \n"
+                "'queue-mem' MiB (default: %d) each.\n\n"
+                "If the -parallel option is specified, video and audio \n"
+                "are decoded on a thread each, the demuxer hands packets \n"
+                "over through lock-free queues of %d packets; the output \n"
+                "files are the same as without it.\n\n"
+                "If the -analyze option is specified, the luma histogram, \n"
+                "mean and variance of every video frame are computed while \n"
+                "decoding, and a frame differing from the previous one \n"
+                "by more than 'scene-threshold' (default: %.0f) is \n"
+                "reported as a scene cut.\n\n"
+                "Video frames are written straight from the decoded \n"
+                "planes; if the -copy option is specified, they are \n"
+                "packed into an unpadded buffer first instead. If the \n"
+                "-mmap option is specified, the space of the whole video \n"
+                "(estimated from its duration and frame rate) is \n"
+                "reserved with fallocate() first and the frames are \n"
+                "copied into a window of the file mapped in memory, the \n"
+                "file is truncated to its final size at the end.\n\n"
+                "If the -shm option is specified, the decoded video \n"
+                "frames are published into the POSIX shared memory ring \n"
+                "'/name' of 'shm-slots' (default: %d) frames as well, \n"
+                "for a consumer process such as shm_consumer to map in \n"
+                "place; the decoder waits for the consumer when the ring \n"
+                "is full, or overwrites the oldest frame with -shm-drop. \n"
+                "Give /dev/null as 'video outfile' to skip the disk.\n\n"
+                "If the -audio-only, -video-only or -stream option is \n"
+                "specified, only the best audio stream, the best video \n"
+                "stream or the stream with the given index is decoded \n"
+                "(the other output file is left alone). The demuxer \n"
+                "discards every stream that is not decoded, their \n"
+                "packets are not even read; if the -no-discard option is \n"
+                "specified, they are read and dropped instead.\n\n"
+                "If the -ss option is specified, the input is seeked to \n"
+                "the last key frame before that many seconds and decoded \n"
+                "from there, the frames before it are cut; with -t, the \n"
+                "frames after that many more seconds are cut and reading \n"
+                "stops once every stream got past them.\n\n"
+                "If the -remux option is specified, nothing is decoded: \n"
+                "the packets of every audio, video and subtitle stream \n"
+                "(or of the streams selected as above) are copied into \n"
+                "'outfile', the container given by its extension.\n\n"
+                "If the -thumbs option is specified, only key frames are \n"
+                "decoded (without loop filter, audio is not even demuxed) \n"
+                "and written as 'thumb-width' (default: %d) pixels wide \n"
+                "'prefix-<n>.ppm' images, one per key frame or, with \n"
+                "-thumb-every, one per that many seconds.\n\n"
+                "If the -batch option is specified, every file of the \n"
+                "directory or list is decoded (with the options given \n"
+                "before, -cache excepted) on 1, 2, 4, ... up to 'jobs' \n"
+                "threads (default: one per CPU) in turn, idle threads \n"
+                "stealing inputs from busy ones, and the throughput of \n"
+                "each round is reported; the outputs go to \n"
+                "'outdir/<n>.video' and 'outdir/<n>.audio' (default: \n"
+                "/dev/null).\n\n"
+                "If the -trace option is specified (in a 'make TRACE=1' \n"
+                "build), every read, decode, copy and write is timed, the \n"
+                "latency percentiles of each stage are printed at the end \n"
+                "and a Chrome trace (chrome://tracing) is written to \n"
+                "'file'.\n",
+                argv[0], argv[0], argv[0], argv[0], FRAME_QUEUE_MAX_FRAMES,
+                FRAME_QUEUE_MAX_BYTES >> 20, PACKET_QUEUE_SIZE,
+                LUMA_SCENE_THRESHOLD, SHM_RING_SLOTS, THUMBNAIL_WIDTH);
+        return 1;
     }
-    src_filename       = argv[1];
-    video_dst_filename = argv[2];
-    audio_dst_filename = argv[3];
-
-/*
-
-demuxing & decoding
- ____________________________________________________________
-| avcodec_register_all();                                    |
-|                                                            |
-| - Register all the codecs, parsers and bitstream filters.  |
-|____________________________________________________________|
-| avformat_open_input(&fmt_ctx, src_filename, NULL, NULL);   | 
-|                                                            |
-| - Allocate AVFormatContext.                                |
-| - Open an input stream.                                    |
-|____________________________________________________________|
-| avformat_find_stream_info(fmt_ctx, NULL);                  |
-|                                                            |
-| - Get stream information.                                  |
-|____________________________________________________________|
-                              |
-                              |
- _____________________________v______________________________
-| open_codec_context(&video_stream_idx, &video_dec_ctx,      |
-|                    fmt_ctx, AVMEDIA_TYPE_VIDEO);           |
-|                                                            |
-| open_codec_context(&audio_stream_idx, &audio_dec_ctx,      |
-|                    fmt_ctx, AVMEDIA_TYPE_AUDIO);           |
-|    ________________________________________________________|___
-|   | av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);       |
-|   |                                                            |
-|   | - Get AVPacket::stream_index.                              |
-|   | - Get AVStream.                                            |
-|   |____________________________________________________________|
-|   | avcodec_find_decoder(st->codecpar->codec_id);              |
-|   |                                                            |
-|   | - Find AVCodec.                                            |
-|   |____________________________________________________________|
-|   | avcodec_alloc_context3(dec);                               |
-|   |                                                            |
-|   | - Allocate AVCodecContext.                                 |
-|   |____________________________________________________________|
-|   | avcodec_parameters_to_context(*dec_ctx, st->codecpar);     |
-|   |                                                            |
-|   | - Fill AVCodecContext using parameters of AVCodec.         |
-|   |____________________________________________________________|
-|   | avcodec_open2(*dec_ctx, dec, &opts);                       |
-|   |                                                            |
-|   | - Open AVCodec with AVDictionary.                          |
-|   |____________________________________________________________|
-|                                                            |
-| - Get AVPacket::width, AVPacket::height.                   |
-| - Get AVPixelFormat.                                       |
-|____________________________________________________________|
-                              |
-                              |
- _____________________________v______________________________
-| fopen(video_dst_filename, "wb");                           |
-|                                                            |
-| fopen(audio_dst_filename, "wb");                           |
-|                                                            |
-| - Open video / audio output stream.                        |
-|____________________________________________________________|
-| av_image_alloc(video_dst_data, video_dst_linesize,         |
-|                width, height, pix_fmt, 1);                 |
-|                                                            |
-| - Allocate image buffer.                                   |
-|     - Allocate AVFrame::data.                              |
-|     - Allocate AVFrame::linesize.                          |
-|____________________________________________________________|
-| av_frame_alloc();                                          |
-|                                                            |
-| - Allocate AVFrame.                                        |
-|____________________________________________________________|
-| av_init_packet(&pkt);                                      |
-|                                                            |
-| - Initialize some fields of AVPacket with default values.  |
-|____________________________________________________________|
-                              |
-                              |
- _____________________________v______________________________
-| av_read_frame(fmt_ctx, &pkt);                              |
-|                                                            |
-| - Get next encoded AVPacket from AVFormatContext::Stream.  |
-|____________________________________________________________|
-| decode_packet(0);                                          |
-|    ________________________________________________________|___
-|   | avcodec_send_packet(video_dec_ctx, &pkt);                  |
-|   |                                                            | 
-|   | avcodec_send_packet(audio_dec_ctx, &pkt);                  |
-|   |                                                            |
-|   | - Send encoded AVPacket to AVCodec.                        | 
-|   |____________________________________________________________|
-|   | avcodec_receive_frame(video_dec_ctx, frame);               |
-|   |                                                            | 
-|   | avcodec_receive_frame(video_dec_ctx, frame);               |
-|   |                                                            |
-|   | - Receive decoded AVFrame from AVCodec.                    | 
-|   |____________________________________________________________|
-|   | av_image_copy(video_dst_data, video_dst_linesize,          | 
-|   |               (const uint8_t **)(frame->data),             |
-|   |               frame->linesize, pix_fmt, width, height);    | 
-|   |                                                            |
-|   | - Copy AVFrame to image buffer.                            |
-|   |____________________________________________________________|
-|   | fwrite(video_dst_data[0], 1,                               |
-|   |        video_dst_bufsize, video_dst_file);                 |
-|   |                                                            |
-|   | fwrite(frame->extended_data[0], 1,                         |
-|   |        unpadded_linesize, audio_dst_file);                 |
-|   |                                                            |
-|   | - Write decoded AVFrame to video/audio output stream.      |
-|   |____________________________________________________________|
-|                                                            | 
-|____________________________________________________________|
-                              |
-                              |
-                              v
 
-*/
-    
     avcodec_register_all();
 
-    /* open input file, and allocate format context (fmt_ctx point to NULL,
-     * in which case an AVFormatContext is allocated by this function) */
-    if ((ret = avformat_open_input(&fmt_ctx,
-                                   src_filename, NULL, NULL)) < 0) {
-        fprintf(stderr,
-                "Could not open source file '%s' (%s)\n",
-                src_filename, av_err2str(ret));
-        goto end;
-    }
-
-    /* retrieve stream information */
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
-        fprintf(stderr,
-                "Could not find stream information (%s)\n",
-                av_err2str(ret));
-        goto end;
-    }
-
-    if (open_codec_context(&video_stream_idx,
-                           &video_dec_ctx, fmt_ctx, AVMEDIA_TYPE_VIDEO) >= 0) {
-        video_stream = fmt_ctx->streams[video_stream_idx];
-        video_dst_file = fopen(video_dst_filename, "wb");
-        if (!video_dst_file) {
-            fprintf(stderr, 
-                    "Could not open destination file '%s'\n",
-                    video_dst_filename);
-            ret = 1;
-            goto end;
-        }
-
-        /* allocate image where the decoded image will be put */
-        width = video_dec_ctx->width;
-        height = video_dec_ctx->height;
-        pix_fmt = video_dec_ctx->pix_fmt;
-        /* the allocated image buffer has to be freed by using
-         * av_freep(&video_dst_data[0]) */
-        ret = av_image_alloc(video_dst_data, video_dst_linesize,
-                             width, height, pix_fmt, 1);
-        if (ret < 0) {
-            fprintf(stderr,
-                    "Could not allocate raw video buffer (%s)\n",
-                    av_err2str(ret));
-            goto end;
-        }
-        video_dst_bufsize = ret;
-    }
-
-    if (open_codec_context(&audio_stream_idx,
-                           &audio_dec_ctx, fmt_ctx, AVMEDIA_TYPE_AUDIO) >= 0) {
-        audio_stream = fmt_ctx->streams[audio_stream_idx];
-        audio_dst_file = fopen(audio_dst_filename, "wb");
-        if (!audio_dst_file) {
-            fprintf(stderr, 
-                    "Could not open destination file '%s'\n",
-                    audio_dst_filename);
-            ret = 1;
-            goto end;
-        }
+    if (trace_file && trace_init(trace_file) < 0)
+        fprintf(stderr, "Tracing is not compiled in, build with 'make "
+                "TRACE=1', -trace ignored\n");
+
+    /* one session per input, thumbnails make no sense for a batch */
+    if (batch_source) {
+        ret = batch_decode_run(batch_source, &opts,
+                               nb_jobs > 0 ? nb_jobs : av_cpu_count(),
+                               out_dir, stderr);
+        trace_dump(stderr);
+        return ret < 0;
     }
 
-    /* dump input information to stderr */
-    av_dump_format(fmt_ctx, 0, src_filename, 0);
-
-    if (!audio_stream && !video_stream) {
-        fprintf(stderr, 
-                "Could not find audio or video "
-                "stream in the input, aborting\n");
-        ret = 1;
+    if ((ret = frame_pool_init(&pool)) < 0)
         goto end;
-    }
-
-    frame = av_frame_alloc();
-    if (!frame) {
-        fprintf(stderr, "Could not allocate frame\n");
-        ret = AVERROR(ENOMEM);
+    if (cache_file &&
+        (ret = probe_cache_open(&cache, cache_file, 0)) < 0)
         goto end;
-    }
-
-    /* initialize packet, set data to NULL, let the demuxer fill it */
-    av_init_packet(&pkt);
-    pkt.data = NULL;
-    pkt.size = 0;
-
-    if (video_stream)
-        fprintf(stdout, 
-                "Demuxing video from file '%s' into '%s'\n", 
-                src_filename, video_dst_filename);
-    if (audio_stream)
-        fprintf(stdout, 
-                "Demuxing audio from file '%s' into '%s'\n", 
-                src_filename, audio_dst_filename);
-
-    /* read frames (encoded packets) from the file */
-    while (av_read_frame(fmt_ctx, &pkt) >= 0) {
-        AVPacket orig_pkt = pkt; /* WHY do it ?? SHOW reference counting ?? */
-        do {
-            ret = decode_packet(0);
-            if (ret < 0)
-                break;
-            pkt.data += ret;
-            pkt.size -= ret;
-        } while (pkt.size > 0);
-        /* unreference the buffer referenced by the packet and reset the
-         * remaining packet fields to their default values */
-        if (refcount)
-            av_packet_unref(&orig_pkt);
-    }
 
-    /* flush cached frames */
-    pkt.data = NULL;
-    pkt.size = 0;
-    ret = decode_packet(1);
-    if (ret < 0) {
-        fprintf(stderr, "Error sending the first flush packet\n");
+    if ((ret = demux_session_create(&s, argv[i],
+                                    argc - i == 3 ? argv[i + 1] : NULL,
+                                    argc - i == 3 ? argv[i + 2] : NULL,
+                                    &opts, pool, cache)) < 0 ||
+        (ret = demux_session_run(s)) < 0)
         goto end;
-    }
-
-    fprintf(stdout, "Demuxing succeeded\n");
 
-    if (video_stream) {
-        fprintf(stdout,
-                "Play the output video file with the command:\n"
-                "ffplay -f rawvideo -pix_fmt %s -video_size %dx%d %s\n",
-                av_get_pix_fmt_name(pix_fmt), width, height,
-                video_dst_filename);
-    }
-
-    if (audio_stream) {
-        enum AVSampleFormat sfmt = audio_dec_ctx->sample_fmt;
-        int n_channels = audio_dec_ctx->channels;
-        const char *fmt;
-
-        if (av_sample_fmt_is_planar(sfmt)) {
-            const char *packed = av_get_sample_fmt_name(sfmt);
-            fprintf(stdout, 
-                    "Warning: the sample format the decoder produced "
-                    "is planar (%s).\n"
-                    "This example will output the first channel only.\n",
-                    packed ? packed : "?");
-            sfmt = av_get_packed_sample_fmt(sfmt);
-            n_channels = 1;
-        }
-
-        if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0)
-            goto end;
-
-        fprintf(stdout, 
-                "Play the output audio file with the command:\n"
-                "ffplay -f %s -ac %d -ar %d %s\n",
-                fmt, n_channels, audio_dec_ctx->sample_rate,
-                audio_dst_filename);
+    demux_session_dump_stats(s, stderr);
+    if (opts.remux_filename) {
+        fprintf(stdout, "Remuxing succeeded\n");
+    } else if (!opts.thumb_prefix) {
+        fprintf(stdout, "Demuxing succeeded\n");
+        ret = demux_session_print_play(s, stdout);
     }
 
 end:
-    avcodec_free_context(&video_dec_ctx);
-    avcodec_free_context(&audio_dec_ctx);
-    avformat_close_input(&fmt_ctx);
-    if (video_dst_file) fclose(video_dst_file);
-    if (audio_dst_file) fclose(audio_dst_file);
-    av_frame_free(&frame);
-    av_free(video_dst_data[0]);
-
-    return (ret != 0);
-}
-
-static int decode_packet(int cached) {
-    int ret = 0;
-    // int got_frame;
-    int decoded = pkt.size;
-
-    if (pkt.stream_index == video_stream_idx) {
-
-        /* WARNING: 'avcodec_decode_video2()' is deprecated, if enable the
-         * reference counting, the caller must release the frame using
-         * av_frame_unref() */
-
-        // ret = avcodec_decode_video2(video_dec_ctx,
-        //                             frame, &got_frame, &pkt);
-        
-        ret = avcodec_send_packet(video_dec_ctx, &pkt);
-        if (ret < 0) {
-            fprintf(stderr, 
-                    "Error sending a video packet for decoding (%s)\n",
-                    av_err2str(ret));
-            return ret;
-        } 
-        
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(video_dec_ctx, frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                return 0;
-            } else if (ret < 0) {
-                fprintf(stderr,
-                        "Error during decoding video frames (%s)\n",
-                        av_err2str(ret));
-                return ret;
-            }
-
-            if (frame->width  != width  ||
-                frame->height != height || frame->format != pix_fmt) {
-                /* To handle this change, one could call av_image_alloc
-                 * again and decode the following frames into another
-                 * rawvideo file. */
-                fprintf(stderr, 
-                        "Error: width, height and pixel format have to be "
-                        "constant in a rawvideo file, but the width, height "
-                        "or pixel format of the input video changed:\n"
-                        "old: width = %d, height = %d, format = %s\n"
-                        "new: width = %d, height = %d, format = %s\n",
-                        width, height, av_get_pix_fmt_name(pix_fmt),
-                        frame->width, frame->height,
-                        av_get_pix_fmt_name(frame->format));
-                return -1;
-            }
-
-            fprintf(stdout, 
-                    "video_frame%s n:%d coded_n:%d\n",
-                    cached ? "(cached)" : "", video_frame_count++, 
-                    frame->coded_picture_number);
-
-            /* copy decoded frame to destination buffer:
-             * this is required since rawvideo expects non aligned data */
-            
-            /* (Does the FUNC convert PACKED FMT to PLANAR FMT ???) */
-            av_image_copy(video_dst_data, video_dst_linesize,
-                          (const uint8_t **)(frame->data),
-                          frame->linesize, pix_fmt, width, height);
-
-            /* write to rawvideo file */
-            fwrite(video_dst_data[0], 1, video_dst_bufsize, video_dst_file);
-        }
-    } else if (pkt.stream_index == audio_stream_idx) {
-
-        /* WARNING: 'avcodec_decode_audio4()' is deprecated, if enable the
-         * reference counting, the caller must release the frame using
-         * av_frame_unref() */
-
-        // ret = avcodec_decode_audio4(audio_dec_ctx,
-        //                             frame, &got_frame, &pkt); */
-
-        ret = avcodec_send_packet(audio_dec_ctx, &pkt);
-        if (ret < 0) {
-            fprintf(stderr, 
-                    "Error sending a audio packet for decoding (%s)\n",
-                    av_err2str(ret));
-            return ret;
-        }
-
-        /* Some audio decoders decode only part of the packet, and have to be
-         * called again with the remainder of the packet data.
-         * Sample: fate-suite/lossless-audio/luckynight-partial.shn
-         * Also, some decoders might over-read the packet. */
-        decoded = FFMIN(ret, pkt.size);
-
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(audio_dec_ctx, frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                return 0;
-            } else if (ret < 0) {
-                fprintf(stderr,
-                        "Error during decoding audio frames (%s)\n",
-                        av_err2str(ret));
-                return ret;
-            }
-
-            size_t unpadded_linesize = av_get_bytes_per_sample(frame->format) \
-                                       * frame->nb_samples; 
-            fprintf(stdout, 
-                    "audio_frame%s n:%d nb_samples:%d pts:%s\n",
-                    cached ? "(cached)" : "", 
-                    audio_frame_count++, frame->nb_samples, 
-                    av_ts2timestr(frame->pts, &audio_dec_ctx->time_base));
-
-            /* Write the raw audio data samples of the first plane.
-             * This works fine for packed formats (e.g. AV_SAMPLE_FMT_S16).
-             * However, most audio decoders output planar audio, which uses
-             * a separate plane of audio samples for each channel (e.g.
-             * AV_SAMPLE_FMT_S16P).
-             * In other words, this code will write only the first audio channel
-             * in these cases.
-             * You should use libswresample or libavfilter to convert the frame
-             * to packed data. */
-
-            /* (How to convert PLANAR FMT data to PACKED FMT data ???) */
-            fwrite(frame->extended_data[0],
-                   1, unpadded_linesize, audio_dst_file);
-        }
+    demux_session_destroy(&s);
+    if (pool) {
+        frame_pool_dump_stats(pool, stderr);
+        frame_pool_free(&pool);
     }
-
-    /* If we use frame reference counting, we own the data and need to 
-     * de-reference it when we don't use it anymore.
-     * The function av_frame_unref() unreference all the buffers referenced
-     * by frame and reset the frame fields */
-
-    // if (refcount)
-    //     av_frame_unref(frame);
-
-    return decoded;
-}
-
-static int open_codec_context(int *stream_idx,
-                              AVCodecContext **dec_ctx, 
-                              AVFormatContext *fmt_ctx,
-                              enum AVMediaType type) {
-    int ret;
-    int stream_index;
-    AVStream *st;
-    AVCodec  *dec = NULL;
-    AVDictionary *opts = NULL;
-
-    if ((ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0)) < 0) {
-        fprintf(stderr, 
-                "Could not find %s stream in input file '%s' (%s)\n",
-                av_get_media_type_string(type), src_filename, av_err2str(ret));
-        return ret;
-    } else {
-        stream_index = ret;
-        st = fmt_ctx->streams[stream_index];
-
-        /* find decoder for the stream */
-        dec = avcodec_find_decoder(st->codecpar->codec_id);
-        if (!dec) {
-            fprintf(stderr, 
-                    "Failed to find %s codec\n",
-                    av_get_media_type_string(type));
-            return AVERROR(EINVAL);
-        }
-
-        /* allocate a codec context for the decoder */
-        *dec_ctx = avcodec_alloc_context3(dec);
-        if (!*dec_ctx) {
-            fprintf(stderr, 
-                    "Failed to allocate the %s codec context\n",
-                    av_get_media_type_string(type));
-            return AVERROR(ENOMEM);
-        }
-
-        /* copy codec parameters from input stream to output codec context */
-        if ((ret = avcodec_parameters_to_context(*dec_ctx,
-                                                 st->codecpar)) < 0) {
-            fprintf(stderr, 
-                    "Failed to copy %s codec parameters to decoder context\n",
-                    av_get_media_type_string(type));
-            return ret;
-        }
-
-        /* init the decoders, with or without reference counting */
-        av_dict_set(&opts, "refcounted_frames", refcount ? "1" : "0", 0);
-        if ((ret = avcodec_open2(*dec_ctx, dec, &opts)) < 0) {
-            fprintf(stderr, 
-                    "Failed to open %s codec\n",
-                    av_get_media_type_string(type));
-            return ret;
-        }
-        *stream_idx = stream_index;
-    }
-
-    return 0;
-}
-
-static int get_format_from_sample_fmt(const char **fmt,
-                                      enum AVSampleFormat sample_fmt) {
-    int i;
-    struct sample_fmt_entry {
-        enum AVSampleFormat sample_fmt;
-        const char *fmt_be, *fmt_le;
-    } sample_fmt_entries[] = {
-        { AV_SAMPLE_FMT_U8,  "u8",    "u8"    },
-        { AV_SAMPLE_FMT_S16, "s16be", "s16le" },
-        { AV_SAMPLE_FMT_S32, "s32be", "s32le" },
-        { AV_SAMPLE_FMT_FLT, "f32be", "f32le" },
-        { AV_SAMPLE_FMT_DBL, "f64be", "f64le" },
-    };
-    *fmt = NULL;
-
-    for (i = 0; i < FF_ARRAY_ELEMS(sample_fmt_entries); i++) {
-        struct sample_fmt_entry *entry = &sample_fmt_entries[i];
-        if (sample_fmt == entry->sample_fmt) {
-            *fmt = AV_NE(entry->fmt_be, entry->fmt_le);
-            return 0;
-        }
+    if (cache) {
+        probe_cache_dump_stats(cache, stderr);
+        probe_cache_close(&cache);
     }
+    trace_dump(stderr);
 
-    fprintf(stderr,
-            "sample format %s is not supported as output format\n",
-            av_get_sample_fmt_name(sample_fmt));
-    return -1;
+    return (ret != 0);
 }
-
@@ -0,0 +1,373 @@
+/**
+ * @file downscale.c
+ * 2x / 4x box downscaling of planar 8-bit frames, with SSSE3 / AVX2 / NEON
+ * kernels picked at runtime and a scalar fallback
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+#include "downscale.h"
+
+static void box2_c(uint8_t *, const uint8_t *const *, int);
+
+static void box4_c(uint8_t *, const uint8_t *const *, int);
+
+#if HAVE_X86_KERNELS
+static void box2_ssse3(uint8_t *, const uint8_t *const *, int);
+
+static void box4_ssse3(uint8_t *, const uint8_t *const *, int);
+
+static void box2_avx2(uint8_t *, const uint8_t *const *, int);
+
+static void box4_avx2(uint8_t *, const uint8_t *const *, int);
+#endif
+
+#if HAVE_NEON_KERNELS
+static void box2_neon(uint8_t *, const uint8_t *const *, int);
+
+static void box4_neon(uint8_t *, const uint8_t *const *, int);
+#endif
+
+static void downscale_plane(uint8_t *, int, const uint8_t *, int,
+                            int, int, int, const struct downscale_kernels *);
+
+static const struct downscale_kernels kernels[] = {
+    {"scalar", 0,                 box2_c,     box4_c},
+#if HAVE_X86_KERNELS
+    {"ssse3",  AV_CPU_FLAG_SSSE3, box2_ssse3, box4_ssse3},
+    {"avx2",   AV_CPU_FLAG_AVX2,  box2_avx2,  box4_avx2},
+#endif
+#if HAVE_NEON_KERNELS
+    {"neon",   AV_CPU_FLAG_NEON,  box2_neon,  box4_neon},
+#endif
+};
+
+int downscale_supported(enum AVPixelFormat fmt) {
+    int i;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL |
+                                AV_PIX_FMT_FLAG_HWACCEL |
+                                AV_PIX_FMT_FLAG_BITSTREAM) ||
+        (!(desc->flags & AV_PIX_FMT_FLAG_PLANAR) && desc->nb_components > 1))
+        return 0;
+    for (i = 0; i < desc->nb_components; i++)
+        if (desc->comp[i].depth != 8 || desc->comp[i].step != 1)
+            return 0;
+    return 1;
+}
+
+void downscale_geometry(AVFrame *dst, const AVFrame *src, int factor) {
+    int shift = factor == 4 ? 2 : 1;
+
+    dst->format = src->format;
+    dst->width  = AV_CEIL_RSHIFT(src->width,  shift);
+    dst->height = AV_CEIL_RSHIFT(src->height, shift);
+}
+
+int downscale_frame(AVFrame *dst, const AVFrame *src, int factor,
+                    const struct downscale_kernels *k) {
+    int i, ret;
+    int shift = factor == 4 ? 2 : 1;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(src->format);
+
+    if ((factor != 2 && factor != 4) || !downscale_supported(src->format))
+        return AVERROR(EINVAL);
+
+    if (!dst->buf[0]) {
+        downscale_geometry(dst, src, factor);
+        if ((ret = av_frame_get_buffer(dst, 32)) < 0)
+            return ret;
+    } else if (dst->format != src->format ||
+               dst->width  != AV_CEIL_RSHIFT(src->width,  shift) ||
+               dst->height != AV_CEIL_RSHIFT(src->height, shift)) {
+        return AVERROR(EINVAL);
+    }
+    if ((ret = av_frame_copy_props(dst, src)) < 0)
+        return ret;
+
+    /* ceil(ceil(w / f) / c) == ceil(ceil(w / c) / f), so the chroma of
+     * the downscaled frame is the downscaled chroma */
+    for (i = 0; i < av_pix_fmt_count_planes(src->format); i++) {
+        int chroma = i == 1 || i == 2;
+        int w = chroma ? AV_CEIL_RSHIFT(src->width,  desc->log2_chroma_w) :
+                         src->width;
+        int h = chroma ? AV_CEIL_RSHIFT(src->height, desc->log2_chroma_h) :
+                         src->height;
+
+        downscale_plane(dst->data[i], dst->linesize[i],
+                        src->data[i], src->linesize[i], w, h, shift, k);
+    }
+
+    return 0;
+}
+
+const struct downscale_kernels *downscale_kernels_all(int *nb_kernels) {
+    *nb_kernels = FF_ARRAY_ELEMS(kernels);
+    return kernels;
+}
+
+const struct downscale_kernels *downscale_kernels_best(int cpu_flags) {
+    int i;
+
+    /* later entries are faster */
+    for (i = FF_ARRAY_ELEMS(kernels) - 1; i > 0; i--)
+        if ((cpu_flags & kernels[i].cpu_flag) == kernels[i].cpu_flag)
+            return &kernels[i];
+    return &kernels[0];
+}
+
+static void downscale_plane(uint8_t *dst, int dst_linesize,
+                            const uint8_t *src, int src_linesize,
+                            int w, int h, int shift,
+                            const struct downscale_kernels *k) {
+    int i, j, x, y;
+    int f = 1 << shift;
+    int full = w >> shift;               /* blocks inside the plane */
+    int dst_w = AV_CEIL_RSHIFT(w, shift);
+    int dst_h = AV_CEIL_RSHIFT(h, shift);
+    const uint8_t *rows[4];
+
+    for (y = 0; y < dst_h; y++, dst += dst_linesize) {
+        /* the last block row repeats the bottom row when cut short */
+        for (i = 0; i < f; i++)
+            rows[i] = src + FFMIN(y * f + i, h - 1) * src_linesize;
+
+        if (full)
+            (shift == 1 ? k->box2 : k->box4)(dst, rows, full);
+
+        for (x = full; x < dst_w; x++) {
+            int sum = 0;
+
+            for (i = 0; i < f; i++)
+                for (j = 0; j < f; j++)
+                    sum += rows[i][FFMIN(x * f + j, w - 1)];
+            dst[x] = (sum + (f * f >> 1)) >> (2 * shift);
+        }
+    }
+}
+
+static void box2_c(uint8_t *dst, const uint8_t *const *rows, int dst_width) {
+    int x;
+    const uint8_t *r0 = rows[0], *r1 = rows[1];
+
+    for (x = 0; x < dst_width; x++)
+        dst[x] = (r0[2 * x] + r0[2 * x + 1] +
+                  r1[2 * x] + r1[2 * x + 1] + 2) >> 2;
+}
+
+static void box4_c(uint8_t *dst, const uint8_t *const *rows, int dst_width) {
+    int i, x;
+
+    for (x = 0; x < dst_width; x++) {
+        int sum = 0;
+
+        for (i = 0; i < 4; i++)
+            sum += rows[i][4 * x] + rows[i][4 * x + 1] +
+                   rows[i][4 * x + 2] + rows[i][4 * x + 3];
+        dst[x] = (sum + 8) >> 4;
+    }
+}
+
+/* horizontal pairs are summed with a multiply-add by ones into 16-bit
+ * lanes (at most 16 * 255, no overflow), rows are added, and the rounded
+ * mean is packed back to bytes: the same integer maths as the scalar
+ * code */
+
+#if HAVE_X86_KERNELS
+
+__attribute__((target("ssse3")))
+static void box2_ssse3(uint8_t *dst, const uint8_t *const *rows,
+                       int dst_width) {
+    int x;
+    const uint8_t *r0 = rows[0], *r1 = rows[1];
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two  = _mm_set1_epi16(2);
+
+    for (x = 0; x + 16 <= dst_width; x += 16) {
+        const uint8_t *p0 = r0 + 2 * x, *p1 = r1 + 2 * x;
+        __m128i lo = _mm_add_epi16(
+            _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)p0), ones),
+            _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)p1), ones));
+        __m128i hi = _mm_add_epi16(
+            _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(p0 + 16)),
+                              ones),
+            _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(p1 + 16)),
+                              ones));
+
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    box2_c(dst + x, (const uint8_t *const []){r0 + 2 * x, r1 + 2 * x},
+           dst_width - x);
+}
+
+__attribute__((target("ssse3")))
+static void box4_ssse3(uint8_t *dst, const uint8_t *const *rows,
+                       int dst_width) {
+    int c, i, x;
+    const __m128i ones  = _mm_set1_epi8(1);
+    const __m128i eight = _mm_set1_epi16(8);
+
+    for (x = 0; x + 16 <= dst_width; x += 16) {
+        __m128i pairs[4], lo, hi;
+
+        /* pairs[c]: 8 column pair sums over the 4 rows, 4 outputs */
+        for (c = 0; c < 4; c++) {
+            pairs[c] = _mm_setzero_si128();
+            for (i = 0; i < 4; i++)
+                pairs[c] = _mm_add_epi16(pairs[c], _mm_maddubs_epi16(
+                    _mm_loadu_si128((const __m128i *)
+                                    (rows[i] + 4 * x + 16 * c)), ones));
+        }
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(pairs[0],
+                                                         pairs[1]),
+                                          eight), 4);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(pairs[2],
+                                                         pairs[3]),
+                                          eight), 4);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    box4_c(dst + x, (const uint8_t *const []){rows[0] + 4 * x,
+                                              rows[1] + 4 * x,
+                                              rows[2] + 4 * x,
+                                              rows[3] + 4 * x},
+           dst_width - x);
+}
+
+__attribute__((target("avx2")))
+static void box2_avx2(uint8_t *dst, const uint8_t *const *rows,
+                      int dst_width) {
+    int x;
+    const uint8_t *r0 = rows[0], *r1 = rows[1];
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i two  = _mm256_set1_epi16(2);
+
+    for (x = 0; x + 32 <= dst_width; x += 32) {
+        const uint8_t *p0 = r0 + 2 * x, *p1 = r1 + 2 * x;
+        __m256i lo = _mm256_add_epi16(
+            _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)p0),
+                                 ones),
+            _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)p1),
+                                 ones));
+        __m256i hi = _mm256_add_epi16(
+            _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)
+                                                    (p0 + 32)), ones),
+            _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)
+                                                    (p1 + 32)), ones));
+
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+        /* packing works per 128-bit lane, put the quarters back in order */
+        _mm256_storeu_si256((__m256i *)(dst + x),
+                            _mm256_permute4x64_epi64(
+                                _mm256_packus_epi16(lo, hi), 0xd8));
+    }
+    box2_c(dst + x, (const uint8_t *const []){r0 + 2 * x, r1 + 2 * x},
+           dst_width - x);
+}
+
+__attribute__((target("avx2")))
+static void box4_avx2(uint8_t *dst, const uint8_t *const *rows,
+                      int dst_width) {
+    int c, i, x;
+    const __m256i ones  = _mm256_set1_epi8(1);
+    const __m256i eight = _mm256_set1_epi16(8);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (x = 0; x + 32 <= dst_width; x += 32) {
+        __m256i pairs[4], lo, hi;
+
+        for (c = 0; c < 4; c++) {
+            pairs[c] = _mm256_setzero_si256();
+            for (i = 0; i < 4; i++)
+                pairs[c] = _mm256_add_epi16(pairs[c], _mm256_maddubs_epi16(
+                    _mm256_loadu_si256((const __m256i *)
+                                       (rows[i] + 4 * x + 32 * c)), ones));
+        }
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_hadd_epi16(pairs[0],
+                                                                  pairs[1]),
+                                                eight), 4);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_hadd_epi16(pairs[2],
+                                                                  pairs[3]),
+                                                eight), 4);
+        /* after the in-lane add and pack, each 32-bit group holds 4
+         * consecutive outputs, interleaved between the two lanes */
+        _mm256_storeu_si256((__m256i *)(dst + x),
+                            _mm256_permutevar8x32_epi32(
+                                _mm256_packus_epi16(lo, hi), order));
+    }
+    box4_c(dst + x, (const uint8_t *const []){rows[0] + 4 * x,
+                                              rows[1] + 4 * x,
+                                              rows[2] + 4 * x,
+                                              rows[3] + 4 * x},
+           dst_width - x);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+#if HAVE_NEON_KERNELS
+
+static void box2_neon(uint8_t *dst, const uint8_t *const *rows,
+                      int dst_width) {
+    int x;
+    const uint8_t *r0 = rows[0], *r1 = rows[1];
+
+    for (x = 0; x + 16 <= dst_width; x += 16) {
+        const uint8_t *p0 = r0 + 2 * x, *p1 = r1 + 2 * x;
+        uint16x8_t lo = vaddq_u16(vpaddlq_u8(vld1q_u8(p0)),
+                                  vpaddlq_u8(vld1q_u8(p1)));
+        uint16x8_t hi = vaddq_u16(vpaddlq_u8(vld1q_u8(p0 + 16)),
+                                  vpaddlq_u8(vld1q_u8(p1 + 16)));
+
+        /* rounding narrowing shift, (sum + 2) >> 2 */
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 2),
+                                      vrshrn_n_u16(hi, 2)));
+    }
+    box2_c(dst + x, (const uint8_t *const []){r0 + 2 * x, r1 + 2 * x},
+           dst_width - x);
+}
+
+static void box4_neon(uint8_t *dst, const uint8_t *const *rows,
+                      int dst_width) {
+    int i, x;
+
+    for (x = 0; x + 8 <= dst_width; x += 8) {
+        uint16x8_t lo = vdupq_n_u16(0);
+        uint16x8_t hi = vdupq_n_u16(0);
+
+        for (i = 0; i < 4; i++) {
+            lo = vpadalq_u8(lo, vld1q_u8(rows[i] + 4 * x));
+            hi = vpadalq_u8(hi, vld1q_u8(rows[i] + 4 * x + 16));
+        }
+        vst1_u8(dst + x, vrshrn_n_u16(vpaddq_u16(lo, hi), 4));
+    }
+    box4_c(dst + x, (const uint8_t *const []){rows[0] + 4 * x,
+                                              rows[1] + 4 * x,
+                                              rows[2] + 4 * x,
+                                              rows[3] + 4 * x},
+           dst_width - x);
+}
+
+#endif /* HAVE_NEON_KERNELS */
@@ -0,0 +1,50 @@
+/**
+ * @file downscale.h
+ * 2x / 4x box downscaling of planar 8-bit frames, with SSSE3 / AVX2 / NEON
+ * kernels picked at runtime and a scalar fallback
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef DOWNSCALE_H
+#define DOWNSCALE_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+/* row kernels, dst[x] is the rounded mean of the factor x factor block at
+ * column factor * x of rows[0 .. factor - 1], all of them produce exactly
+ * the scalar results */
+struct downscale_kernels {
+    const char *name;
+    int         cpu_flag; /* AV_CPU_FLAG_* needed, 0 for scalar */
+    void (*box2)(uint8_t *dst, const uint8_t *const *rows, int dst_width);
+    void (*box4)(uint8_t *dst, const uint8_t *const *rows, int dst_width);
+};
+
+/* whether frames of fmt can be downscaled: every plane 8-bit, one byte
+ * per pixel */
+int  downscale_supported(enum AVPixelFormat fmt);
+
+/* set format, width and height of dst to those of src downscaled by
+ * factor (2 or 4), sizes rounded up */
+void downscale_geometry(AVFrame *dst, const AVFrame *src, int factor);
+
+/* fill dst with src downscaled by factor (2 or 4), edge blocks are padded
+ * by repeating the last row / column; a blank dst is allocated, one with
+ * buffers already (e.g. from a pool) must have the downscale_geometry() */
+int  downscale_frame(AVFrame *dst, const AVFrame *src, int factor,
+                     const struct downscale_kernels *k);
+
+/* every kernel set compiled in (whether the CPU can run it or not),
+ * scalar first */
+const struct downscale_kernels *downscale_kernels_all(int *nb_kernels);
+
+/* the fastest kernel set cpu_flags allow */
+const struct downscale_kernels *downscale_kernels_best(int cpu_flags);
+
+#endif /* DOWNSCALE_H */
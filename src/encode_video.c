@@ -15,6 +15,7 @@
 
 #include <libavutil/opt.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/parseutils.h>
 
 #include <libavcodec/avcodec.h>
 
@@ -30,9 +31,19 @@ int main(int argc, char **argv) {
     AVPacket *pkt      = NULL;
     AVFrame  *frame    = NULL;
     uint8_t  endcode[] = {0, 0, 1, 0xb7};
+    int width   = 352;
+    int height  = 288;
+    int seconds = argc > 4 ? atoi(argv[4]) : 1;
 
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <output file> <codec name>\n", argv[0]);
+    if (argc < 3 ||
+        (argc > 3 && (av_parse_video_size(&width, &height, argv[3]) < 0 ||
+                      width % 2 || height % 2)) || seconds <= 0) {
+        fprintf(stderr,
+                "Usage: %s <output file> <codec name> [size [seconds]]\n\n"
+                "size     WxH or an abbreviation such as hd1080 or 4k, even "
+                "(default: 352x288)\n"
+                "seconds  length of the clip, 25 frames each (default: 1)\n",
+                argv[0]);
         exit(0);
     }
     filename   = argv[1];
@@ -55,9 +66,10 @@ int main(int argc, char **argv) {
         goto end;
     }
 
-    codec_ctx->width     = 352;
-    codec_ctx->height    = 288;
-    codec_ctx->bit_rate  = 400000;
+    /* the bit rate grows with the picture, 400 kbit/s at 352x288 */
+    codec_ctx->width     = width;
+    codec_ctx->height    = height;
+    codec_ctx->bit_rate  = 400000LL * width * height / (352 * 288);
     codec_ctx->time_base = (AVRational){1, 25};
     codec_ctx->framerate = (AVRational){25, 1};
 
@@ -113,8 +125,8 @@ int main(int argc, char **argv) {
         goto end;
     }
 
-    /* encode 1 second of video */
-    for (int i = 0; i < 25; i++) {
+    /* encode 'seconds' seconds of video */
+    for (int i = 0; i < 25 * seconds; i++) {
         fflush(stdout);
 
         /* make sure the frame data is writable */
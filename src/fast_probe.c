@@ -0,0 +1,106 @@
+/**
+ * @file fast_probe.c
+ * bounded stream info analysis: trust complete container headers and
+ * cap probesize / analyzeduration for the rest
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <libavutil/bprint.h>
+
+#include "fast_probe.h"
+
+static void missing_fields(const AVCodecParameters *, AVBPrint *);
+
+int fast_probe_open_options(AVDictionary **opts) {
+    int ret;
+
+    /* probesize also bounds the format detection inside
+     * avformat_open_input(), 32 KiB is plenty for every header we know */
+    if ((ret = av_dict_set_int(opts, "probesize", FAST_PROBE_SIZE, 0)) < 0)
+        return ret;
+    return av_dict_set_int(opts, "analyzeduration", FAST_PROBE_DURATION, 0);
+}
+
+int fast_probe_find_stream_info(AVFormatContext *fmt_ctx) {
+    int i;
+
+    for (i = 0; i < fmt_ctx->nb_streams; i++)
+        if (!fast_probe_stream_complete(fmt_ctx->streams[i]))
+            break;
+
+    /* containers without a header (MPEG-TS / PS, raw streams) add their
+     * streams while packets are read, so no stream is no information */
+    if (fmt_ctx->nb_streams && i == fmt_ctx->nb_streams)
+        return 0;
+
+    fmt_ctx->probesize            = FAST_PROBE_SIZE;
+    fmt_ctx->max_analyze_duration = FAST_PROBE_DURATION;
+
+    return avformat_find_stream_info(fmt_ctx, NULL);
+}
+
+int fast_probe_stream_complete(const AVStream *st) {
+    AVBPrint bp;
+    int complete;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    missing_fields(st->codecpar, &bp);
+    complete = !bp.len;
+    av_bprint_finalize(&bp, NULL);
+
+    return complete;
+}
+
+int fast_probe_report_incomplete(const AVFormatContext *fmt_ctx, FILE *fp) {
+    int i, nb_incomplete = 0;
+    AVBPrint bp;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        const AVCodecParameters *par = fmt_ctx->streams[i]->codecpar;
+        const char *type = av_get_media_type_string(par->codec_type);
+
+        av_bprint_clear(&bp);
+        missing_fields(par, &bp);
+        if (!bp.len)
+            continue;
+
+        fprintf(fp, "Stream #%d (%s %s) left incomplete, missing:%s\n",
+                i, type ? type : "unknown", avcodec_get_name(par->codec_id),
+                bp.str);
+        nb_incomplete++;
+    }
+    av_bprint_finalize(&bp, NULL);
+
+    return nb_incomplete;
+}
+
+static void missing_fields(const AVCodecParameters *par, AVBPrint *bp) {
+    if (par->codec_id == AV_CODEC_ID_NONE)
+        av_bprintf(bp, " codec");
+
+    switch (par->codec_type) {
+        case AVMEDIA_TYPE_VIDEO:
+            if (par->width <= 0 || par->height <= 0)
+                av_bprintf(bp, " size");
+            if (par->format < 0)
+                av_bprintf(bp, " pix_fmt");
+            break;
+        case AVMEDIA_TYPE_AUDIO:
+            if (par->sample_rate <= 0)
+                av_bprintf(bp, " sample_rate");
+            if (par->channels <= 0)
+                av_bprintf(bp, " channels");
+            if (par->format < 0)
+                av_bprintf(bp, " sample_fmt");
+            break;
+        case AVMEDIA_TYPE_UNKNOWN:
+            av_bprintf(bp, " type");
+            break;
+        default:
+            break;
+    }
+}
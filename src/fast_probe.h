@@ -0,0 +1,38 @@
+/**
+ * @file fast_probe.h
+ * bounded stream info analysis: trust complete container headers and
+ * cap probesize / analyzeduration for the rest
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef FAST_PROBE_H
+#define FAST_PROBE_H
+
+#include <stdio.h>
+
+#include <libavutil/dict.h>
+#include <libavformat/avformat.h>
+
+#define FAST_PROBE_SIZE     (32 << 10)          /* bytes */
+#define FAST_PROBE_DURATION (AV_TIME_BASE / 2)  /* 0.5 s */
+
+/* options for avformat_open_input() capping format probing and analysis,
+ * the dictionary must be freed with av_dict_free() */
+int  fast_probe_open_options(AVDictionary **opts);
+
+/* skip avformat_find_stream_info() when the headers already describe
+ * every stream completely, otherwise run it with capped probesize and
+ * analyzeduration; returns the avformat_find_stream_info() result */
+int  fast_probe_find_stream_info(AVFormatContext *fmt_ctx);
+
+/* 1 if the codec parameters of st are complete enough to open and
+ * configure a decoder without looking at any packet */
+int  fast_probe_stream_complete(const AVStream *st);
+
+/* list the streams left with incomplete parameters, returns their count */
+int  fast_probe_report_incomplete(const AVFormatContext *fmt_ctx, FILE *fp);
+
+#endif /* FAST_PROBE_H */
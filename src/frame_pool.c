@@ -0,0 +1,342 @@
+/**
+ * @file frame_pool.c
+ * recycled decoder buffers (AVBufferPool behind a get_buffer2 callback),
+ * AVFrames and AVPackets, so that steady-state decoding allocates no new
+ * frame data (the small AVBuffer / AVBufferRef wrappers and the side data
+ * libavcodec attaches are still allocated per frame)
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/buffer.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/channel_layout.h>
+
+#include "frame_pool.h"
+
+/* linesize alignment, at least what any decoder asks for (STRIDE_ALIGN) */
+#define LINE_ALIGN 64
+
+struct frame_pool {
+    pthread_mutex_t lock;
+
+    struct {
+        int           size;
+        AVBufferPool *pool;
+    } pools[FRAME_POOL_MAX_POOLS];
+    int       nb_pools;
+
+    AVFrame  *frames[FRAME_POOL_MAX_FREE];
+    int       nb_frames;
+    AVPacket *pkts[FRAME_POOL_MAX_FREE];
+    int       nb_pkts;
+
+    struct frame_pool_stats stats;
+};
+
+static AVBufferRef *get_buffer(struct frame_pool *, int);
+
+static AVBufferRef *pool_alloc(void *, int);
+
+static int          video_buffer(struct frame_pool *, AVFrame *, int, int,
+                                 const int *);
+
+static int          audio_buffer(struct frame_pool *, AVFrame *, int);
+
+static void         count_default(struct frame_pool *);
+
+int frame_pool_init(struct frame_pool **pool) {
+    struct frame_pool *p;
+
+    if (!(p = av_mallocz(sizeof(*p))))
+        return AVERROR(ENOMEM);
+    pthread_mutex_init(&p->lock, NULL);
+
+    *pool = p;
+    return 0;
+}
+
+void frame_pool_free(struct frame_pool **pool) {
+    int i;
+    struct frame_pool *p = *pool;
+
+    if (!p)
+        return;
+
+    /* a pool goes away once its last buffer has been released */
+    for (i = 0; i < p->nb_pools; i++)
+        av_buffer_pool_uninit(&p->pools[i].pool);
+    for (i = 0; i < p->nb_frames; i++)
+        av_frame_free(&p->frames[i]);
+    for (i = 0; i < p->nb_pkts; i++)
+        av_packet_free(&p->pkts[i]);
+    pthread_mutex_destroy(&p->lock);
+    av_freep(pool);
+}
+
+void frame_pool_attach(struct frame_pool *pool, AVCodecContext *avctx) {
+    avctx->opaque                = pool;
+    avctx->get_buffer2           = frame_pool_get_buffer2;
+    avctx->thread_safe_callbacks = 1;
+}
+
+int frame_pool_get_buffer2(AVCodecContext *avctx, AVFrame *frame,
+                           int flags) {
+    struct frame_pool *pool = avctx->opaque;
+    const AVPixFmtDescriptor *desc;
+    int w = frame->width;
+    int h = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+
+    if (!(avctx->codec->capabilities & AV_CODEC_CAP_DR1))
+        goto fallback;
+
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        desc = av_pix_fmt_desc_get(frame->format);
+        if (!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL |
+                                    AV_PIX_FMT_FLAG_HWACCEL))
+            goto fallback;
+
+        /* the decoder writes whole macroblocks, size the planes the way
+         * avcodec_default_get_buffer2() does */
+        avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+        if (video_buffer(pool, frame, w, h, linesize_align) >= 0)
+            return 0;
+    } else if (avctx->codec_type == AVMEDIA_TYPE_AUDIO) {
+        if (audio_buffer(pool, frame, avctx->channels) >= 0)
+            return 0;
+    }
+
+fallback:
+    count_default(pool);
+    return avcodec_default_get_buffer2(avctx, frame, flags);
+}
+
+int frame_pool_get_frame_buffer(struct frame_pool *pool, AVFrame *frame) {
+    const AVPixFmtDescriptor *desc;
+    int channels;
+
+    if (frame->width > 0 && frame->height > 0) {
+        desc = av_pix_fmt_desc_get(frame->format);
+        if (desc && !(desc->flags & (AV_PIX_FMT_FLAG_PAL |
+                                     AV_PIX_FMT_FLAG_HWACCEL)) &&
+            video_buffer(pool, frame, frame->width,
+                         FFALIGN(frame->height, 32), NULL) >= 0)
+            return 0;
+    } else if (frame->nb_samples > 0) {
+        channels = frame->channels ? frame->channels :
+                   av_get_channel_layout_nb_channels(frame->channel_layout);
+        if (audio_buffer(pool, frame, channels) >= 0)
+            return 0;
+    }
+
+    count_default(pool);
+    return av_frame_get_buffer(frame, 32);
+}
+
+AVFrame *frame_pool_get_frame(struct frame_pool *pool) {
+    AVFrame *frame = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.frame_gets++;
+    if (pool->nb_frames)
+        frame = pool->frames[--pool->nb_frames];
+    else
+        pool->stats.frame_allocs++;
+    pthread_mutex_unlock(&pool->lock);
+
+    return frame ? frame : av_frame_alloc();
+}
+
+AVPacket *frame_pool_get_packet(struct frame_pool *pool) {
+    AVPacket *pkt = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.packet_gets++;
+    if (pool->nb_pkts)
+        pkt = pool->pkts[--pool->nb_pkts];
+    else
+        pool->stats.packet_allocs++;
+    pthread_mutex_unlock(&pool->lock);
+
+    return pkt ? pkt : av_packet_alloc();
+}
+
+void frame_pool_put_frame(struct frame_pool *pool, AVFrame **frame) {
+    if (!*frame)
+        return;
+
+    av_frame_unref(*frame);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->nb_frames < FRAME_POOL_MAX_FREE) {
+        pool->frames[pool->nb_frames++] = *frame;
+        *frame = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    av_frame_free(frame);
+}
+
+void frame_pool_put_packet(struct frame_pool *pool, AVPacket **pkt) {
+    if (!*pkt)
+        return;
+
+    av_packet_unref(*pkt);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->nb_pkts < FRAME_POOL_MAX_FREE) {
+        pool->pkts[pool->nb_pkts++] = *pkt;
+        *pkt = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    av_packet_free(pkt);
+}
+
+void frame_pool_get_stats(struct frame_pool *pool,
+                          struct frame_pool_stats *stats) {
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void frame_pool_dump_stats(struct frame_pool *pool, FILE *fp) {
+    int nb_pools;
+    struct frame_pool_stats stats;
+
+    frame_pool_get_stats(pool, &stats);
+    pthread_mutex_lock(&pool->lock);
+    nb_pools = pool->nb_pools;
+    pthread_mutex_unlock(&pool->lock);
+
+    fprintf(fp,
+            "frame pool: %"PRId64" buffers from %d pools, %"PRId64" "
+            "new pool buffers (the last for buffer %"PRId64"), %"PRId64" "
+            "left to the default allocator; frames %"PRId64" / %"PRId64" "
+            "allocated, packets %"PRId64" / %"PRId64" allocated (buffer "
+            "refs and side data not counted)\n",
+            stats.buffer_gets, nb_pools, stats.buffer_allocs,
+            stats.last_alloc, stats.buffer_defaults,
+            stats.frame_gets, stats.frame_allocs,
+            stats.packet_gets, stats.packet_allocs);
+}
+
+static AVBufferRef *get_buffer(struct frame_pool *pool, int size) {
+    int i;
+    AVBufferRef *buf = NULL;
+
+    size = FFALIGN(size, FRAME_POOL_SIZE_ALIGN);
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < pool->nb_pools && pool->pools[i].size != size; i++)
+        ;
+    if (i == pool->nb_pools && i < FRAME_POOL_MAX_POOLS &&
+        (pool->pools[i].pool = av_buffer_pool_init2(size, pool, pool_alloc,
+                                                    NULL))) {
+        pool->pools[i].size = size;
+        pool->nb_pools++;
+    }
+    if (i < pool->nb_pools &&
+        (buf = av_buffer_pool_get(pool->pools[i].pool)))
+        pool->stats.buffer_gets++;
+    pthread_mutex_unlock(&pool->lock);
+
+    return buf;
+}
+
+static AVBufferRef *pool_alloc(void *opaque, int size) {
+    struct frame_pool *pool = opaque;
+
+    /* only called from av_buffer_pool_get() in get_buffer(), under the
+     * lock; zeroed like the buffers of the default allocator */
+    pool->stats.buffer_allocs++;
+    pool->stats.last_alloc = pool->stats.buffer_gets + 1;
+
+    return av_buffer_allocz(size);
+}
+
+/* linesize_align: what the decoder asks for per plane, or NULL */
+static int video_buffer(struct frame_pool *pool, AVFrame *frame,
+                        int w, int h, const int *linesize_align) {
+    int i, ret, size, unaligned;
+    int linesize[4];
+    uint8_t *data[4];
+    AVBufferRef *buf;
+
+    /* widen the picture until every plane is aligned, as
+     * avcodec_default_get_buffer2() does: aligning the planes one by one
+     * would break linesize[0] == 2 * linesize[1] and the like, which some
+     * decoders rely on */
+    do {
+        if ((ret = av_image_fill_linesizes(linesize, frame->format, w)) < 0)
+            return ret;
+        w += w & ~(w - 1);
+
+        unaligned = 0;
+        for (i = 0; i < 4; i++)
+            unaligned |= linesize[i] %
+                         FFMAX(linesize_align ? linesize_align[i] : 0,
+                               LINE_ALIGN);
+    } while (unaligned);
+
+    /* with a NULL base the plane pointers are offsets into one buffer */
+    if ((size = av_image_fill_pointers(data, frame->format, h, NULL,
+                                       linesize)) < 0)
+        return size;
+    /* pseudo-paletted formats (gray8, rgb8, ...) come with a palette
+     * in data[1] that av_image_copy() relies on, left to the default */
+    if (data[1] && !linesize[1])
+        return AVERROR(ENOSYS);
+
+    /* SIMD code may read a little past the end of the last row */
+    if (!(buf = get_buffer(pool, size + 16 + LINE_ALIGN - 1)))
+        return AVERROR(ENOMEM);
+
+    frame->buf[0] = buf;
+    for (i = 0; i < 4 && linesize[i]; i++) {
+        frame->data[i]     = buf->data + (intptr_t)data[i];
+        frame->linesize[i] = linesize[i];
+    }
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+static int audio_buffer(struct frame_pool *pool, AVFrame *frame,
+                        int channels) {
+    int size, linesize;
+    int planes = av_sample_fmt_is_planar(frame->format) ? channels : 1;
+    AVBufferRef *buf;
+
+    /* more planes than data[] holds need extended_buf */
+    if (channels <= 0 || planes > AV_NUM_DATA_POINTERS)
+        return AVERROR(ENOSYS);
+    if ((size = av_samples_get_buffer_size(&linesize, channels,
+                                           frame->nb_samples,
+                                           frame->format, 0)) < 0)
+        return size;
+
+    if (!(buf = get_buffer(pool, size)))
+        return AVERROR(ENOMEM);
+
+    frame->buf[0] = buf;
+    av_samples_fill_arrays(frame->data, &frame->linesize[0], buf->data,
+                           channels, frame->nb_samples, frame->format, 0);
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+static void count_default(struct frame_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.buffer_defaults++;
+    pthread_mutex_unlock(&pool->lock);
+}
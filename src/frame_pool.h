@@ -0,0 +1,84 @@
+/**
+ * @file frame_pool.h
+ * recycled decoder buffers (AVBufferPool behind a get_buffer2 callback),
+ * AVFrames and AVPackets, so that steady-state decoding allocates no new
+ * frame data (the small AVBuffer / AVBufferRef wrappers and the side data
+ * libavcodec attaches are still allocated per frame)
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+
+/* distinct buffer sizes (one AVBufferPool each), sizes are rounded up to
+ * FRAME_POOL_SIZE_ALIGN so that e.g. short last audio frames share one */
+#define FRAME_POOL_MAX_POOLS  16
+#define FRAME_POOL_SIZE_ALIGN 4096
+
+/* blank AVFrames / AVPackets kept for reuse, the rest is freed */
+#define FRAME_POOL_MAX_FREE   64
+
+/* counts pool buffers, AVFrames and AVPackets only: av_buffer_pool_get()
+ * still allocates an AVBuffer and an AVBufferRef per buffer handed out,
+ * and libavcodec its per-frame side data, none of which shows here */
+struct frame_pool_stats {
+    int64_t buffer_gets;     /* buffers handed out */
+    int64_t buffer_allocs;   /* of which new pool buffers (frame data) */
+    int64_t buffer_defaults; /* left to avcodec_default_get_buffer2() */
+    int64_t last_alloc;      /* buffer_gets at the last allocation */
+    int64_t frame_gets;
+    int64_t frame_allocs;
+    int64_t packet_gets;
+    int64_t packet_allocs;
+};
+
+struct frame_pool;
+
+int  frame_pool_init(struct frame_pool **pool);
+
+/* frees the recycled frames and packets; buffers still referenced go back
+ * to the heap when released, so frames may outlive the pool, but codec
+ * contexts attached to it may not */
+void frame_pool_free(struct frame_pool **pool);
+
+/* make avctx decode into pool buffers, before avcodec_open2(); uses
+ * avctx->opaque */
+void frame_pool_attach(struct frame_pool *pool, AVCodecContext *avctx);
+
+/* the get_buffer2 callback installed by frame_pool_attach(), falls back to
+ * avcodec_default_get_buffer2() for hardware, paletted and non-DR1
+ * decoders; thread safe */
+int  frame_pool_get_buffer2(AVCodecContext *avctx, AVFrame *frame,
+                            int flags);
+
+/* av_frame_get_buffer() from the pool: format, width and height (video)
+ * or format, channel_layout and nb_samples (audio) have to be set */
+int  frame_pool_get_frame_buffer(struct frame_pool *pool, AVFrame *frame);
+
+/* a blank frame / packet, recycled when possible */
+AVFrame  *frame_pool_get_frame(struct frame_pool *pool);
+
+AVPacket *frame_pool_get_packet(struct frame_pool *pool);
+
+/* unreference *frame / *pkt, keep it for reuse and set the pointer to
+ * NULL; NULL is a no-op */
+void frame_pool_put_frame(struct frame_pool *pool, AVFrame **frame);
+
+void frame_pool_put_packet(struct frame_pool *pool, AVPacket **pkt);
+
+/* a consistent copy, the counters move on from other threads */
+void frame_pool_get_stats(struct frame_pool *pool,
+                          struct frame_pool_stats *stats);
+
+void frame_pool_dump_stats(struct frame_pool *pool, FILE *fp);
+
+#endif /* FRAME_POOL_H */
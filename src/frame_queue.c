@@ -0,0 +1,264 @@
+/**
+ * @file frame_queue.c
+ * bounded queue of refcounted AVFrames between a decode loop and a
+ * consumer thread, limited in frames and in bytes referenced
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include "frame_queue.h"
+
+struct frame_queue {
+    AVFrame **frames;    /* circular, nb_frames starting at head */
+    int64_t  *sizes;     /* bytes referenced by each queued frame */
+    int       max_frames;
+    int64_t   max_bytes;
+    int       head;
+    int       nb_frames;
+    int64_t   bytes;
+    int       finished;
+    int       aborted;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+
+    int     (*consume)(void *, AVFrame *);
+    void     *opaque;
+    pthread_t thread;
+    int       consumer_running;
+    int       consumer_ret;
+
+    struct frame_queue_stats stats;
+};
+
+static int64_t frame_bytes(const AVFrame *);
+
+static void   *consumer(void *);
+
+int frame_queue_init(struct frame_queue **q, int max_frames,
+                     int64_t max_bytes) {
+    int i;
+    struct frame_queue *fq;
+
+    if (!(fq = av_mallocz(sizeof(*fq))))
+        return AVERROR(ENOMEM);
+    fq->max_frames = max_frames > 0 ? max_frames : FRAME_QUEUE_MAX_FRAMES;
+    fq->max_bytes  = max_bytes  > 0 ? max_bytes  : FRAME_QUEUE_MAX_BYTES;
+
+    fq->frames = av_mallocz_array(fq->max_frames, sizeof(*fq->frames));
+    fq->sizes  = av_mallocz_array(fq->max_frames, sizeof(*fq->sizes));
+    if (!fq->frames || !fq->sizes)
+        goto fail;
+    for (i = 0; i < fq->max_frames; i++)
+        if (!(fq->frames[i] = av_frame_alloc()))
+            goto fail;
+
+    pthread_mutex_init(&fq->lock, NULL);
+    pthread_cond_init(&fq->not_empty, NULL);
+    pthread_cond_init(&fq->not_full, NULL);
+
+    *q = fq;
+    return 0;
+
+fail:
+    for (i = 0; fq->frames && i < fq->max_frames; i++)
+        av_frame_free(&fq->frames[i]);
+    av_free(fq->frames);
+    av_free(fq->sizes);
+    av_free(fq);
+    return AVERROR(ENOMEM);
+}
+
+void frame_queue_free(struct frame_queue **q) {
+    int i;
+    struct frame_queue *fq = *q;
+
+    if (!fq)
+        return;
+
+    frame_queue_abort(fq);
+    frame_queue_join_consumer(fq);
+
+    /* av_frame_free() drops whatever references are still queued */
+    for (i = 0; i < fq->max_frames; i++)
+        av_frame_free(&fq->frames[i]);
+    av_free(fq->frames);
+    av_free(fq->sizes);
+
+    pthread_cond_destroy(&fq->not_full);
+    pthread_cond_destroy(&fq->not_empty);
+    pthread_mutex_destroy(&fq->lock);
+    av_freep(q);
+}
+
+int frame_queue_push(struct frame_queue *q, AVFrame *frame) {
+    int tail;
+    int64_t size = frame_bytes(frame);
+
+    pthread_mutex_lock(&q->lock);
+    if (!q->aborted && (q->nb_frames == q->max_frames ||
+                        (q->nb_frames && q->bytes + size > q->max_bytes))) {
+        int64_t t = av_gettime_relative();
+
+        while (!q->aborted && (q->nb_frames == q->max_frames ||
+                               (q->nb_frames &&
+                                q->bytes + size > q->max_bytes)))
+            pthread_cond_wait(&q->not_full, &q->lock);
+        q->stats.push_blocked_us += av_gettime_relative() - t;
+    }
+    if (q->aborted) {
+        pthread_mutex_unlock(&q->lock);
+        return AVERROR_EXIT;
+    }
+
+    tail = (q->head + q->nb_frames) % q->max_frames;
+    av_frame_move_ref(q->frames[tail], frame);
+    q->sizes[tail] = size;
+    q->nb_frames++;
+    q->bytes += size;
+
+    q->stats.nb_frames++;
+    q->stats.depth_sum += q->nb_frames;
+    q->stats.depth_max  = FFMAX(q->stats.depth_max, q->nb_frames);
+    q->stats.bytes_max  = FFMAX(q->stats.bytes_max, q->bytes);
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+int frame_queue_pop(struct frame_queue *q, AVFrame *frame) {
+    pthread_mutex_lock(&q->lock);
+    if (!q->aborted && !q->finished && !q->nb_frames) {
+        int64_t t = av_gettime_relative();
+
+        while (!q->aborted && !q->finished && !q->nb_frames)
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        q->stats.pop_blocked_us += av_gettime_relative() - t;
+    }
+    if (q->aborted || !q->nb_frames) {
+        pthread_mutex_unlock(&q->lock);
+        return q->aborted ? AVERROR_EXIT : AVERROR_EOF;
+    }
+
+    av_frame_move_ref(frame, q->frames[q->head]);
+    q->bytes -= q->sizes[q->head];
+    q->head   = (q->head + 1) % q->max_frames;
+    q->nb_frames--;
+
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+void frame_queue_finish(struct frame_queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->finished = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void frame_queue_abort(struct frame_queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->aborted = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+int frame_queue_start_consumer(struct frame_queue *q,
+                               int (*consume)(void *opaque, AVFrame *frame),
+                               void *opaque) {
+    int ret;
+
+    q->consume      = consume;
+    q->opaque       = opaque;
+    q->consumer_ret = 0;
+    if ((ret = pthread_create(&q->thread, NULL, consumer, q)))
+        return AVERROR(ret);
+    q->consumer_running = 1;
+
+    return 0;
+}
+
+int frame_queue_join_consumer(struct frame_queue *q) {
+    if (q->consumer_running) {
+        pthread_join(q->thread, NULL);
+        q->consumer_running = 0;
+    }
+
+    return q->consumer_ret;
+}
+
+const struct frame_queue_stats *frame_queue_get_stats(struct frame_queue *q) {
+    return &q->stats;
+}
+
+void frame_queue_dump_stats(struct frame_queue *q, const char *name,
+                            FILE *fp) {
+    const struct frame_queue_stats *stats = &q->stats;
+
+    fprintf(fp,
+            "frame queue (%s): %"PRId64" frames, depth avg %.1f max %d "
+            "of %d, peak %.1f MiB of %.1f MiB, decode blocked %.3f s, "
+            "write blocked %.3f s\n",
+            name, stats->nb_frames,
+            stats->nb_frames ?
+            (double)stats->depth_sum / stats->nb_frames : 0.0,
+            stats->depth_max, q->max_frames,
+            stats->bytes_max / (1024.0 * 1024.0),
+            q->max_bytes / (1024.0 * 1024.0),
+            stats->push_blocked_us / 1e6, stats->pop_blocked_us / 1e6);
+}
+
+static int64_t frame_bytes(const AVFrame *frame) {
+    int i;
+    int64_t size = 0;
+
+    /* what the references keep alive, shared buffers are counted once
+     * per frame which errs on the safe side */
+    for (i = 0; i < FF_ARRAY_ELEMS(frame->buf) && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    for (i = 0; i < frame->nb_extended_buf; i++)
+        size += frame->extended_buf[i]->size;
+
+    return size;
+}
+
+static void *consumer(void *arg) {
+    int ret;
+    struct frame_queue *q = arg;
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame) {
+        q->consumer_ret = AVERROR(ENOMEM);
+        frame_queue_abort(q);
+        return NULL;
+    }
+
+    while ((ret = frame_queue_pop(q, frame)) >= 0) {
+        ret = q->consume(q->opaque, frame);
+        av_frame_unref(frame);
+        if (ret < 0) {
+            q->consumer_ret = ret;
+            frame_queue_abort(q);
+            break;
+        }
+    }
+
+    av_frame_free(&frame);
+    return NULL;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file frame_queue.h
+ * bounded queue of refcounted AVFrames between a decode loop and a
+ * consumer thread, limited in frames and in bytes referenced
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+#define FRAME_QUEUE_MAX_FRAMES 16
+#define FRAME_QUEUE_MAX_BYTES  (256 << 20)
+
+struct frame_queue_stats {
+    int64_t nb_frames;       /* frames pushed */
+    int64_t depth_sum;       /* queue depth sampled at each push */
+    int     depth_max;
+    int64_t bytes_max;       /* peak of the bytes referenced by the queue */
+    int64_t push_blocked_us; /* time the producer waited for room */
+    int64_t pop_blocked_us;  /* time the consumer waited for frames */
+};
+
+struct frame_queue;
+
+/* max_frames and max_bytes bound the queue, 0 selects the defaults; a
+ * frame larger than max_bytes on its own is still let into an empty
+ * queue */
+int  frame_queue_init(struct frame_queue **q, int max_frames,
+                      int64_t max_bytes);
+
+/* abort the queue, join the consumer and free everything still queued */
+void frame_queue_free(struct frame_queue **q);
+
+/* move the references of frame into the queue (frame is left blank),
+ * blocking while the queue is full; AVERROR_EXIT once aborted */
+int  frame_queue_push(struct frame_queue *q, AVFrame *frame);
+
+/* move the oldest frame into frame, blocking while the queue is empty;
+ * AVERROR_EOF once finished and drained, AVERROR_EXIT once aborted */
+int  frame_queue_pop(struct frame_queue *q, AVFrame *frame);
+
+/* no more pushes, the consumer drains what is left and sees EOF */
+void frame_queue_finish(struct frame_queue *q);
+
+/* wake everyone up and make push / pop fail from now on */
+void frame_queue_abort(struct frame_queue *q);
+
+/* pop frames on a new thread and hand them to consume() (which must not
+ * keep references past its return) until EOF; an error of consume()
+ * aborts the queue */
+int  frame_queue_start_consumer(struct frame_queue *q,
+                                int (*consume)(void *opaque, AVFrame *frame),
+                                void *opaque);
+
+/* wait for the consumer, returns the first consume() error or 0 */
+int  frame_queue_join_consumer(struct frame_queue *q);
+
+const struct frame_queue_stats *frame_queue_get_stats(struct frame_queue *q);
+
+void frame_queue_dump_stats(struct frame_queue *q, const char *name,
+                            FILE *fp);
+
+#endif /* FRAME_QUEUE_H */
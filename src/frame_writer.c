@@ -0,0 +1,587 @@
+/**
+ * @file frame_writer.c
+ * write decoded video frames as one PGM file per frame, or all of them
+ * into a single Y4M or raw video stream with one writev() per frame,
+ * straight from the frame planes
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* fallocate(), sync_file_range() */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+
+#include "frame_writer.h"
+#include "trace.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct frame_writer {
+    enum frame_writer_mode mode;
+    char      *filename;
+    int        fd;
+    AVRational frame_rate;
+    int        copy;
+
+    /* taken from the first frame, width 0 until then */
+    int        width;
+    int        height;
+    enum AVPixelFormat pix_fmt;
+    int        nb_planes;
+    int        plane_bytes[4];  /* bytes per row of each plane */
+    int        plane_height[4];
+
+    uint8_t   *staging;         /* FRAME_WRITER_ALIGN aligned, copy mode */
+    size_t     frame_size;
+    struct iovec *iov;          /* header, tag and one per row at most */
+    char       header[128];     /* Y4M stream header */
+    int        header_len;      /* not yet written while non zero */
+
+    /* mmap mode: the file is reserved up to alloc_size and written
+     * through the window [map_offset, map_offset + map_size) */
+    int        use_mmap;
+    int64_t    mmap_frames;     /* estimated, 0 if unknown */
+    int64_t    file_size;       /* written so far, the final size */
+    int64_t    alloc_size;
+    uint8_t   *map;
+    int64_t    map_offset;
+    size_t     map_size;
+
+    struct frame_writer_stats stats;
+};
+
+static int         setup(struct frame_writer *, const AVFrame *);
+
+static int         write_pgm(struct frame_writer *, const AVFrame *);
+
+static int         write_stream(struct frame_writer *, const AVFrame *);
+
+static int         setup_mmap(struct frame_writer *);
+
+static int         write_mapped(struct frame_writer *, const AVFrame *);
+
+static int         map_window(struct frame_writer *, size_t);
+
+static int         reserve(struct frame_writer *, int64_t);
+
+static int         add_plane(struct frame_writer *, int, const uint8_t *,
+                             int, int);
+
+static int         add_iov(struct iovec *, int, const uint8_t *, size_t);
+
+static int         writev_all(int, struct iovec *, int, int64_t *);
+
+static const char *y4m_colorspace(enum AVPixelFormat);
+
+int frame_writer_open(struct frame_writer **fw, const char *filename,
+                      enum frame_writer_mode mode) {
+    struct frame_writer *w;
+
+    if (!(w = av_mallocz(sizeof(*w))))
+        return AVERROR(ENOMEM);
+    w->mode       = mode;
+    w->fd         = -1;
+    w->frame_rate = (AVRational){25, 1};
+    if (!(w->filename = av_strdup(filename))) {
+        av_free(w);
+        return AVERROR(ENOMEM);
+    }
+
+    if (mode != FRAME_WRITER_PGM &&
+        (w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        int ret = AVERROR(errno);
+        fprintf(stderr, "Could not open '%s'\n", filename);
+        av_free(w->filename);
+        av_free(w);
+        return ret;
+    }
+
+    *fw = w;
+    return 0;
+}
+
+void frame_writer_set_frame_rate(struct frame_writer *fw,
+                                 AVRational frame_rate) {
+    if (!fw->width && frame_rate.num > 0 && frame_rate.den > 0)
+        fw->frame_rate = frame_rate;
+}
+
+void frame_writer_set_copy(struct frame_writer *fw, int copy) {
+    if (!fw->width)
+        fw->copy = copy;
+}
+
+void frame_writer_set_mmap(struct frame_writer *fw, int64_t nb_frames) {
+    if (!fw->width && fw->mode != FRAME_WRITER_PGM) {
+        fw->use_mmap    = 1;
+        fw->mmap_frames = FFMAX(nb_frames, 0);
+    }
+}
+
+int frame_writer_write(struct frame_writer *fw, const AVFrame *frame) {
+    int ret;
+    int64_t t = av_gettime_relative();
+
+    if (fw->mode == FRAME_WRITER_PGM)
+        ret = write_pgm(fw, frame);
+    else
+        ret = write_stream(fw, frame);
+    if (ret < 0)
+        return ret;
+
+    fw->stats.nb_frames++;
+    fw->stats.write_us += av_gettime_relative() - t;
+
+    return 0;
+}
+
+void frame_writer_close(struct frame_writer **fw) {
+    if (!*fw)
+        return;
+
+    if ((*fw)->map)
+        munmap((*fw)->map, (*fw)->map_size);
+    /* drop what was reserved past the last frame */
+    if ((*fw)->use_mmap && (*fw)->fd >= 0 &&
+        ftruncate((*fw)->fd, (*fw)->file_size) < 0)
+        fprintf(stderr, "Could not truncate '%s'\n", (*fw)->filename);
+    if ((*fw)->fd >= 0)
+        close((*fw)->fd);
+    free((*fw)->staging);
+    av_free((*fw)->iov);
+    av_free((*fw)->filename);
+    av_freep(fw);
+}
+
+const struct frame_writer_stats *frame_writer_get_stats(
+        struct frame_writer *fw) {
+    return &fw->stats;
+}
+
+void frame_writer_dump_stats(struct frame_writer *fw, FILE *fp) {
+    static const char *const names[] = {"pgm", "y4m", "raw"};
+    const struct frame_writer_stats *stats = &fw->stats;
+    double mb  = stats->bytes_written / (1024.0 * 1024.0);
+    double sec = FFMAX(stats->write_us, 1) / 1e6;
+
+    fprintf(fp,
+            "frame writer (%s): %"PRId64" frames, %.1f MiB in %.3f s, "
+            "%.1f MiB/s, %.1f frames/s, %"PRId64" %s",
+            names[fw->mode], stats->nb_frames, mb, sec, mb / sec,
+            stats->nb_frames / sec, stats->nb_writes,
+            fw->mode == FRAME_WRITER_PGM ? "files" : "writes");
+    if (fw->use_mmap)
+        fprintf(fp, ", mmap, %"PRId64" windows, %.1f MiB reserved in "
+                "%"PRId64" fallocate() calls", stats->nb_maps,
+                stats->bytes_reserved / (1024.0 * 1024.0),
+                stats->nb_reserves);
+    else if (fw->mode != FRAME_WRITER_PGM && fw->copy)
+        fprintf(fp, ", %.1f MiB copied", stats->bytes_copied /
+                (1024.0 * 1024.0));
+    else if (fw->mode != FRAME_WRITER_PGM)
+        fprintf(fp, ", zero-copy, %"PRId64" whole / %"PRId64" row-wise "
+                "planes, %.1f iovecs/frame", stats->planes_whole,
+                stats->planes_rows,
+                (double)stats->nb_iovecs / FFMAX(stats->nb_frames, 1));
+    fprintf(fp, "\n");
+}
+
+int frame_writer_mode_from_name(const char *name) {
+    if (!strcmp(name, "pgm"))
+        return FRAME_WRITER_PGM;
+    if (!strcmp(name, "y4m"))
+        return FRAME_WRITER_Y4M;
+    if (!strcmp(name, "raw"))
+        return FRAME_WRITER_RAW;
+    return -1;
+}
+
+static int setup(struct frame_writer *fw, const AVFrame *frame) {
+    int i, ret;
+    int nb_iov = 2;
+    int linesize[4];
+    const char *colorspace = NULL;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_HWACCEL |
+                                AV_PIX_FMT_FLAG_BITSTREAM) ||
+        (fw->mode == FRAME_WRITER_Y4M &&
+         !(colorspace = y4m_colorspace(frame->format)))) {
+        fprintf(stderr, "Pixel format %s cannot be written as %s\n",
+                desc ? desc->name : "none",
+                fw->mode == FRAME_WRITER_Y4M ? "y4m" : "raw video");
+        return AVERROR(ENOSYS);
+    }
+
+    /* rows are stored unpadded, so the minimal linesizes are the row
+     * sizes, and chroma planes are subsampled vertically as well */
+    if ((ret = av_image_fill_linesizes(linesize, frame->format,
+                                       frame->width)) < 0)
+        return ret;
+    fw->nb_planes  = av_pix_fmt_count_planes(frame->format);
+    fw->frame_size = 0;
+    for (i = 0; i < fw->nb_planes; i++) {
+        fw->plane_bytes[i]  = linesize[i];
+        fw->plane_height[i] = i == 1 || i == 2 ?
+                              AV_CEIL_RSHIFT(frame->height,
+                                             desc->log2_chroma_h) :
+                              frame->height;
+        fw->frame_size += (size_t)fw->plane_bytes[i] * fw->plane_height[i];
+        nb_iov         += fw->plane_height[i];
+    }
+
+    /* the palette follows the indices, as av_image_copy() lays it out */
+    if (desc->flags & AV_PIX_FMT_FLAG_PAL) {
+        fw->plane_bytes[1]  = AVPALETTE_SIZE;
+        fw->plane_height[1] = 1;
+        fw->nb_planes       = 2;
+        fw->frame_size     += AVPALETTE_SIZE;
+        nb_iov++;
+    }
+
+    if (!(fw->iov = av_malloc_array(nb_iov, sizeof(*fw->iov))))
+        return AVERROR(ENOMEM);
+
+    if (fw->mode == FRAME_WRITER_Y4M) {
+        AVRational sar = frame->sample_aspect_ratio;
+
+        fw->header_len = snprintf(fw->header, sizeof(fw->header),
+                                  "YUV4MPEG2 W%d H%d F%d:%d I%c A%d:%d C%s\n",
+                                  frame->width, frame->height,
+                                  fw->frame_rate.num, fw->frame_rate.den,
+                                  !frame->interlaced_frame ? 'p' :
+                                  frame->top_field_first ? 't' : 'b',
+                                  sar.num, sar.num ? sar.den : 0,
+                                  colorspace);
+    }
+
+    /* the reservation covers the stream header, which is known by now */
+    if (fw->use_mmap && (ret = setup_mmap(fw)) < 0)
+        return ret;
+    if (fw->copy && !fw->use_mmap &&
+        (ret = posix_memalign((void **)&fw->staging, FRAME_WRITER_ALIGN,
+                              FFALIGN(fw->frame_size, FRAME_WRITER_ALIGN))))
+        return AVERROR(ret);
+
+    fw->width   = frame->width;
+    fw->height  = frame->height;
+    fw->pix_fmt = frame->format;
+
+    return 0;
+}
+
+static int write_pgm(struct frame_writer *fw, const AVFrame *frame) {
+    int i, ret;
+    FILE *fp;
+    char filename[1024];
+    TRACE_BEGIN(t);
+
+    /* the historical output: a file per frame, luma rows written one at
+     * a time through stdio */
+    snprintf(filename, sizeof(filename), "%s-%"PRId64,
+             fw->filename, fw->stats.nb_frames + 1);
+    if (!(fp = fopen(filename, "w"))) {
+        fprintf(stderr, "Could not open '%s'\n", filename);
+        return AVERROR(errno);
+    }
+    fprintf(fp, "P5\n%d %d\n%d\n", frame->width, frame->height, 255);
+    for (i = 0; i < frame->height; i++)
+        fwrite(frame->data[0] + i * frame->linesize[0], 1, frame->width, fp);
+    fw->stats.bytes_written += ftell(fp);
+    fw->stats.nb_writes++;
+
+    ret = fclose(fp) ? AVERROR(errno) : 0;
+    TRACE_END(TRACE_WRITE, t);
+    return ret;
+}
+
+static int write_stream(struct frame_writer *fw, const AVFrame *frame) {
+    static const char frame_tag[] = "FRAME\n";
+    int i, n, ret;
+    int nb_iov = 0;
+    int first;
+    uint8_t *dst;
+
+    if (!fw->width) {
+        if ((ret = setup(fw, frame)) < 0)
+            return ret;
+    } else if (frame->width  != fw->width  ||
+               frame->height != fw->height || frame->format != fw->pix_fmt) {
+        fprintf(stderr,
+                "Error: width, height and pixel format have to be constant "
+                "in a single stream file (%dx%d %s, now %dx%d %s)\n",
+                fw->width, fw->height, av_get_pix_fmt_name(fw->pix_fmt),
+                frame->width, frame->height,
+                av_get_pix_fmt_name(frame->format));
+        return AVERROR(EINVAL);
+    }
+
+    if (fw->use_mmap)
+        return write_mapped(fw, frame);
+
+    if (fw->header_len)
+        fw->iov[nb_iov++] = (struct iovec){fw->header, fw->header_len};
+    if (fw->mode == FRAME_WRITER_Y4M)
+        fw->iov[nb_iov++] = (struct iovec){(void *)frame_tag,
+                                           sizeof(frame_tag) - 1};
+    first = nb_iov;
+
+    if (fw->copy) {
+        TRACE_BEGIN(t_copy);
+
+        /* pack the planes without their padding, so the whole frame is
+         * one contiguous, page aligned block */
+        dst = fw->staging;
+        for (i = 0; i < fw->nb_planes; i++) {
+            av_image_copy_plane(dst, fw->plane_bytes[i],
+                                frame->data[i], frame->linesize[i],
+                                fw->plane_bytes[i], fw->plane_height[i]);
+            dst += (size_t)fw->plane_bytes[i] * fw->plane_height[i];
+        }
+        fw->stats.bytes_copied += fw->frame_size;
+        TRACE_END(TRACE_COPY, t_copy);
+        fw->iov[nb_iov++] = (struct iovec){fw->staging, fw->frame_size};
+    } else {
+        /* the kernel gathers the rows from the frame itself, nothing is
+         * read or written by the CPU before the write */
+        for (i = 0; i < fw->nb_planes; i++)
+            nb_iov = add_plane(fw, nb_iov, frame->data[i],
+                               frame->linesize[i], i);
+    }
+    fw->stats.nb_iovecs += nb_iov - first;
+
+    for (i = 0; i < nb_iov; i++)
+        fw->stats.bytes_written += fw->iov[i].iov_len;
+    for (i = 0; i < nb_iov; i += n) {
+        TRACE_BEGIN(t_write);
+
+        n = FFMIN(nb_iov - i, IOV_MAX);
+        ret = writev_all(fw->fd, fw->iov + i, n, &fw->stats.nb_writes);
+        TRACE_END(TRACE_WRITE, t_write);
+        if (ret < 0) {
+            fprintf(stderr, "Could not write to '%s'\n", fw->filename);
+            return ret;
+        }
+    }
+    fw->header_len = 0;
+
+    return 0;
+}
+
+static int setup_mmap(struct frame_writer *fw) {
+    int fd;
+    struct stat st;
+    int64_t size = fw->header_len + fw->mmap_frames *
+                   (fw->frame_size + (fw->mode == FRAME_WRITER_Y4M ?
+                                     sizeof("FRAME\n") - 1 : 0));
+
+    if (fstat(fw->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "'%s' is not a regular file, not memory mapped\n",
+                fw->filename);
+        fw->use_mmap = 0;
+        return 0;
+    }
+
+    /* a shared mapping needs the file open for reading as well; nothing
+     * has been written to it yet */
+    if ((fd = open(fw->filename, O_RDWR)) < 0 || dup2(fd, fw->fd) < 0) {
+        int ret = AVERROR(errno);
+        fprintf(stderr, "Could not reopen '%s' for mapping\n", fw->filename);
+        if (fd >= 0)
+            close(fd);
+        return ret;
+    }
+    close(fd);
+
+    return size > 0 ? reserve(fw, size) : 0;
+}
+
+static int write_mapped(struct frame_writer *fw, const AVFrame *frame) {
+    static const char frame_tag[] = "FRAME\n";
+    int i, ret;
+    size_t len = fw->header_len + fw->frame_size +
+                 (fw->mode == FRAME_WRITER_Y4M ? sizeof(frame_tag) - 1 : 0);
+    uint8_t *dst;
+    TRACE_BEGIN(t);
+
+    if ((ret = map_window(fw, len)) < 0) {
+        fprintf(stderr, "Could not map '%s' (%s)\n", fw->filename,
+                av_err2str(ret));
+        return ret;
+    }
+
+    /* the rows go from the frame into the page cache, no system call */
+    dst = fw->map + (fw->file_size - fw->map_offset);
+    memcpy(dst, fw->header, fw->header_len);
+    dst += fw->header_len;
+    if (fw->mode == FRAME_WRITER_Y4M) {
+        memcpy(dst, frame_tag, sizeof(frame_tag) - 1);
+        dst += sizeof(frame_tag) - 1;
+    }
+    for (i = 0; i < fw->nb_planes; i++) {
+        av_image_copy_plane(dst, fw->plane_bytes[i],
+                            frame->data[i], frame->linesize[i],
+                            fw->plane_bytes[i], fw->plane_height[i]);
+        dst += (size_t)fw->plane_bytes[i] * fw->plane_height[i];
+    }
+    TRACE_END(TRACE_WRITE, t);
+
+    fw->file_size           += len;
+    fw->stats.bytes_written += len;
+    fw->header_len           = 0;
+
+    return 0;
+}
+
+/* make [file_size, file_size + len) part of the mapped window */
+static int map_window(struct frame_writer *fw, size_t len) {
+    int ret;
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t offset;
+    size_t size;
+    void *map;
+
+    if (fw->map && fw->file_size + len <= fw->map_offset + fw->map_size)
+        return 0;
+
+    if (fw->map) {
+        /* start the write-back of the window left behind, so that dirty
+         * pages do not pile up over gigabytes of output */
+        sync_file_range(fw->fd, fw->map_offset, fw->map_size,
+                        SYNC_FILE_RANGE_WRITE);
+        munmap(fw->map, fw->map_size);
+        fw->map = NULL;
+    }
+
+    offset = fw->file_size & ~(page - 1);
+    size   = FFALIGN(FFMAX(FRAME_WRITER_MMAP_WINDOW,
+                           fw->file_size - offset + len), page);
+    /* touching a page past the end of the file raises SIGBUS */
+    if (offset + (int64_t)size > fw->alloc_size &&
+        (ret = reserve(fw, FFMAX(offset + (int64_t)size,
+                                 fw->alloc_size + fw->alloc_size / 2))) < 0)
+        return ret;
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fw->fd,
+               offset);
+    if (map == MAP_FAILED)
+        return AVERROR(errno);
+    fw->map        = map;
+    fw->map_offset = offset;
+    fw->map_size   = size;
+    fw->stats.nb_maps++;
+
+    return 0;
+}
+
+/* grow the file to size with blocks allocated right away, in as few
+ * extents as the file system can, rather than one by one as the pages
+ * are written back */
+static int reserve(struct frame_writer *fw, int64_t size) {
+    if (fallocate(fw->fd, 0, fw->alloc_size, size - fw->alloc_size) < 0) {
+        /* a sparse file still does for the mapping */
+        if (errno != EOPNOTSUPP || ftruncate(fw->fd, size) < 0)
+            return AVERROR(errno);
+    }
+    fw->stats.nb_reserves++;
+    fw->stats.bytes_reserved += size - fw->alloc_size;
+    fw->alloc_size            = size;
+
+    return 0;
+}
+
+static int add_plane(struct frame_writer *fw, int nb_iov,
+                     const uint8_t *data, int linesize, int plane) {
+    int y;
+    int bytes  = fw->plane_bytes[plane];
+    int height = fw->plane_height[plane];
+
+    if (linesize == bytes || height == 1) {
+        fw->stats.planes_whole++;
+        return add_iov(fw->iov, nb_iov, data, (size_t)bytes * height);
+    }
+
+    fw->stats.planes_rows++;
+    for (y = 0; y < height; y++)
+        nb_iov = add_iov(fw->iov, nb_iov, data + (ptrdiff_t)y * linesize,
+                         bytes);
+
+    return nb_iov;
+}
+
+static int add_iov(struct iovec *iov, int nb_iov,
+                   const uint8_t *base, size_t len) {
+    struct iovec *last = nb_iov ? &iov[nb_iov - 1] : NULL;
+
+    /* planes of one buffer may follow each other, one iovec then */
+    if (last && (uint8_t *)last->iov_base + last->iov_len == base) {
+        last->iov_len += len;
+        return nb_iov;
+    }
+    iov[nb_iov] = (struct iovec){(void *)base, len};
+
+    return nb_iov + 1;
+}
+
+static int writev_all(int fd, struct iovec *iov, int nb_iov,
+                      int64_t *nb_writes) {
+    while (nb_iov > 0) {
+        ssize_t n = writev(fd, iov, nb_iov);
+
+        (*nb_writes)++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+
+        /* short write, skip what went out and retry with the rest */
+        while (nb_iov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            nb_iov--;
+        }
+        if (nb_iov) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+static const char *y4m_colorspace(enum AVPixelFormat pix_fmt) {
+    switch (pix_fmt) {
+        case AV_PIX_FMT_GRAY8:    return "mono";
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P: return "420jpeg";
+        case AV_PIX_FMT_YUV411P:  return "411";
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUVJ422P: return "422";
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUVJ444P: return "444";
+        default:                  return NULL;
+    }
+}
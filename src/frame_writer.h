@@ -0,0 +1,88 @@
+/**
+ * @file frame_writer.h
+ * write decoded video frames as one PGM file per frame, or all of them
+ * into a single Y4M or raw video stream with one writev() per frame,
+ * straight from the frame planes
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+
+/* alignment of the staging buffer a frame is packed into in copy mode */
+#define FRAME_WRITER_ALIGN 4096
+
+/* size of the window of the file mapped at a time in mmap mode, a frame
+ * larger than that gets a window of its own size */
+#define FRAME_WRITER_MMAP_WINDOW (64 << 20)
+
+enum frame_writer_mode {
+    FRAME_WRITER_PGM, /* '<filename>-<n>', luma only, one file per frame */
+    FRAME_WRITER_Y4M, /* YUV4MPEG2 stream, 8-bit YUV and gray formats */
+    FRAME_WRITER_RAW, /* planes back to back, then the palette if any */
+};
+
+struct frame_writer_stats {
+    int64_t nb_frames;
+    int64_t bytes_written;
+    int64_t nb_writes;    /* writev() calls, files created for PGM */
+    int64_t write_us;     /* time spent packing and writing frames */
+    int64_t bytes_copied; /* packed into the staging buffer first */
+    int64_t nb_iovecs;    /* frame data iovecs handed to writev() */
+    int64_t planes_whole; /* planes written as one block (no padding) */
+    int64_t planes_rows;  /* planes written row by row (padded rows) */
+    int64_t nb_maps;      /* windows mapped in mmap mode */
+    int64_t nb_reserves;  /* fallocate() calls in mmap mode */
+    int64_t bytes_reserved;
+};
+
+struct frame_writer;
+
+/* for PGM filename is the prefix of the per-frame files, otherwise the
+ * stream file, which is created (or truncated) right away */
+int  frame_writer_open(struct frame_writer **fw, const char *filename,
+                       enum frame_writer_mode mode);
+
+/* frame rate put in the Y4M stream header, 25 fps if never set; no effect
+ * once the first frame has been written */
+void frame_writer_set_frame_rate(struct frame_writer *fw,
+                                 AVRational frame_rate);
+
+/* with copy set, every frame is packed into an aligned staging buffer
+ * and written as one block instead of straight from frame->data, the
+ * old behaviour kept for comparison; no effect once the first frame has
+ * been written */
+void frame_writer_set_copy(struct frame_writer *fw, int copy);
+
+/* copy stream frames into a memory mapped window moving through the
+ * file instead of writing them with writev(); the space of nb_frames
+ * frames (an estimate, 0 if unknown) is reserved with fallocate() up
+ * front, more as needed, and the file is truncated to what was written
+ * at close; writev() is kept if the output is not a regular file; no
+ * effect once the first frame has been written */
+void frame_writer_set_mmap(struct frame_writer *fw, int64_t nb_frames);
+
+/* geometry and pixel format are taken from the first frame and have to
+ * stay constant in Y4M and raw streams */
+int  frame_writer_write(struct frame_writer *fw, const AVFrame *frame);
+
+void frame_writer_close(struct frame_writer **fw);
+
+const struct frame_writer_stats *frame_writer_get_stats(
+        struct frame_writer *fw);
+
+void frame_writer_dump_stats(struct frame_writer *fw, FILE *fp);
+
+/* parse "pgm", "y4m" or "raw", returns a negative value otherwise */
+int  frame_writer_mode_from_name(const char *name);
+
+#endif /* FRAME_WRITER_H */
@@ -0,0 +1,329 @@
+/**
+ * @file gop_index.c
+ * picture index of an MPEG-1/2 video elementary stream, byte offset,
+ * output order and picture type of every coded picture, kept in a
+ * '<input>.idx' sidecar file
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/intreadwrite.h>
+
+#include "gop_index.h"
+
+/*
+
+sidecar layout, native endianness (it is a cache, not an exchange format)
+
+ struct idx_header | header_size bytes, padded to 8 | nb_entries entries
+
+*/
+
+#define GOP_INDEX_MAGIC   "GOPINDEX"
+#define GOP_INDEX_VERSION 2 /* 1 could hold offsets before the picture */
+#define PARSE_CHUNK_SIZE  (64 << 10)
+
+struct idx_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nb_entries;
+    int64_t  file_size;
+    int64_t  mtime_ns;
+    uint32_t header_size;
+    uint32_t reserved;
+};
+
+static int  file_key(const char *, int64_t *, int64_t *);
+
+static int  add_entry(struct gop_index *, int *, int64_t, int);
+
+static int  copy_sequence_header(struct gop_index *, const uint8_t *, int);
+
+static void sidecar_name(char *, size_t, const char *);
+
+int gop_index_build(struct gop_index **idx, const char *filename,
+                    enum AVCodecID codec_id) {
+    int ret, nb_alloc = 0;
+    int next_display = 0;
+    int anchor = -1; /* last I/P picture, output after the B pictures
+                      * that follow it in coded order */
+    FILE *fp = NULL;
+    int64_t pos = 0;
+    struct gop_index *gi = NULL;
+    AVCodecParserContext *parser_ctx = NULL;
+    AVCodecContext *codec_ctx = NULL;
+    uint8_t buf[PARSE_CHUNK_SIZE + AV_INPUT_BUFFER_PADDING_SIZE] = {0};
+
+    *idx = NULL;
+    if (!(gi = av_mallocz(sizeof(*gi))))
+        return AVERROR(ENOMEM);
+    if ((ret = file_key(filename, &gi->file_size, &gi->mtime_ns)) < 0)
+        goto fail;
+
+    parser_ctx = av_parser_init(codec_id);
+    codec_ctx  = avcodec_alloc_context3(NULL);
+    if (!parser_ctx || !codec_ctx) {
+        ret = parser_ctx ? AVERROR(ENOMEM) : AVERROR(ENOSYS);
+        goto fail;
+    }
+    if (!(fp = fopen(filename, "rb"))) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+
+    for (;;) {
+        size_t size = fread(buf, 1, PARSE_CHUNK_SIZE, fp);
+        const uint8_t *data = buf;
+        int64_t data_pos = pos;
+
+        pos += size;
+        /* a final empty call drains the picture held by the parser */
+        do {
+            uint8_t *pkt_data;
+            int pkt_size;
+            int len = av_parser_parse2(parser_ctx, codec_ctx,
+                                       &pkt_data, &pkt_size, data, size,
+                                       AV_NOPTS_VALUE, AV_NOPTS_VALUE,
+                                       data_pos);
+            if (len < 0) {
+                ret = len;
+                goto fail;
+            }
+            data     += len;
+            data_pos += len;
+            size     -= len;
+            if (!pkt_size)
+                continue;
+
+            if (!gi->nb_entries &&
+                (ret = copy_sequence_header(gi, pkt_data, pkt_size)) < 0)
+                goto fail;
+            /* pos is that of the parse call the picture started in, the
+             * picture lies offset bytes further (before it, when a
+             * start code straddles two calls) */
+            if ((ret = add_entry(gi, &nb_alloc,
+                                 parser_ctx->pos + parser_ctx->offset,
+                                 parser_ctx->pict_type)) < 0)
+                goto fail;
+
+            /* output order: a B picture right away, an I or P picture
+             * once the next I or P picture shows up */
+            if (parser_ctx->pict_type == AV_PICTURE_TYPE_B) {
+                gi->entries[gi->nb_entries - 1].display_n = next_display++;
+            } else {
+                if (anchor >= 0)
+                    gi->entries[anchor].display_n = next_display++;
+                anchor = gi->nb_entries - 1;
+            }
+        } while (size > 0);
+        if (data == buf)
+            break;
+    }
+    if (anchor >= 0)
+        gi->entries[anchor].display_n = next_display++;
+
+    if (ferror(fp)) {
+        ret = AVERROR(EIO);
+        goto fail;
+    }
+    fclose(fp);
+    av_parser_close(parser_ctx);
+    avcodec_free_context(&codec_ctx);
+
+    *idx = gi;
+    return 0;
+
+fail:
+    if (fp)
+        fclose(fp);
+    av_parser_close(parser_ctx);
+    avcodec_free_context(&codec_ctx);
+    gop_index_free(&gi);
+    return ret;
+}
+
+int gop_index_load(struct gop_index **idx, const char *filename) {
+    int ret;
+    FILE *fp;
+    char name[4096];
+    int64_t file_size, mtime_ns;
+    struct idx_header hdr;
+    struct gop_index *gi = NULL;
+
+    *idx = NULL;
+    sidecar_name(name, sizeof(name), filename);
+    if (!(fp = fopen(name, "rb")))
+        return AVERROR(errno);
+
+    if ((ret = file_key(filename, &file_size, &mtime_ns)) < 0)
+        goto fail;
+    ret = AVERROR_INVALIDDATA;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, GOP_INDEX_MAGIC, sizeof(hdr.magic)) ||
+        hdr.version != GOP_INDEX_VERSION ||
+        hdr.file_size != file_size || hdr.mtime_ns != mtime_ns ||
+        hdr.nb_entries > INT_MAX / sizeof(*gi->entries) ||
+        hdr.header_size > INT_MAX - 8)
+        goto fail;
+
+    if (!(gi = av_mallocz(sizeof(*gi))) ||
+        !(gi->entries = av_malloc_array(FFMAX(hdr.nb_entries, 1),
+                                        sizeof(*gi->entries))) ||
+        !(gi->header = av_mallocz(FFALIGN(hdr.header_size, 8) +
+                                  AV_INPUT_BUFFER_PADDING_SIZE))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    gi->file_size   = file_size;
+    gi->mtime_ns    = mtime_ns;
+    gi->nb_entries  = hdr.nb_entries;
+    gi->header_size = hdr.header_size;
+
+    if ((hdr.header_size &&
+         fread(gi->header, FFALIGN(hdr.header_size, 8), 1, fp) != 1) ||
+        (hdr.nb_entries &&
+         fread(gi->entries, sizeof(*gi->entries),
+               hdr.nb_entries, fp) != hdr.nb_entries)) {
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+    fclose(fp);
+
+    *idx = gi;
+    return 0;
+
+fail:
+    fclose(fp);
+    gop_index_free(&gi);
+    return ret;
+}
+
+int gop_index_save(const struct gop_index *idx, const char *filename) {
+    FILE *fp;
+    char name[4096];
+    struct idx_header hdr = {{0}};
+
+    memcpy(hdr.magic, GOP_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version     = GOP_INDEX_VERSION;
+    hdr.nb_entries  = idx->nb_entries;
+    hdr.file_size   = idx->file_size;
+    hdr.mtime_ns    = idx->mtime_ns;
+    hdr.header_size = idx->header_size;
+
+    sidecar_name(name, sizeof(name), filename);
+    if (!(fp = fopen(name, "wb"))) {
+        fprintf(stderr, "Could not create index file '%s'\n", name);
+        return AVERROR(errno);
+    }
+
+    /* the header buffer is allocated padded to 8 bytes and zeroed */
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    if (idx->header_size)
+        fwrite(idx->header, FFALIGN(idx->header_size, 8), 1, fp);
+    fwrite(idx->entries, sizeof(*idx->entries), idx->nb_entries, fp);
+
+    if (ferror(fp) | fclose(fp)) {
+        fprintf(stderr, "Could not write index file '%s'\n", name);
+        remove(name);
+        return AVERROR(EIO);
+    }
+
+    return 0;
+}
+
+void gop_index_free(struct gop_index **idx) {
+    if (!*idx)
+        return;
+
+    av_free((*idx)->entries);
+    av_free((*idx)->header);
+    av_freep(idx);
+}
+
+int gop_index_seek_point(const struct gop_index *idx, int display_n) {
+    int i, coded_n = -1;
+
+    for (i = 0; i < idx->nb_entries; i++)
+        if (idx->entries[i].display_n == display_n)
+            coded_n = i;
+    if (coded_n < 0)
+        return -1;
+
+    /* the last intra picture in coded order that is not output after the
+     * target: everything the target references follows it */
+    for (i = coded_n; i >= 0; i--)
+        if (idx->entries[i].pict_type == AV_PICTURE_TYPE_I &&
+            idx->entries[i].display_n <= display_n)
+            return i;
+
+    return 0;
+}
+
+static int file_key(const char *filename, int64_t *size, int64_t *mtime_ns) {
+    struct stat st;
+
+    if (stat(filename, &st) < 0)
+        return AVERROR(errno);
+    *size     = st.st_size;
+    *mtime_ns = st.st_mtim.tv_sec * INT64_C(1000000000) + st.st_mtim.tv_nsec;
+
+    return 0;
+}
+
+static int add_entry(struct gop_index *gi, int *nb_alloc,
+                     int64_t offset, int pict_type) {
+    struct gop_index_entry *entry;
+
+    if (gi->nb_entries == *nb_alloc) {
+        int n = FFMAX(1024, *nb_alloc * 2);
+        void *entries = av_realloc_array(gi->entries, n,
+                                         sizeof(*gi->entries));
+        if (!entries)
+            return AVERROR(ENOMEM);
+        gi->entries = entries;
+        *nb_alloc   = n;
+    }
+
+    entry = &gi->entries[gi->nb_entries++];
+    entry->offset    = offset;
+    entry->display_n = -1;
+    entry->pict_type = pict_type;
+
+    return 0;
+}
+
+static int copy_sequence_header(struct gop_index *gi,
+                                const uint8_t *data, int size) {
+    int i;
+
+    /* the sequence header (0xb3) and its extensions (0xb5) up to the
+     * first GOP (0xb8) or picture (0x00) start code */
+    if (size < 4 || AV_RB32(data) != 0x1b3)
+        return 0;
+    for (i = 4; i + 4 <= size; i++)
+        if (AV_RB24(data + i) == 1 && (data[i + 3] == 0xb8 || !data[i + 3]))
+            break;
+    if (i + 4 > size)
+        return 0;
+
+    if (!(gi->header = av_mallocz(FFALIGN(i, 8) +
+                                  AV_INPUT_BUFFER_PADDING_SIZE)))
+        return AVERROR(ENOMEM);
+    memcpy(gi->header, data, i);
+    gi->header_size = i;
+
+    return 0;
+}
+
+static void sidecar_name(char *name, size_t size, const char *filename) {
+    snprintf(name, size, "%s.idx", filename);
+}
@@ -0,0 +1,51 @@
+/**
+ * @file gop_index.h
+ * picture index of an MPEG-1/2 video elementary stream, byte offset,
+ * output order and picture type of every coded picture, kept in a
+ * '<input>.idx' sidecar file
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef GOP_INDEX_H
+#define GOP_INDEX_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+struct gop_index_entry {
+    int64_t offset;    /* of the parsed packet, headers in front included */
+    int32_t display_n; /* output order number, 0 based */
+    int32_t pict_type; /* enum AVPictureType */
+};
+
+struct gop_index {
+    int64_t  file_size;   /* of the indexed input, to detect changes */
+    int64_t  mtime_ns;
+    int      nb_entries;  /* in coded (bitstream) order */
+    struct gop_index_entry *entries;
+    int      header_size; /* sequence header (and extension) of the */
+    uint8_t *header;      /* stream, fed to the decoder before a jump */
+};
+
+/* parse the whole stream (no decoding) with the parser of codec_id */
+int  gop_index_build(struct gop_index **idx, const char *filename,
+                     enum AVCodecID codec_id);
+
+/* read '<filename>.idx', AVERROR(ENOENT) if there is none and
+ * AVERROR_INVALIDDATA if it is damaged or filename changed since */
+int  gop_index_load(struct gop_index **idx, const char *filename);
+
+/* write '<filename>.idx' */
+int  gop_index_save(const struct gop_index *idx, const char *filename);
+
+void gop_index_free(struct gop_index **idx);
+
+/* coded position of the intra picture decoding has to start from to get
+ * the picture with output order number display_n, -1 if out of range */
+int  gop_index_seek_point(const struct gop_index *idx, int display_n);
+
+#endif /* GOP_INDEX_H */
@@ -0,0 +1,364 @@
+/**
+ * @file interleave.c
+ * planar to packed (interleaved) audio samples, u8 / s16 / s32 / flt / dbl,
+ * with SSE2 / NEON kernels picked at runtime and a scalar fallback, and
+ * one write per frame
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/samplefmt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+#include "interleave.h"
+#include "trace.h"
+
+/*
+
+SIMD kernels, 2, 4 and 8 channels: one 16-byte vector is loaded from each
+plane, then log2(channels) rounds zip vector j with vector j + channels / 2
+(unpack low / high at the sample size), which leaves the vectors in output
+order; the tail is left to the scalar code. Other channel counts go
+through the scalar code as well, and so do 8 channels of 4 or 8-byte
+samples: they spill out of the 16 vector registers and lose to it.
+
+*/
+
+struct interleaver {
+    const struct interleave_kernels *kernels;
+    uint8_t *buf;
+    int      buf_size;
+    struct interleaver_stats stats;
+};
+
+#define DEFINE_INTERLEAVE_C(name, type)                                     \
+static void name(uint8_t *dst, const uint8_t *const *src,                   \
+                 int nb_channels, int nb_samples) {                         \
+    int ch, i;                                                              \
+    type *d = (type *)dst;                                                  \
+                                                                            \
+    if (nb_channels == 1) {                                                 \
+        memcpy(dst, src[0], nb_samples * sizeof(type));                     \
+        return;                                                             \
+    }                                                                       \
+    for (ch = 0; ch < nb_channels; ch++) {                                  \
+        const type *s = (const type *)src[ch];                              \
+                                                                            \
+        for (i = 0; i < nb_samples; i++)                                    \
+            d[i * nb_channels + ch] = s[i];                                 \
+    }                                                                       \
+}
+
+DEFINE_INTERLEAVE_C(interleave_8_c,  uint8_t)
+DEFINE_INTERLEAVE_C(interleave_16_c, uint16_t)
+DEFINE_INTERLEAVE_C(interleave_32_c, uint32_t)
+DEFINE_INTERLEAVE_C(interleave_64_c, uint64_t)
+
+static const interleave_fn scalar_fn[4] = {
+    interleave_8_c, interleave_16_c, interleave_32_c, interleave_64_c,
+};
+
+#if HAVE_X86_KERNELS
+
+__attribute__((always_inline, target("sse2")))
+static inline void zip_sse2(__m128i a, __m128i b, int size,
+                            __m128i *lo, __m128i *hi) {
+    switch (size) {
+        case 1:
+            *lo = _mm_unpacklo_epi8(a, b);
+            *hi = _mm_unpackhi_epi8(a, b);
+            break;
+        case 2:
+            *lo = _mm_unpacklo_epi16(a, b);
+            *hi = _mm_unpackhi_epi16(a, b);
+            break;
+        case 4:
+            *lo = _mm_unpacklo_epi32(a, b);
+            *hi = _mm_unpackhi_epi32(a, b);
+            break;
+        default:
+            *lo = _mm_unpacklo_epi64(a, b);
+            *hi = _mm_unpackhi_epi64(a, b);
+            break;
+    }
+}
+
+__attribute__((always_inline, target("sse2")))
+static inline void interleave_sse2(uint8_t *dst, const uint8_t *const *src,
+                                   int nb_channels, int nb_samples,
+                                   int size) {
+    int j, r, x;
+    int n = 16 / size; /* samples per vector */
+    int half = nb_channels / 2;
+    __m128i v[INTERLEAVE_MAX_CHANNELS], w[INTERLEAVE_MAX_CHANNELS];
+    const uint8_t *planes[INTERLEAVE_MAX_CHANNELS];
+
+    /* a local copy, stores through dst could alias src[] otherwise */
+    for (j = 0; j < nb_channels; j++)
+        planes[j] = src[j];
+
+    for (x = 0; x + n <= nb_samples; x += n) {
+        for (j = 0; j < nb_channels; j++)
+            v[j] = _mm_loadu_si128((const __m128i *)(planes[j] + x * size));
+        for (r = 1; r < nb_channels; r <<= 1) {
+            for (j = 0; j < half; j++)
+                zip_sse2(v[j], v[j + half], size, &w[2 * j], &w[2 * j + 1]);
+            for (j = 0; j < nb_channels; j++)
+                v[j] = w[j];
+        }
+        for (j = 0; j < nb_channels; j++)
+            _mm_storeu_si128((__m128i *)(dst + (x * nb_channels + j * n) *
+                                         size), v[j]);
+    }
+
+    for (j = 0; j < nb_channels; j++)
+        planes[j] += x * size;
+    scalar_fn[av_log2(size)](dst + x * nb_channels * size, planes,
+                             nb_channels, nb_samples - x);
+}
+
+/* constant sample size and channel count, the loops above unroll */
+#define DEFINE_INTERLEAVE_SSE2(size, channels)                              \
+__attribute__((target("sse2")))                                             \
+static void interleave_##size##_##channels##_sse2(                          \
+        uint8_t *dst, const uint8_t *const *src,                            \
+        int nb_channels, int nb_samples) {                                  \
+    interleave_sse2(dst, src, channels, nb_samples, size);                  \
+}
+
+DEFINE_INTERLEAVE_SSE2(1, 2) DEFINE_INTERLEAVE_SSE2(1, 4)
+DEFINE_INTERLEAVE_SSE2(1, 8) DEFINE_INTERLEAVE_SSE2(2, 2)
+DEFINE_INTERLEAVE_SSE2(2, 4) DEFINE_INTERLEAVE_SSE2(2, 8)
+DEFINE_INTERLEAVE_SSE2(4, 2) DEFINE_INTERLEAVE_SSE2(4, 4)
+DEFINE_INTERLEAVE_SSE2(8, 2) DEFINE_INTERLEAVE_SSE2(8, 4)
+
+#endif /* HAVE_X86_KERNELS */
+
+#if HAVE_NEON_KERNELS
+
+static inline void zip_neon(uint8x16_t a, uint8x16_t b, int size,
+                            uint8x16_t *lo, uint8x16_t *hi) {
+    switch (size) {
+        case 1:
+            *lo = vzip1q_u8(a, b);
+            *hi = vzip2q_u8(a, b);
+            break;
+        case 2:
+            *lo = vreinterpretq_u8_u16(vzip1q_u16(vreinterpretq_u16_u8(a),
+                                                  vreinterpretq_u16_u8(b)));
+            *hi = vreinterpretq_u8_u16(vzip2q_u16(vreinterpretq_u16_u8(a),
+                                                  vreinterpretq_u16_u8(b)));
+            break;
+        case 4:
+            *lo = vreinterpretq_u8_u32(vzip1q_u32(vreinterpretq_u32_u8(a),
+                                                  vreinterpretq_u32_u8(b)));
+            *hi = vreinterpretq_u8_u32(vzip2q_u32(vreinterpretq_u32_u8(a),
+                                                  vreinterpretq_u32_u8(b)));
+            break;
+        default:
+            *lo = vreinterpretq_u8_u64(vzip1q_u64(vreinterpretq_u64_u8(a),
+                                                  vreinterpretq_u64_u8(b)));
+            *hi = vreinterpretq_u8_u64(vzip2q_u64(vreinterpretq_u64_u8(a),
+                                                  vreinterpretq_u64_u8(b)));
+            break;
+    }
+}
+
+static inline void interleave_neon(uint8_t *dst, const uint8_t *const *src,
+                                   int nb_channels, int nb_samples,
+                                   int size) {
+    int j, r, x;
+    int n = 16 / size;
+    int half = nb_channels / 2;
+    uint8x16_t v[INTERLEAVE_MAX_CHANNELS], w[INTERLEAVE_MAX_CHANNELS];
+    const uint8_t *planes[INTERLEAVE_MAX_CHANNELS];
+
+    /* a local copy, stores through dst could alias src[] otherwise */
+    for (j = 0; j < nb_channels; j++)
+        planes[j] = src[j];
+
+    for (x = 0; x + n <= nb_samples; x += n) {
+        for (j = 0; j < nb_channels; j++)
+            v[j] = vld1q_u8(planes[j] + x * size);
+        for (r = 1; r < nb_channels; r <<= 1) {
+            for (j = 0; j < half; j++)
+                zip_neon(v[j], v[j + half], size, &w[2 * j], &w[2 * j + 1]);
+            for (j = 0; j < nb_channels; j++)
+                v[j] = w[j];
+        }
+        for (j = 0; j < nb_channels; j++)
+            vst1q_u8(dst + (x * nb_channels + j * n) * size, v[j]);
+    }
+
+    for (j = 0; j < nb_channels; j++)
+        planes[j] += x * size;
+    scalar_fn[av_log2(size)](dst + x * nb_channels * size, planes,
+                             nb_channels, nb_samples - x);
+}
+
+#define DEFINE_INTERLEAVE_NEON(size, channels)                              \
+static void interleave_##size##_##channels##_neon(                          \
+        uint8_t *dst, const uint8_t *const *src,                            \
+        int nb_channels, int nb_samples) {                                  \
+    interleave_neon(dst, src, channels, nb_samples, size);                  \
+}
+
+DEFINE_INTERLEAVE_NEON(1, 2) DEFINE_INTERLEAVE_NEON(1, 4)
+DEFINE_INTERLEAVE_NEON(1, 8) DEFINE_INTERLEAVE_NEON(2, 2)
+DEFINE_INTERLEAVE_NEON(2, 4) DEFINE_INTERLEAVE_NEON(2, 8)
+DEFINE_INTERLEAVE_NEON(4, 2) DEFINE_INTERLEAVE_NEON(4, 4)
+DEFINE_INTERLEAVE_NEON(8, 2) DEFINE_INTERLEAVE_NEON(8, 4)
+
+#endif /* HAVE_NEON_KERNELS */
+
+#define C_ROW(fn) {fn, fn, fn, fn, fn, fn, fn, fn}
+#define SIMD_ROW(size, arch)                                                \
+    {NULL, interleave_##size##_2_##arch, NULL, interleave_##size##_4_##arch}
+#define SIMD_ROW_8CH(size, arch)                                            \
+    {NULL, interleave_##size##_2_##arch, NULL, interleave_##size##_4_##arch, \
+     NULL, NULL, NULL, interleave_##size##_8_##arch}
+
+static const struct interleave_kernels kernels[] = {
+    {"scalar", 0, {C_ROW(interleave_8_c),  C_ROW(interleave_16_c),
+                   C_ROW(interleave_32_c), C_ROW(interleave_64_c)}},
+#if HAVE_X86_KERNELS
+    {"sse2", AV_CPU_FLAG_SSE2, {SIMD_ROW_8CH(1, sse2), SIMD_ROW_8CH(2, sse2),
+                                SIMD_ROW(4, sse2),     SIMD_ROW(8, sse2)}},
+#endif
+#if HAVE_NEON_KERNELS
+    {"neon", AV_CPU_FLAG_NEON, {SIMD_ROW_8CH(1, neon), SIMD_ROW_8CH(2, neon),
+                                SIMD_ROW(4, neon),     SIMD_ROW(8, neon)}},
+#endif
+};
+
+int interleaver_init(struct interleaver **il) {
+    struct interleaver *i;
+
+    if (!(i = av_mallocz(sizeof(*i))))
+        return AVERROR(ENOMEM);
+    i->kernels = interleave_kernels_best(av_get_cpu_flags());
+
+    *il = i;
+    return 0;
+}
+
+void interleaver_free(struct interleaver **il) {
+    if (!*il)
+        return;
+
+    av_free((*il)->buf);
+    av_freep(il);
+}
+
+int interleaver_write(struct interleaver *il, const AVFrame *frame,
+                      FILE *fp) {
+    int size = av_get_bytes_per_sample(frame->format);
+    int bytes = size * frame->channels * frame->nb_samples;
+    const uint8_t *data = frame->extended_data[0];
+    int64_t t;
+
+    if (size <= 0 || frame->channels <= 0)
+        return AVERROR(EINVAL);
+
+    if (av_sample_fmt_is_planar(frame->format) && frame->channels > 1) {
+        TRACE_BEGIN(t_copy);
+
+        t = av_gettime_relative();
+        if (bytes > il->buf_size) {
+            av_freep(&il->buf);
+            il->buf_size = 0;
+            if (!(il->buf = av_malloc(bytes)))
+                return AVERROR(ENOMEM);
+            il->buf_size = bytes;
+        }
+        interleave_samples(il->kernels, il->buf,
+                           (const uint8_t *const *)frame->extended_data,
+                           size, frame->channels, frame->nb_samples);
+        data = il->buf;
+        il->stats.interleave_us += av_gettime_relative() - t;
+        TRACE_END(TRACE_COPY, t_copy);
+    }
+
+    TRACE_BEGIN(t_write);
+    t = av_gettime_relative();
+    if (fwrite(data, 1, bytes, fp) != bytes)
+        return AVERROR(EIO);
+    il->stats.write_us += av_gettime_relative() - t;
+    TRACE_END(TRACE_WRITE, t_write);
+
+    il->stats.nb_frames++;
+    il->stats.nb_samples    += (int64_t)frame->channels * frame->nb_samples;
+    il->stats.nb_writes++;
+    il->stats.bytes_written += bytes;
+
+    return 0;
+}
+
+const char *interleaver_kernel_name(struct interleaver *il) {
+    return il->kernels->name;
+}
+
+const struct interleaver_stats *interleaver_get_stats(
+        struct interleaver *il) {
+    return &il->stats;
+}
+
+void interleaver_dump_stats(struct interleaver *il, FILE *fp) {
+    const struct interleaver_stats *stats = &il->stats;
+
+    fprintf(fp,
+            "audio interleave (%s): %"PRId64" frames, %"PRId64" samples, "
+            "%.1f Msamples/s interleaving, %"PRId64" writes, %.1f MiB in "
+            "%.3f s\n",
+            il->kernels->name, stats->nb_frames, stats->nb_samples,
+            stats->nb_samples / (double)FFMAX(stats->interleave_us, 1),
+            stats->nb_writes, stats->bytes_written / (1024.0 * 1024.0),
+            stats->write_us / 1e6);
+}
+
+void interleave_samples(const struct interleave_kernels *k, uint8_t *dst,
+                        const uint8_t *const *src, int sample_size,
+                        int nb_channels, int nb_samples) {
+    int shift = av_log2(sample_size);
+    interleave_fn fn = NULL;
+
+    if (nb_channels <= INTERLEAVE_MAX_CHANNELS)
+        fn = k->fn[shift][nb_channels - 1];
+    if (!fn)
+        fn = scalar_fn[shift];
+    fn(dst, src, nb_channels, nb_samples);
+}
+
+const struct interleave_kernels *interleave_kernels_all(int *nb_kernels) {
+    *nb_kernels = FF_ARRAY_ELEMS(kernels);
+    return kernels;
+}
+
+const struct interleave_kernels *interleave_kernels_best(int cpu_flags) {
+    int i;
+
+    /* later entries are faster */
+    for (i = FF_ARRAY_ELEMS(kernels) - 1; i > 0; i--)
+        if ((cpu_flags & kernels[i].cpu_flag) == kernels[i].cpu_flag)
+            return &kernels[i];
+    return &kernels[0];
+}
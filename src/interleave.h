@@ -0,0 +1,79 @@
+/**
+ * @file interleave.h
+ * planar to packed (interleaved) audio samples, u8 / s16 / s32 / flt / dbl,
+ * with SSE2 / NEON kernels picked at runtime and a scalar fallback, and
+ * one write per frame
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+/* channel counts with kernels of their own, more go through the generic
+ * scalar code */
+#define INTERLEAVE_MAX_CHANNELS 8
+
+/* dst gets nb_samples groups of nb_channels samples, one from each plane
+ * of src in turn */
+typedef void (*interleave_fn)(uint8_t *dst, const uint8_t *const *src,
+                              int nb_channels, int nb_samples);
+
+/* all of them produce exactly the scalar results */
+struct interleave_kernels {
+    const char   *name;
+    int           cpu_flag; /* AV_CPU_FLAG_* needed, 0 for scalar */
+    /* [log2 of the sample size][channels - 1], NULL where the set has
+     * nothing better than the scalar code */
+    interleave_fn fn[4][INTERLEAVE_MAX_CHANNELS];
+};
+
+struct interleaver_stats {
+    int64_t nb_frames;
+    int64_t nb_samples;     /* over all channels */
+    int64_t interleave_us;  /* time spent converting */
+    int64_t nb_writes;
+    int64_t bytes_written;
+    int64_t write_us;
+};
+
+struct interleaver;
+
+/* the kernels are the best ones av_get_cpu_flags() allows */
+int  interleaver_init(struct interleaver **il);
+
+void interleaver_free(struct interleaver **il);
+
+/* write every channel of frame to fp as packed samples, with a single
+ * fwrite(); packed frames are written as they are */
+int  interleaver_write(struct interleaver *il, const AVFrame *frame,
+                       FILE *fp);
+
+const char *interleaver_kernel_name(struct interleaver *il);
+
+const struct interleaver_stats *interleaver_get_stats(
+        struct interleaver *il);
+
+void interleaver_dump_stats(struct interleaver *il, FILE *fp);
+
+/* interleave nb_channels planes of nb_samples samples of sample_size
+ * (1, 2, 4 or 8) bytes with the kernels of k */
+void interleave_samples(const struct interleave_kernels *k, uint8_t *dst,
+                        const uint8_t *const *src, int sample_size,
+                        int nb_channels, int nb_samples);
+
+/* every kernel set compiled in (whether the CPU can run it or not),
+ * scalar first */
+const struct interleave_kernels *interleave_kernels_all(int *nb_kernels);
+
+/* the fastest kernel set cpu_flags allow */
+const struct interleave_kernels *interleave_kernels_best(int cpu_flags);
+
+#endif /* INTERLEAVE_H */
@@ -0,0 +1,365 @@
+/**
+ * @file kernel_bench.c
+ * checks every SIMD kernel set (luma statistics, box downscaling, audio
+ * interleaving) the CPU can run against the scalar one, on the same random
+ * data, and measures their throughput
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/common.h>
+
+#include "downscale.h"
+#include "interleave.h"
+#include "luma_stats.h"
+
+#define BENCH_WIDTH   1920
+#define BENCH_HEIGHT  1080
+#define BENCH_RUNS    50
+
+/* audio, a frame of samples per channel and the frames per run */
+#define BENCH_SAMPLES 1024
+#define BENCH_FRAMES  2000
+
+/* widths off the vector sizes, so the tails are checked too */
+static const int check_widths[] = {1, 7, 15, 17, 31, 33, 63, 1919, 1921};
+
+static const int check_samples[] = {1, 3, 15, 17, 1023, 1031};
+
+static int  check_luma(const struct luma_kernels *,
+                       const struct luma_kernels *,
+                       const uint8_t *, const uint8_t *, int);
+
+static void bench_luma(const struct luma_kernels *,
+                       const uint8_t *, const uint8_t *, int);
+
+static int  check_downscale(const struct downscale_kernels *,
+                            const struct downscale_kernels *,
+                            const uint8_t *, int);
+
+static void bench_downscale(const struct downscale_kernels *,
+                            const uint8_t *, int);
+
+static int  check_interleave(const struct interleave_kernels *,
+                             const struct interleave_kernels *,
+                             const uint8_t *, int, int, int);
+
+static void bench_interleave(const struct interleave_kernels *,
+                             const uint8_t *, int, int, FILE *);
+
+int main(int argc, char **argv) {
+    int i, j, nb_kernels, ok, failed = 0;
+    int cpu_flags = av_get_cpu_flags();
+    int size = BENCH_WIDTH * BENCH_HEIGHT;
+    const struct luma_kernels *k = luma_kernels_all(&nb_kernels);
+    const struct downscale_kernels *dk;
+    const struct interleave_kernels *ik;
+    /* sample size, channels: s16 stereo, flt stereo, 5.1 and 7.1 */
+    static const int bench_layouts[][2] = {{2, 2}, {4, 2}, {4, 6}, {4, 8}};
+    FILE *null = NULL;
+    uint8_t *a = NULL, *b = NULL;
+
+    if (argc > 1) {
+        fprintf(stderr,
+                "Usage: %s\n"
+                "verify the luma, downscaling and audio interleaving kernels "
+                "against the scalar\n"
+                "ones and print their throughput on %dx%d planes and %d "
+                "sample frames\n",
+                argv[0], BENCH_WIDTH, BENCH_HEIGHT, BENCH_SAMPLES);
+        exit(0);
+    }
+
+    a = av_malloc(size);
+    b = av_malloc(size);
+    if (!a || !b) {
+        fprintf(stderr, "Cannot allocate planes\n");
+        failed = 1;
+        goto end;
+    }
+    /* fixed seed, a mismatch can be replayed */
+    srand(1);
+    for (i = 0; i < size; i++) {
+        a[i] = rand() & 0xff;
+        b[i] = rand() & 0xff;
+    }
+    /* plus the extremes, where overflowing lanes would show */
+    memset(a, 0xff, BENCH_WIDTH);
+    memset(b, 0x00, BENCH_WIDTH);
+
+    fprintf(stdout, "luma statistics, best kernels for this CPU: %s\n",
+            luma_kernels_best(cpu_flags)->name);
+
+    for (i = 0; i < nb_kernels; i++) {
+        if ((cpu_flags & k[i].cpu_flag) != k[i].cpu_flag) {
+            fprintf(stdout, "%-8s: not supported by this CPU, skipped\n",
+                    k[i].name);
+            continue;
+        }
+        ok = 1;
+        for (j = 0; j < FF_ARRAY_ELEMS(check_widths); j++)
+            if (check_luma(&k[0], &k[i], a, b, check_widths[j]) < 0)
+                ok = 0;
+        /* the whole plane as a single row too, for long accumulations */
+        if (check_luma(&k[0], &k[i], a, b, size) < 0)
+            ok = 0;
+        bench_luma(&k[i], a, b, ok);
+        failed |= !ok;
+    }
+
+    dk = downscale_kernels_all(&nb_kernels);
+    fprintf(stdout, "box downscaling, best kernels for this CPU: %s\n",
+            downscale_kernels_best(cpu_flags)->name);
+    for (i = 0; i < nb_kernels; i++) {
+        if ((cpu_flags & dk[i].cpu_flag) != dk[i].cpu_flag) {
+            fprintf(stdout, "%-8s: not supported by this CPU, skipped\n",
+                    dk[i].name);
+            continue;
+        }
+        /* output widths, 4 rows of 4 * width pixels fit in a plane */
+        ok = 1;
+        for (j = 0; j < FF_ARRAY_ELEMS(check_widths); j++)
+            if (check_downscale(&dk[0], &dk[i], a, check_widths[j]) < 0)
+                ok = 0;
+        bench_downscale(&dk[i], a, ok);
+        failed |= !ok;
+    }
+
+    ik = interleave_kernels_all(&nb_kernels);
+    fprintf(stdout, "audio interleaving, best kernels for this CPU: %s\n",
+            interleave_kernels_best(cpu_flags)->name);
+    for (i = 0; i < nb_kernels; i++) {
+        int sample_size, channels;
+
+        if ((cpu_flags & ik[i].cpu_flag) != ik[i].cpu_flag) {
+            fprintf(stdout, "%-8s: not supported by this CPU, skipped\n",
+                    ik[i].name);
+            continue;
+        }
+        ok = 1;
+        for (sample_size = 1; sample_size <= 8; sample_size <<= 1)
+            for (channels = 1; channels <= INTERLEAVE_MAX_CHANNELS;
+                 channels++)
+                for (j = 0; j < FF_ARRAY_ELEMS(check_samples); j++)
+                    if (check_interleave(&ik[0], &ik[i], a, sample_size,
+                                         channels, check_samples[j]) < 0)
+                        ok = 0;
+        fprintf(stdout, "%-8s: %s\n", ik[i].name, ok ? "ok" : "FAILED");
+        failed |= !ok;
+    }
+
+    /* what decode_audio did before: one fwrite() per sample and channel */
+    if (!(null = fopen("/dev/null", "wb"))) {
+        fprintf(stderr, "Cannot open /dev/null\n");
+        failed = 1;
+        goto end;
+    }
+    for (j = 0; j < FF_ARRAY_ELEMS(bench_layouts); j++)
+        bench_interleave(interleave_kernels_best(cpu_flags), a,
+                         bench_layouts[j][0], bench_layouts[j][1], null);
+
+end:
+    if (null) fclose(null);
+    av_free(a);
+    av_free(b);
+
+    return failed;
+}
+
+static int check_luma(const struct luma_kernels *ref,
+                      const struct luma_kernels *k,
+                      const uint8_t *a, const uint8_t *b, int width) {
+    uint64_t s0, sq0, s1, sq1;
+    static uint32_t h0[4][256], h1[4][256];
+
+    ref->sum_sq(a, width, &s0, &sq0);
+    k->sum_sq(a, width, &s1, &sq1);
+    if (s0 != s1 || sq0 != sq1) {
+        fprintf(stderr, "%s: sum_sq mismatch at width %d\n", k->name, width);
+        return -1;
+    }
+    if (ref->sad(a, b, width) != k->sad(a, b, width)) {
+        fprintf(stderr, "%s: sad mismatch at width %d\n", k->name, width);
+        return -1;
+    }
+    memset(h0, 0, sizeof(h0));
+    memset(h1, 0, sizeof(h1));
+    ref->hist(a, width, h0);
+    k->hist(a, width, h1);
+    if (memcmp(h0, h1, sizeof(h0))) {
+        fprintf(stderr, "%s: hist mismatch at width %d\n", k->name, width);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_luma(const struct luma_kernels *k,
+                       const uint8_t *a, const uint8_t *b, int ok) {
+    int r, y;
+    uint64_t s, sq, sink = 0;
+    static uint32_t hist[4][256];
+    int64_t t0, t1, t2, t3;
+    double mpix = (double)BENCH_WIDTH * BENCH_HEIGHT * BENCH_RUNS / 1e6;
+
+    t0 = av_gettime_relative();
+    for (r = 0; r < BENCH_RUNS; r++)
+        for (y = 0; y < BENCH_HEIGHT; y++) {
+            k->sum_sq(a + y * BENCH_WIDTH, BENCH_WIDTH, &s, &sq);
+            sink += s + sq;
+        }
+    t1 = av_gettime_relative();
+    for (r = 0; r < BENCH_RUNS; r++)
+        for (y = 0; y < BENCH_HEIGHT; y++)
+            sink += k->sad(a + y * BENCH_WIDTH, b + y * BENCH_WIDTH,
+                           BENCH_WIDTH);
+    t2 = av_gettime_relative();
+    for (r = 0; r < BENCH_RUNS; r++)
+        for (y = 0; y < BENCH_HEIGHT; y++)
+            k->hist(a + y * BENCH_WIDTH, BENCH_WIDTH, hist);
+    t3 = av_gettime_relative();
+
+    /* sink keeps the loops from being optimised out */
+    fprintf(stdout,
+            "%-8s: %s, sum_sq %.0f Mpix/s, sad %.0f Mpix/s, "
+            "hist %.0f Mpix/s, %.3f ms per %dx%d frame%s\n",
+            k->name, ok ? "ok" : "FAILED", mpix * 1e6 / FFMAX(t1 - t0, 1),
+            mpix * 1e6 / FFMAX(t2 - t1, 1), mpix * 1e6 / FFMAX(t3 - t2, 1),
+            (t3 - t0) / 1000.0 / BENCH_RUNS, BENCH_WIDTH, BENCH_HEIGHT,
+            sink + hist[0][0] ? "" : " ");
+}
+
+static int check_downscale(const struct downscale_kernels *ref,
+                           const struct downscale_kernels *k,
+                           const uint8_t *src, int width) {
+    static uint8_t d0[2 * BENCH_WIDTH], d1[2 * BENCH_WIDTH];
+    const uint8_t *rows[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        rows[i] = src + i * 4 * width;
+
+    ref->box2(d0, rows, width);
+    k->box2(d1, rows, width);
+    if (memcmp(d0, d1, width)) {
+        fprintf(stderr, "%s: box2 mismatch at width %d\n", k->name, width);
+        return -1;
+    }
+    ref->box4(d0, rows, width);
+    k->box4(d1, rows, width);
+    if (memcmp(d0, d1, width)) {
+        fprintf(stderr, "%s: box4 mismatch at width %d\n", k->name, width);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_downscale(const struct downscale_kernels *k,
+                            const uint8_t *src, int ok) {
+    int r, y;
+    static uint8_t dst[BENCH_WIDTH];
+    const uint8_t *rows[4];
+    int64_t t0, t1, t2;
+    double mpix = (double)BENCH_WIDTH * BENCH_HEIGHT * BENCH_RUNS / 1e6;
+
+    /* source pixels per second, a whole plane per run either way */
+    t0 = av_gettime_relative();
+    for (r = 0; r < BENCH_RUNS; r++)
+        for (y = 0; y < BENCH_HEIGHT; y += 2) {
+            rows[0] = src + y * BENCH_WIDTH;
+            rows[1] = rows[0] + BENCH_WIDTH;
+            k->box2(dst, rows, BENCH_WIDTH / 2);
+        }
+    t1 = av_gettime_relative();
+    for (r = 0; r < BENCH_RUNS; r++)
+        for (y = 0; y < BENCH_HEIGHT; y += 4) {
+            rows[0] = src + y * BENCH_WIDTH;
+            rows[1] = rows[0] + BENCH_WIDTH;
+            rows[2] = rows[1] + BENCH_WIDTH;
+            rows[3] = rows[2] + BENCH_WIDTH;
+            k->box4(dst, rows, BENCH_WIDTH / 4);
+        }
+    t2 = av_gettime_relative();
+
+    fprintf(stdout,
+            "%-8s: %s, box2 %.0f Mpix/s, box4 %.0f Mpix/s%s\n",
+            k->name, ok ? "ok" : "FAILED", mpix * 1e6 / FFMAX(t1 - t0, 1),
+            mpix * 1e6 / FFMAX(t2 - t1, 1), dst[0] ? "" : " ");
+}
+
+static int check_interleave(const struct interleave_kernels *ref,
+                            const struct interleave_kernels *k,
+                            const uint8_t *src, int sample_size,
+                            int channels, int nb_samples) {
+    static uint8_t d0[INTERLEAVE_MAX_CHANNELS * 8 * 1031];
+    static uint8_t d1[INTERLEAVE_MAX_CHANNELS * 8 * 1031];
+    const uint8_t *planes[INTERLEAVE_MAX_CHANNELS];
+    int ch, bytes = sample_size * channels * nb_samples;
+
+    /* odd offsets, planes are not aligned in general */
+    for (ch = 0; ch < channels; ch++)
+        planes[ch] = src + ch * 8 * 1031 + ch;
+
+    interleave_samples(ref, d0, planes, sample_size, channels, nb_samples);
+    interleave_samples(k, d1, planes, sample_size, channels, nb_samples);
+    if (memcmp(d0, d1, bytes)) {
+        fprintf(stderr, "%s: interleave mismatch, %d bytes x %d channels, "
+                "%d samples\n", k->name, sample_size, channels, nb_samples);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_interleave(const struct interleave_kernels *best,
+                             const uint8_t *src, int sample_size,
+                             int channels, FILE *null) {
+    int ch, f, i;
+    int bytes = sample_size * channels * BENCH_SAMPLES;
+    static uint8_t dst[INTERLEAVE_MAX_CHANNELS * 8 * BENCH_SAMPLES];
+    const uint8_t *planes[INTERLEAVE_MAX_CHANNELS];
+    const struct interleave_kernels *scalar = interleave_kernels_all(&i);
+    int64_t t0, t1, t2, t3;
+    double msamples = (double)channels * BENCH_SAMPLES * BENCH_FRAMES / 1e6;
+
+    for (ch = 0; ch < channels; ch++)
+        planes[ch] = src + ch * sample_size * BENCH_SAMPLES;
+
+    /* a tenth of the frames for the slow path, scaled up below */
+    t0 = av_gettime_relative();
+    for (f = 0; f < BENCH_FRAMES / 10; f++)
+        for (i = 0; i < BENCH_SAMPLES; i++)
+            for (ch = 0; ch < channels; ch++)
+                fwrite(planes[ch] + sample_size * i, 1, sample_size, null);
+    t1 = av_gettime_relative();
+    for (f = 0; f < BENCH_FRAMES; f++) {
+        interleave_samples(scalar, dst, planes, sample_size, channels,
+                           BENCH_SAMPLES);
+        fwrite(dst, 1, bytes, null);
+    }
+    t2 = av_gettime_relative();
+    for (f = 0; f < BENCH_FRAMES; f++) {
+        interleave_samples(best, dst, planes, sample_size, channels,
+                           BENCH_SAMPLES);
+        fwrite(dst, 1, bytes, null);
+    }
+    t3 = av_gettime_relative();
+
+    fprintf(stdout,
+            "%d-byte samples x %d channels: fwrite per sample %.1f, "
+            "scalar + one fwrite %.0f, %s + one fwrite %.0f Msamples/s\n",
+            sample_size, channels,
+            msamples / 10 * 1e6 / FFMAX(t1 - t0, 1),
+            msamples * 1e6 / FFMAX(t2 - t1, 1), best->name,
+            msamples * 1e6 / FFMAX(t3 - t2, 1));
+}
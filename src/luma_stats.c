@@ -0,0 +1,393 @@
+/**
+ * @file luma_stats.c
+ * per-frame luma histogram, mean / variance and scene change score, with
+ * SSE4.1 / AVX2 / NEON kernels picked at runtime and a scalar fallback
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+#include "luma_stats.h"
+
+/* pixels summed up in 32-bit lanes before widening them */
+#define SUM_SQ_BLOCK 16384
+
+struct luma_analyzer {
+    const struct luma_kernels *kernels;
+    double    threshold;
+    AVFrame  *prev;           /* reference to the previous frame */
+    uint32_t  sub_hist[4][256];
+    struct luma_analyzer_stats stats;
+};
+
+static void     sum_sq_c(const uint8_t *, int, uint64_t *, uint64_t *);
+
+static uint64_t sad_c(const uint8_t *, const uint8_t *, int);
+
+static void     hist_c(const uint8_t *, int, uint32_t [4][256]);
+
+#if HAVE_X86_KERNELS
+static void     sum_sq_sse4(const uint8_t *, int, uint64_t *, uint64_t *);
+
+static uint64_t sad_sse4(const uint8_t *, const uint8_t *, int);
+
+static void     sum_sq_avx2(const uint8_t *, int, uint64_t *, uint64_t *);
+
+static uint64_t sad_avx2(const uint8_t *, const uint8_t *, int);
+#endif
+
+#if HAVE_NEON_KERNELS
+static void     sum_sq_neon(const uint8_t *, int, uint64_t *, uint64_t *);
+
+static uint64_t sad_neon(const uint8_t *, const uint8_t *, int);
+#endif
+
+/* histograms are scatter updates, no SIMD flavour beats the scalar one
+ * with split counters, so every set shares it */
+static const struct luma_kernels kernels[] = {
+    {"scalar", 0,                 sum_sq_c,    sad_c,    hist_c},
+#if HAVE_X86_KERNELS
+    {"sse4.1", AV_CPU_FLAG_SSE4,  sum_sq_sse4, sad_sse4, hist_c},
+    {"avx2",   AV_CPU_FLAG_AVX2,  sum_sq_avx2, sad_avx2, hist_c},
+#endif
+#if HAVE_NEON_KERNELS
+    {"neon",   AV_CPU_FLAG_NEON,  sum_sq_neon, sad_neon, hist_c},
+#endif
+};
+
+int luma_analyzer_init(struct luma_analyzer **la, double threshold) {
+    struct luma_analyzer *a;
+
+    if (!(a = av_mallocz(sizeof(*a))))
+        return AVERROR(ENOMEM);
+    if (!(a->prev = av_frame_alloc())) {
+        av_free(a);
+        return AVERROR(ENOMEM);
+    }
+    a->kernels   = luma_kernels_best(av_get_cpu_flags());
+    a->threshold = threshold > 0 ? threshold : LUMA_SCENE_THRESHOLD;
+
+    *la = a;
+    return 0;
+}
+
+void luma_analyzer_free(struct luma_analyzer **la) {
+    if (!*la)
+        return;
+
+    av_frame_free(&(*la)->prev);
+    av_freep(la);
+}
+
+int luma_analyzer_run(struct luma_analyzer *la, const AVFrame *frame,
+                      struct luma_stats *stats) {
+    int x, y, ret;
+    int w = frame->width, h = frame->height;
+    int compare;
+    uint64_t sum = 0, sum_sq = 0, sad = 0;
+    double n = (double)w * h;
+    int64_t t = av_gettime_relative();
+    const struct luma_kernels *k = la->kernels;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+
+    if (!desc || desc->comp[0].plane || desc->comp[0].depth != 8 ||
+        desc->comp[0].step != 1 || desc->flags & (AV_PIX_FMT_FLAG_RGB |
+                                                  AV_PIX_FMT_FLAG_PAL |
+                                                  AV_PIX_FMT_FLAG_HWACCEL))
+        return AVERROR(ENOSYS);
+
+    compare = la->prev->data[0] && la->prev->width == w &&
+              la->prev->height == h;
+
+    memset(la->sub_hist, 0, sizeof(la->sub_hist));
+    for (y = 0; y < h; y++) {
+        const uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        uint64_t s, sq;
+
+        k->sum_sq(row, w, &s, &sq);
+        sum    += s;
+        sum_sq += sq;
+        k->hist(row, w, la->sub_hist);
+        if (compare)
+            sad += k->sad(row, la->prev->data[0] + y * la->prev->linesize[0],
+                          w);
+    }
+
+    for (x = 0; x < 256; x++)
+        stats->hist[x] = la->sub_hist[0][x] + la->sub_hist[1][x] +
+                         la->sub_hist[2][x] + la->sub_hist[3][x];
+    stats->mean        = sum / n;
+    stats->variance    = sum_sq / n - stats->mean * stats->mean;
+    stats->scene_score = compare ? sad / n : 0.0;
+    stats->scene_cut   = compare && stats->scene_score > la->threshold;
+
+    /* keep the luma of this frame around for the next score, by
+     * reference: nothing is copied unless the frame is not refcounted */
+    av_frame_unref(la->prev);
+    if ((ret = av_frame_ref(la->prev, frame)) < 0)
+        return ret;
+
+    la->stats.nb_frames++;
+    la->stats.nb_scene_cuts += stats->scene_cut;
+    la->stats.analyze_us    += av_gettime_relative() - t;
+
+    return 0;
+}
+
+const char *luma_analyzer_kernel_name(struct luma_analyzer *la) {
+    return la->kernels->name;
+}
+
+const struct luma_analyzer_stats *luma_analyzer_get_stats(
+        struct luma_analyzer *la) {
+    return &la->stats;
+}
+
+void luma_analyzer_dump_stats(struct luma_analyzer *la, int64_t elapsed_us,
+                              FILE *fp) {
+    const struct luma_analyzer_stats *stats = &la->stats;
+
+    fprintf(fp,
+            "luma analysis (%s): %"PRId64" frames, %"PRId64" scene cuts, "
+            "%.3f ms/frame, %.1f%% of the decode time\n",
+            la->kernels->name, stats->nb_frames, stats->nb_scene_cuts,
+            stats->nb_frames ?
+            stats->analyze_us / 1000.0 / stats->nb_frames : 0.0,
+            100.0 * stats->analyze_us / FFMAX(elapsed_us, 1));
+}
+
+const struct luma_kernels *luma_kernels_all(int *nb_kernels) {
+    *nb_kernels = FF_ARRAY_ELEMS(kernels);
+    return kernels;
+}
+
+const struct luma_kernels *luma_kernels_best(int cpu_flags) {
+    int i;
+
+    /* later entries are faster */
+    for (i = FF_ARRAY_ELEMS(kernels) - 1; i > 0; i--)
+        if ((cpu_flags & kernels[i].cpu_flag) == kernels[i].cpu_flag)
+            return &kernels[i];
+    return &kernels[0];
+}
+
+static void sum_sq_c(const uint8_t *src, int width,
+                     uint64_t *sum, uint64_t *sum_sq) {
+    int x;
+    uint64_t s = 0, sq = 0;
+
+    for (x = 0; x < width; x++) {
+        s  += src[x];
+        sq += src[x] * src[x];
+    }
+    *sum    = s;
+    *sum_sq = sq;
+}
+
+static uint64_t sad_c(const uint8_t *a, const uint8_t *b, int width) {
+    int x;
+    uint64_t sad = 0;
+
+    for (x = 0; x < width; x++)
+        sad += FFABS(a[x] - b[x]);
+    return sad;
+}
+
+static void hist_c(const uint8_t *src, int width, uint32_t hist[4][256]) {
+    int x;
+
+    for (x = 0; x + 4 <= width; x += 4) {
+        hist[0][src[x    ]]++;
+        hist[1][src[x + 1]]++;
+        hist[2][src[x + 2]]++;
+        hist[3][src[x + 3]]++;
+    }
+    for (; x < width; x++)
+        hist[0][src[x]]++;
+}
+
+#if HAVE_X86_KERNELS
+
+/* the 32-bit lanes of squares take up to 4 * 255^2 per vector, they are
+ * widened to 64 bits every SUM_SQ_BLOCK pixels, long before overflowing */
+
+__attribute__((target("sse4.1")))
+static void sum_sq_sse4(const uint8_t *src, int width,
+                        uint64_t *sum, uint64_t *sum_sq) {
+    int x = 0, end;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s    = _mm_setzero_si128();
+    __m128i sq64 = _mm_setzero_si128();
+    uint64_t s_lanes[2], sq_lanes[2];
+    uint64_t tail_s, tail_sq;
+
+    while (x + 16 <= width) {
+        __m128i sq = _mm_setzero_si128();
+
+        end = FFMIN(width & ~15, x + SUM_SQ_BLOCK);
+        for (; x < end; x += 16) {
+            __m128i v  = _mm_loadu_si128((const __m128i *)(src + x));
+            __m128i lo = _mm_cvtepu8_epi16(v);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+            s  = _mm_add_epi64(s, _mm_sad_epu8(v, zero));
+            sq = _mm_add_epi32(sq, _mm_madd_epi16(lo, lo));
+            sq = _mm_add_epi32(sq, _mm_madd_epi16(hi, hi));
+        }
+        sq64 = _mm_add_epi64(sq64, _mm_cvtepu32_epi64(sq));
+        sq64 = _mm_add_epi64(sq64, _mm_cvtepu32_epi64(_mm_srli_si128(sq,
+                                                                     8)));
+    }
+    _mm_storeu_si128((__m128i *)s_lanes, s);
+    _mm_storeu_si128((__m128i *)sq_lanes, sq64);
+    sum_sq_c(src + x, width - x, &tail_s, &tail_sq);
+
+    *sum    = s_lanes[0] + s_lanes[1] + tail_s;
+    *sum_sq = sq_lanes[0] + sq_lanes[1] + tail_sq;
+}
+
+__attribute__((target("sse4.1")))
+static uint64_t sad_sse4(const uint8_t *a, const uint8_t *b, int width) {
+    int x;
+    __m128i sad = _mm_setzero_si128();
+    uint64_t lanes[2];
+
+    for (x = 0; x + 16 <= width; x += 16)
+        sad = _mm_add_epi64(sad,
+                            _mm_sad_epu8(_mm_loadu_si128((const __m128i *)
+                                                         (a + x)),
+                                         _mm_loadu_si128((const __m128i *)
+                                                         (b + x))));
+    _mm_storeu_si128((__m128i *)lanes, sad);
+
+    return lanes[0] + lanes[1] + sad_c(a + x, b + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void sum_sq_avx2(const uint8_t *src, int width,
+                        uint64_t *sum, uint64_t *sum_sq) {
+    int x = 0, end;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s    = _mm256_setzero_si256();
+    __m256i sq64 = _mm256_setzero_si256();
+    uint64_t s_lanes[4], sq_lanes[4];
+    uint64_t tail_s, tail_sq;
+
+    while (x + 32 <= width) {
+        __m256i sq = _mm256_setzero_si256();
+
+        end = FFMIN(width & ~31, x + SUM_SQ_BLOCK);
+        for (; x < end; x += 32) {
+            __m256i v  = _mm256_loadu_si256((const __m256i *)(src + x));
+            __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+            __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v,
+                                                                       1));
+
+            s  = _mm256_add_epi64(s, _mm256_sad_epu8(v, zero));
+            sq = _mm256_add_epi32(sq, _mm256_madd_epi16(lo, lo));
+            sq = _mm256_add_epi32(sq, _mm256_madd_epi16(hi, hi));
+        }
+        sq64 = _mm256_add_epi64(sq64, _mm256_cvtepu32_epi64(
+                                          _mm256_castsi256_si128(sq)));
+        sq64 = _mm256_add_epi64(sq64, _mm256_cvtepu32_epi64(
+                                          _mm256_extracti128_si256(sq, 1)));
+    }
+    _mm256_storeu_si256((__m256i *)s_lanes, s);
+    _mm256_storeu_si256((__m256i *)sq_lanes, sq64);
+    sum_sq_c(src + x, width - x, &tail_s, &tail_sq);
+
+    *sum    = s_lanes[0] + s_lanes[1] + s_lanes[2] + s_lanes[3] + tail_s;
+    *sum_sq = sq_lanes[0] + sq_lanes[1] + sq_lanes[2] + sq_lanes[3] +
+              tail_sq;
+}
+
+__attribute__((target("avx2")))
+static uint64_t sad_avx2(const uint8_t *a, const uint8_t *b, int width) {
+    int x;
+    __m256i sad = _mm256_setzero_si256();
+    uint64_t lanes[4];
+
+    for (x = 0; x + 32 <= width; x += 32)
+        sad = _mm256_add_epi64(sad,
+                               _mm256_sad_epu8(_mm256_loadu_si256(
+                                                   (const __m256i *)(a + x)),
+                                               _mm256_loadu_si256(
+                                                   (const __m256i *)(b + x))));
+    _mm256_storeu_si256((__m256i *)lanes, sad);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           sad_c(a + x, b + x, width - x);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+#if HAVE_NEON_KERNELS
+
+static void sum_sq_neon(const uint8_t *src, int width,
+                        uint64_t *sum, uint64_t *sum_sq) {
+    int x = 0, end;
+    uint64x2_t s64  = vdupq_n_u64(0);
+    uint64x2_t sq64 = vdupq_n_u64(0);
+    uint64_t tail_s, tail_sq;
+
+    while (x + 16 <= width) {
+        uint32x4_t s  = vdupq_n_u32(0);
+        uint32x4_t sq = vdupq_n_u32(0);
+
+        end = FFMIN(width & ~15, x + SUM_SQ_BLOCK);
+        for (; x < end; x += 16) {
+            uint8x16_t v = vld1q_u8(src + x);
+
+            s  = vpadalq_u16(s, vpaddlq_u8(v));
+            sq = vpadalq_u16(sq, vmull_u8(vget_low_u8(v), vget_low_u8(v)));
+            sq = vpadalq_u16(sq, vmull_u8(vget_high_u8(v),
+                                          vget_high_u8(v)));
+        }
+        s64  = vpadalq_u32(s64, s);
+        sq64 = vpadalq_u32(sq64, sq);
+    }
+    sum_sq_c(src + x, width - x, &tail_s, &tail_sq);
+
+    *sum    = vaddvq_u64(s64) + tail_s;
+    *sum_sq = vaddvq_u64(sq64) + tail_sq;
+}
+
+static uint64_t sad_neon(const uint8_t *a, const uint8_t *b, int width) {
+    int x = 0, end;
+    uint64x2_t sad64 = vdupq_n_u64(0);
+
+    while (x + 16 <= width) {
+        uint32x4_t sad = vdupq_n_u32(0);
+
+        end = FFMIN(width & ~15, x + SUM_SQ_BLOCK);
+        for (; x < end; x += 16)
+            sad = vpadalq_u16(sad, vpaddlq_u8(vabdq_u8(vld1q_u8(a + x),
+                                                       vld1q_u8(b + x))));
+        sad64 = vpadalq_u32(sad64, sad);
+    }
+
+    return vaddvq_u64(sad64) + sad_c(a + x, b + x, width - x);
+}
+
+#endif /* HAVE_NEON_KERNELS */
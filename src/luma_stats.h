@@ -0,0 +1,77 @@
+/**
+ * @file luma_stats.h
+ * per-frame luma histogram, mean / variance and scene change score, with
+ * SSE4.1 / AVX2 / NEON kernels picked at runtime and a scalar fallback
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef LUMA_STATS_H
+#define LUMA_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+/* mean absolute difference to the previous frame (0 - 255) above which a
+ * frame starts a new scene */
+#define LUMA_SCENE_THRESHOLD 30.0
+
+struct luma_stats {
+    uint32_t hist[256];
+    double   mean;
+    double   variance;
+    double   scene_score; /* mean absolute difference, 0 for the first */
+    int      scene_cut;
+};
+
+struct luma_analyzer_stats {
+    int64_t nb_frames;
+    int64_t nb_scene_cuts;
+    int64_t analyze_us;   /* time spent in luma_analyzer_run() */
+};
+
+/* row kernels, all of them produce exactly the scalar results */
+struct luma_kernels {
+    const char *name;
+    int         cpu_flag; /* AV_CPU_FLAG_* needed, 0 for scalar */
+    void     (*sum_sq)(const uint8_t *src, int width,
+                       uint64_t *sum, uint64_t *sum_sq);
+    uint64_t (*sad)(const uint8_t *a, const uint8_t *b, int width);
+    /* four interleaved sub-histograms, summed up once per frame, so
+     * runs of equal pixels do not serialise on one counter */
+    void     (*hist)(const uint8_t *src, int width, uint32_t hist[4][256]);
+};
+
+struct luma_analyzer;
+
+/* threshold <= 0 selects LUMA_SCENE_THRESHOLD, the kernels are the best
+ * ones av_get_cpu_flags() allows */
+int  luma_analyzer_init(struct luma_analyzer **la, double threshold);
+
+void luma_analyzer_free(struct luma_analyzer **la);
+
+/* analyse plane 0 of frame, which must hold 8-bit luma (YUV or gray) */
+int  luma_analyzer_run(struct luma_analyzer *la, const AVFrame *frame,
+                       struct luma_stats *stats);
+
+const char *luma_analyzer_kernel_name(struct luma_analyzer *la);
+
+const struct luma_analyzer_stats *luma_analyzer_get_stats(
+        struct luma_analyzer *la);
+
+/* elapsed_us is the whole decode time, for the share spent analysing */
+void luma_analyzer_dump_stats(struct luma_analyzer *la, int64_t elapsed_us,
+                              FILE *fp);
+
+/* every kernel set compiled in (whether the CPU can run it or not),
+ * scalar first */
+const struct luma_kernels *luma_kernels_all(int *nb_kernels);
+
+/* the fastest kernel set cpu_flags allow */
+const struct luma_kernels *luma_kernels_best(int cpu_flags);
+
+#endif /* LUMA_STATS_H */
@@ -0,0 +1,173 @@
+/**
+ * @file mmap_io.c
+ * seekable AVIOContext backed by a read-only memory mapping of the input
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include "mmap_io.h"
+
+struct mmap_io {
+    uint8_t *base; /* start of the mapping */
+    size_t   size; /* size of the mapping (the file size) */
+    size_t   pos;  /* offset of the next byte handed to libavformat */
+    struct mmap_io_stats stats;
+};
+
+static int     read_packet(void *, uint8_t *, int);
+
+static int64_t seek(void *, int64_t, int);
+
+int mmap_io_open(AVIOContext **pb, const char *filename, int window_size) {
+    int fd;
+    int ret = 0;
+    struct stat st;
+    struct mmap_io *io = NULL;
+    uint8_t *avio_ctx_buffer = NULL;
+
+    *pb = NULL;
+    if (window_size <= 0)
+        window_size = MMAP_IO_WINDOW_SIZE;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return AVERROR(errno);
+
+    if (fstat(fd, &st) < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+
+    if (!(io = av_mallocz(sizeof(*io)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    io->size = st.st_size;
+
+    /* mmap() refuses zero-length mappings, an empty file is simply EOF */
+    if (io->size) {
+        io->base = mmap(NULL, io->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (io->base == MAP_FAILED) {
+            io->base = NULL;
+            ret = AVERROR(errno);
+            goto fail;
+        }
+        /* demuxers mostly read forward, but they may jump to an index at
+         * the end of the file, so keep readahead on and let page faults
+         * do the rest */
+        madvise(io->base, io->size, MADV_WILLNEED);
+    }
+    close(fd);
+    fd = -1;
+
+    if (!(avio_ctx_buffer = av_malloc(window_size))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    *pb = avio_alloc_context(avio_ctx_buffer, window_size,
+                             0, io, &read_packet, NULL, &seek);
+    if (!*pb) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    av_free(avio_ctx_buffer);
+    if (io && io->base)
+        munmap(io->base, io->size);
+    av_free(io);
+    return ret;
+}
+
+void mmap_io_close(AVIOContext **pb) {
+    struct mmap_io *io;
+
+    if (!*pb)
+        return;
+    io = (*pb)->opaque;
+
+    /* note: the internal buffer could have changed,
+     * and be != avio_ctx_buffer */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+
+    if (io->base)
+        munmap(io->base, io->size);
+    av_free(io);
+}
+
+const struct mmap_io_stats *mmap_io_get_stats(AVIOContext *pb) {
+    return &((struct mmap_io *)pb->opaque)->stats;
+}
+
+void mmap_io_dump_stats(AVIOContext *pb, FILE *fp) {
+    const struct mmap_io_stats *stats = mmap_io_get_stats(pb);
+
+    fprintf(fp,
+            "mmap io: %"PRId64" bytes copied, %"PRId64" reads, "
+            "%"PRId64" seeks, window %d bytes\n",
+            stats->bytes_copied, stats->nb_reads,
+            stats->nb_seeks, pb->buffer_size);
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
+    struct mmap_io *io = (struct mmap_io *)opaque;
+
+    io->stats.nb_reads++;
+    if (io->pos >= io->size)
+        return AVERROR_EOF;
+    buf_size = FFMIN((size_t)buf_size, io->size - io->pos);
+
+    /* libavformat reads through the AVIOContext buffer (or straight into
+     * the destination for large reads), so one copy out of the mapping is
+     * the least the public API allows */
+    memcpy(buf, io->base + io->pos, buf_size);
+    io->pos += buf_size;
+    io->stats.bytes_copied += buf_size;
+
+    return buf_size;
+}
+
+static int64_t seek(void *opaque, int64_t offset, int whence) {
+    struct mmap_io *io = (struct mmap_io *)opaque;
+
+    io->stats.nb_seeks++;
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return io->size;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += io->pos;
+            break;
+        case SEEK_END:
+            offset += io->size;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    /* seeking past the end is allowed, the next read returns EOF */
+    if (offset < 0)
+        return AVERROR(EINVAL);
+    io->pos = FFMIN((size_t)offset, io->size);
+
+    return io->pos;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file mmap_io.h
+ * seekable AVIOContext backed by a read-only memory mapping of the input
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef MMAP_IO_H
+#define MMAP_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavformat/avio.h>
+
+#define MMAP_IO_WINDOW_SIZE (1 << 20)
+
+struct mmap_io_stats {
+    int64_t bytes_copied; /* bytes handed to libavformat by read_packet */
+    int64_t nb_reads;     /* calls of the read callback */
+    int64_t nb_seeks;     /* calls of the seek callback (AVSEEK_SIZE too) */
+};
+
+/* map the whole file and allocate an AVIOContext reading from it, the
+ * AVIOContext buffer (the window handed to the demuxer per read callback)
+ * is window_size bytes, 0 selects MMAP_IO_WINDOW_SIZE */
+int  mmap_io_open(AVIOContext **pb, const char *filename, int window_size);
+
+/* free the AVIOContext and unmap the file, *pb is set to NULL */
+void mmap_io_close(AVIOContext **pb);
+
+const struct mmap_io_stats *mmap_io_get_stats(AVIOContext *pb);
+
+void mmap_io_dump_stats(AVIOContext *pb, FILE *fp);
+
+#endif /* MMAP_IO_H */
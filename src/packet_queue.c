@@ -0,0 +1,286 @@
+/**
+ * @file packet_queue.c
+ * bounded single-producer / single-consumer queue of AVPackets between a
+ * demux loop and a decoder thread, lock-free unless one side has to wait
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include "packet_queue.h"
+
+/*
+
+head and tail count packets popped / pushed since the start, the slot of
+packet n is n & (size - 1); only the consumer writes head and only the
+producer writes tail, published with release / read with acquire, so the
+packet moved into a slot is visible before the slot is.
+
+A side that finds the queue full / empty raises its waiting flag under
+the lock and sleeps on the condition; the other side checks the flag
+after publishing (a full fence on both sides orders the flag against the
+counter) and only then takes the lock to wake it.
+
+*/
+
+struct packet_queue {
+    AVPacket *pkts;
+    unsigned  size;
+    _Alignas(64) atomic_uint tail;  /* producer side */
+    _Alignas(64) atomic_uint head;  /* consumer side */
+    _Alignas(64) atomic_int  finished;
+    atomic_int      aborted;
+    atomic_int      producer_waiting;
+    atomic_int      consumer_waiting;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  wakeup;
+
+    int     (*consume)(void *, AVPacket *);
+    void     *opaque;
+    pthread_t thread;
+    int       consumer_running;
+    int       consumer_ret;
+
+    /* push side counters are written by the producer only, pop side ones
+     * by the consumer only */
+    struct packet_queue_stats stats;
+};
+
+static int   must_wait(struct packet_queue *, int);
+
+static void  sleep_while(struct packet_queue *, int);
+
+static void  wake(struct packet_queue *, atomic_int *);
+
+static void *consumer(void *);
+
+int packet_queue_init(struct packet_queue **q, int size) {
+    struct packet_queue *pq;
+    unsigned n = 1;
+
+    if (size <= 0)
+        size = PACKET_QUEUE_SIZE;
+    while (n < size)
+        n <<= 1;
+
+    if (!(pq = av_mallocz(sizeof(*pq))))
+        return AVERROR(ENOMEM);
+    if (!(pq->pkts = av_mallocz_array(n, sizeof(*pq->pkts)))) {
+        av_free(pq);
+        return AVERROR(ENOMEM);
+    }
+    pq->size = n;
+    atomic_init(&pq->tail, 0);
+    atomic_init(&pq->head, 0);
+    atomic_init(&pq->finished, 0);
+    atomic_init(&pq->aborted, 0);
+    atomic_init(&pq->producer_waiting, 0);
+    atomic_init(&pq->consumer_waiting, 0);
+
+    pthread_mutex_init(&pq->lock, NULL);
+    pthread_cond_init(&pq->wakeup, NULL);
+
+    *q = pq;
+    return 0;
+}
+
+void packet_queue_free(struct packet_queue **q) {
+    unsigned i;
+    struct packet_queue *pq = *q;
+
+    if (!pq)
+        return;
+
+    packet_queue_abort(pq);
+    packet_queue_join_consumer(pq);
+
+    for (i = 0; i < pq->size; i++)
+        av_packet_unref(&pq->pkts[i]);
+    av_free(pq->pkts);
+
+    pthread_cond_destroy(&pq->wakeup);
+    pthread_mutex_destroy(&pq->lock);
+    av_freep(q);
+}
+
+int packet_queue_push(struct packet_queue *q, AVPacket *pkt) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    int depth;
+
+    if (must_wait(q, 1)) {
+        int64_t t = av_gettime_relative();
+
+        sleep_while(q, 1);
+        q->stats.push_waits++;
+        q->stats.push_blocked_us += av_gettime_relative() - t;
+    }
+    if (atomic_load(&q->aborted))
+        return AVERROR_EXIT;
+
+    q->stats.nb_packets++;
+    q->stats.bytes += pkt->size;
+    av_packet_move_ref(&q->pkts[tail & (q->size - 1)], pkt);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    depth = tail + 1 - atomic_load_explicit(&q->head, memory_order_relaxed);
+    q->stats.depth_max = FFMAX(q->stats.depth_max, depth);
+
+    wake(q, &q->consumer_waiting);
+
+    return 0;
+}
+
+int packet_queue_pop(struct packet_queue *q, AVPacket *pkt) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (must_wait(q, 0)) {
+        int64_t t = av_gettime_relative();
+
+        sleep_while(q, 0);
+        q->stats.pop_waits++;
+        q->stats.pop_blocked_us += av_gettime_relative() - t;
+    }
+    if (atomic_load(&q->aborted))
+        return AVERROR_EXIT;
+    /* finished is set after the last push, anything pushed before it is
+     * visible by now */
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+        return AVERROR_EOF;
+
+    av_packet_move_ref(pkt, &q->pkts[head & (q->size - 1)]);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    wake(q, &q->producer_waiting);
+
+    return 0;
+}
+
+void packet_queue_finish(struct packet_queue *q) {
+    atomic_store(&q->finished, 1);
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void packet_queue_abort(struct packet_queue *q) {
+    atomic_store(&q->aborted, 1);
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+}
+
+int packet_queue_start_consumer(struct packet_queue *q,
+                                int (*consume)(void *opaque, AVPacket *pkt),
+                                void *opaque) {
+    int ret;
+
+    q->consume      = consume;
+    q->opaque       = opaque;
+    q->consumer_ret = 0;
+    if ((ret = pthread_create(&q->thread, NULL, consumer, q)))
+        return AVERROR(ret);
+    q->consumer_running = 1;
+
+    return 0;
+}
+
+int packet_queue_join_consumer(struct packet_queue *q) {
+    if (q->consumer_running) {
+        pthread_join(q->thread, NULL);
+        q->consumer_running = 0;
+    }
+
+    return q->consumer_ret;
+}
+
+const struct packet_queue_stats *packet_queue_get_stats(
+        struct packet_queue *q) {
+    return &q->stats;
+}
+
+void packet_queue_dump_stats(struct packet_queue *q, const char *name,
+                             FILE *fp) {
+    const struct packet_queue_stats *stats = &q->stats;
+
+    fprintf(fp,
+            "packet queue (%s): %"PRId64" packets, %.1f MiB, depth max %d "
+            "of %u, demux waited %"PRId64" times %.3f s, decode waited "
+            "%"PRId64" times %.3f s\n",
+            name, stats->nb_packets, stats->bytes / (1024.0 * 1024.0),
+            stats->depth_max, q->size,
+            stats->push_waits, stats->push_blocked_us / 1e6,
+            stats->pop_waits, stats->pop_blocked_us / 1e6);
+}
+
+/* full for the producer, empty and not finished for the consumer */
+static int must_wait(struct packet_queue *q, int producer) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (atomic_load(&q->aborted))
+        return 0;
+    if (producer)
+        return tail - head == q->size;
+    return head == tail && !atomic_load(&q->finished);
+}
+
+static void sleep_while(struct packet_queue *q, int producer) {
+    atomic_int *waiting = producer ? &q->producer_waiting :
+                                     &q->consumer_waiting;
+
+    pthread_mutex_lock(&q->lock);
+    atomic_store(waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (must_wait(q, producer))
+        pthread_cond_wait(&q->wakeup, &q->lock);
+    atomic_store(waiting, 0);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void wake(struct packet_queue *q, atomic_int *waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(waiting, memory_order_relaxed))
+        return;
+
+    /* the sleeper holds the lock until it waits, no lost wakeup */
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_signal(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *consumer(void *arg) {
+    int ret;
+    struct packet_queue *q = arg;
+    AVPacket pkt;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    while ((ret = packet_queue_pop(q, &pkt)) >= 0) {
+        ret = q->consume(q->opaque, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            break;
+    }
+    /* end of stream, let the consumer flush */
+    if (ret == AVERROR_EOF)
+        ret = q->consume(q->opaque, NULL);
+    if (ret < 0 && ret != AVERROR_EXIT) {
+        q->consumer_ret = ret;
+        packet_queue_abort(q);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file packet_queue.h
+ * bounded single-producer / single-consumer queue of AVPackets between a
+ * demux loop and a decoder thread, lock-free unless one side has to wait
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+#define PACKET_QUEUE_SIZE 256
+
+struct packet_queue_stats {
+    int64_t nb_packets;      /* packets pushed */
+    int64_t bytes;           /* payload of the packets pushed */
+    int     depth_max;
+    int64_t push_waits;      /* times the producer found the queue full */
+    int64_t push_blocked_us;
+    int64_t pop_waits;       /* times the consumer found it empty */
+    int64_t pop_blocked_us;
+};
+
+struct packet_queue;
+
+/* size is rounded up to a power of two, 0 selects PACKET_QUEUE_SIZE */
+int  packet_queue_init(struct packet_queue **q, int size);
+
+/* abort the queue, join the consumer and free everything still queued */
+void packet_queue_free(struct packet_queue **q);
+
+/* move the references of pkt into the queue (pkt is left blank), blocking
+ * while the queue is full; AVERROR_EXIT once aborted; producer only */
+int  packet_queue_push(struct packet_queue *q, AVPacket *pkt);
+
+/* move the oldest packet into pkt, blocking while the queue is empty;
+ * AVERROR_EOF once finished and drained, AVERROR_EXIT once aborted;
+ * consumer only */
+int  packet_queue_pop(struct packet_queue *q, AVPacket *pkt);
+
+/* no more pushes, the consumer drains what is left and sees EOF */
+void packet_queue_finish(struct packet_queue *q);
+
+/* wake both sides up and make push / pop fail from now on */
+void packet_queue_abort(struct packet_queue *q);
+
+/* pop packets on a new thread and hand them to consume() until EOF, then
+ * call consume() once more with NULL (e.g. to flush a decoder); an error
+ * of consume() aborts the queue */
+int  packet_queue_start_consumer(struct packet_queue *q,
+                                 int (*consume)(void *opaque, AVPacket *pkt),
+                                 void *opaque);
+
+/* wait for the consumer, returns the first consume() error or 0 */
+int  packet_queue_join_consumer(struct packet_queue *q);
+
+const struct packet_queue_stats *packet_queue_get_stats(
+        struct packet_queue *q);
+
+void packet_queue_dump_stats(struct packet_queue *q, const char *name,
+                             FILE *fp);
+
+#endif /* PACKET_QUEUE_H */
@@ -0,0 +1,120 @@
+/**
+ * @file pipe_io.c
+ * non-seekable AVIOContext reading stdin or a FIFO in bounded chunks,
+ * memory use does not depend on the input size
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+
+#include "pipe_io.h"
+
+struct pipe_io {
+    int fd;
+    struct pipe_io_stats stats;
+};
+
+static int read_packet(void *, uint8_t *, int);
+
+int pipe_io_open(AVIOContext **pb, const char *filename, int chunk_size) {
+    int ret = 0;
+    struct pipe_io *io = NULL;
+    uint8_t *avio_ctx_buffer = NULL;
+
+    *pb = NULL;
+    if (chunk_size <= 0)
+        chunk_size = PIPE_IO_CHUNK_SIZE;
+
+    if (!(io = av_mallocz(sizeof(*io))))
+        return AVERROR(ENOMEM);
+
+    if (!strcmp(filename, "-")) {
+        io->fd = STDIN_FILENO;
+    } else if ((io->fd = open(filename, O_RDONLY)) < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+
+    if (!(avio_ctx_buffer = av_malloc(chunk_size))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    /* no seek callback: the AVIOContext is flagged as not seekable and
+     * demuxers fall back to reading front to back */
+    *pb = avio_alloc_context(avio_ctx_buffer, chunk_size,
+                             0, io, &read_packet, NULL, NULL);
+    if (!*pb) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    av_free(avio_ctx_buffer);
+    if (io->fd > STDIN_FILENO)
+        close(io->fd);
+    av_free(io);
+    return ret;
+}
+
+void pipe_io_close(AVIOContext **pb) {
+    struct pipe_io *io;
+
+    if (!*pb)
+        return;
+    io = (*pb)->opaque;
+
+    /* note: the internal buffer could have changed,
+     * and be != avio_ctx_buffer */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+
+    if (io->fd > STDIN_FILENO)
+        close(io->fd);
+    av_free(io);
+}
+
+const struct pipe_io_stats *pipe_io_get_stats(AVIOContext *pb) {
+    return &((struct pipe_io *)pb->opaque)->stats;
+}
+
+void pipe_io_dump_stats(AVIOContext *pb, FILE *fp) {
+    const struct pipe_io_stats *stats = pipe_io_get_stats(pb);
+
+    fprintf(fp,
+            "pipe io: %"PRId64" bytes read, %"PRId64" reads, "
+            "buffer %d bytes\n",
+            stats->bytes_read, stats->nb_reads, pb->buffer_size);
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
+    struct pipe_io *io = (struct pipe_io *)opaque;
+    ssize_t n;
+
+    io->stats.nb_reads++;
+
+    /* read() straight into the AVIOContext buffer, a short read is fine,
+     * the demuxer asks again */
+    do {
+        n = read(io->fd, buf, buf_size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        return AVERROR(errno);
+    if (!n)
+        return AVERROR_EOF;
+    io->stats.bytes_read += n;
+
+    return n;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file pipe_io.h
+ * non-seekable AVIOContext reading stdin or a FIFO in bounded chunks,
+ * memory use does not depend on the input size
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef PIPE_IO_H
+#define PIPE_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavformat/avio.h>
+
+#define PIPE_IO_CHUNK_SIZE (64 << 10)
+
+/*
+
+Without seeking the demuxer only ever sees the stream front to back, so
+the container must describe its streams before the media data:
+
+  probes fine:     MPEG-TS, MPEG-PS, FLV, Matroska / WebM, Ogg, NUT,
+                   ADTS AAC, MP3, AC-3, raw elementary streams (H.264,
+                   HEVC, MPEG-1/2 video), Y4M, WAV
+  probes partly:   AVI (no idx1 index, duration is estimated), MP4 / MOV
+                   with the moov atom in front ('faststart'; the samples
+                   of the tracks have to be interleaved, the demuxer
+                   cannot seek from one track's chunks to another's)
+  fails:           MP4 / MOV with the moov atom at the end, which is what
+                   most encoders write by default
+
+*/
+
+struct pipe_io_stats {
+    int64_t bytes_read; /* bytes read from the input */
+    int64_t nb_reads;   /* calls of the read callback */
+};
+
+/* read filename ("-" is stdin) through an AVIOContext holding a single
+ * chunk_size buffer, 0 selects PIPE_IO_CHUNK_SIZE */
+int  pipe_io_open(AVIOContext **pb, const char *filename, int chunk_size);
+
+/* free the AVIOContext and close the input (stdin is left open), *pb is
+ * set to NULL */
+void pipe_io_close(AVIOContext **pb);
+
+const struct pipe_io_stats *pipe_io_get_stats(AVIOContext *pb);
+
+void pipe_io_dump_stats(AVIOContext *pb, FILE *fp);
+
+#endif /* PIPE_IO_H */
@@ -0,0 +1,599 @@
+/**
+ * @file probe_cache.c
+ * persistent on-disk cache of stream parameters, so that inputs probed
+ * before can skip avformat_find_stream_info()
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include "probe_cache.h"
+
+/*
+
+cache file layout (native endianness, every structure 8-byte aligned, so
+the whole file can be mapped and walked in place)
+ ____________________________________________________________
+| cache_header                                               |
+|____________________________________________________________|
+| cache_record | path | cache_stream x nb_streams | extradata |
+|____________________________________________________________|
+| cache_record | ...                                         |
+|____________________________________________________________|
+
+Records are only appended, a newer record of the same path clears the
+'valid' flag of the older ones, and so does invalidation. Once the invalid
+records outweigh the valid ones (and COMPACT_MIN_SIZE), the next store
+moves the valid ones down over them and truncates the file.
+
+*/
+
+#define PROBE_CACHE_MAGIC   "PRBCACHE"
+#define PROBE_CACHE_VERSION 1
+#define HASH_SPAN           (64 << 10)
+#define COMPACT_MIN_SIZE    (1 << 20)
+
+struct cache_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nb_records; /* including invalidated ones */
+    uint64_t end;        /* offset of the first unused byte */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct cache_record {
+    uint32_t size;       /* whole record, a multiple of 8 */
+    uint32_t valid;
+    uint64_t file_size;
+    int64_t  mtime_ns;
+    uint64_t content_hash;
+    int64_t  start_time;
+    int64_t  duration;
+    int64_t  bit_rate;
+    uint32_t path_len;   /* including the terminating zero */
+    uint32_t nb_streams;
+};
+
+struct cache_stream {
+    int64_t  bit_rate;
+    int64_t  start_time;
+    int64_t  duration;
+    uint64_t channel_layout;
+    int32_t  codec_type, codec_id;
+    uint32_t codec_tag;
+    int32_t  format;
+    int32_t  width, height, sample_rate, channels;
+    int32_t  profile, level, block_align, frame_size;
+    int32_t  bits_per_coded_sample, bits_per_raw_sample;
+    int32_t  initial_padding, video_delay;
+    int32_t  sar_num, sar_den, tb_num, tb_den;
+    int32_t  avg_fr_num, avg_fr_den, r_fr_num, r_fr_den;
+    uint32_t extradata_offset; /* from the start of the record */
+    uint32_t extradata_size;
+};
+
+struct cache_key {
+    const char *path;
+    uint32_t    path_len;
+    uint64_t    file_size;
+    int64_t     mtime_ns;
+    uint64_t    content_hash;
+};
+
+struct probe_cache {
+    int fd;
+    int hash_content;
+    int warned;     /* about an unusable cache file */
+    int64_t hits;   /* this process only, the header keeps the totals */
+    int64_t misses;
+};
+
+#define ALIGN8(x) FFALIGN((x), 8)
+
+static int      make_key(struct probe_cache *, const char *,
+                         struct cache_key *);
+
+static uint64_t fnv1a(uint64_t, const uint8_t *, size_t);
+
+static int      map_cache(struct probe_cache *, uint8_t **, size_t *);
+
+static struct cache_record *next_record(uint8_t *, size_t, size_t *);
+
+static int      apply_record(const struct cache_record *,
+                             AVFormatContext *);
+
+static void     compact_cache(struct probe_cache *, uint8_t *, size_t);
+
+int probe_cache_open(struct probe_cache **pc, const char *filename,
+                     int hash_content) {
+    int ret = 0;
+    struct stat st;
+    struct cache_header header = {{0}};
+
+    if (!(*pc = av_mallocz(sizeof(**pc))))
+        return AVERROR(ENOMEM);
+    (*pc)->hash_content = hash_content;
+
+    if (((*pc)->fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open probe cache '%s'\n", filename);
+        goto fail;
+    }
+
+    flock((*pc)->fd, LOCK_EX);
+    if (fstat((*pc)->fd, &st) < 0) {
+        ret = AVERROR(errno);
+    } else if (!st.st_size) {
+        memcpy(header.magic, PROBE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = PROBE_CACHE_VERSION;
+        header.end     = sizeof(header);
+        if (pwrite((*pc)->fd, &header, sizeof(header), 0) != sizeof(header))
+            ret = AVERROR(EIO);
+    } else if (pread((*pc)->fd, &header, sizeof(header), 0) != sizeof(header)
+               || memcmp(header.magic, PROBE_CACHE_MAGIC, 8)
+               || header.version != PROBE_CACHE_VERSION) {
+        fprintf(stderr, "'%s' is not a probe cache\n", filename);
+        ret = AVERROR_INVALIDDATA;
+    }
+    flock((*pc)->fd, LOCK_UN);
+    if (ret < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    probe_cache_close(pc);
+    return ret;
+}
+
+void probe_cache_close(struct probe_cache **pc) {
+    if (!*pc)
+        return;
+    if ((*pc)->fd >= 0)
+        close((*pc)->fd);
+    av_freep(pc);
+}
+
+int probe_cache_lookup(struct probe_cache *pc, const char *path,
+                       AVFormatContext *fmt_ctx) {
+    int ret;
+    uint8_t *base;
+    size_t size, offset;
+    struct cache_key key;
+    struct cache_header *header;
+    struct cache_record *rec;
+
+    /* inputs that cannot be stat()ed (pipes, URLs) are never cached */
+    if (make_key(pc, path, &key) < 0) {
+        pc->misses++;
+        return 0;
+    }
+
+    flock(pc->fd, LOCK_EX);
+    if ((ret = map_cache(pc, &base, &size)) < 0)
+        goto end;
+    header = (struct cache_header *)base;
+
+    ret = 0;
+    offset = sizeof(*header);
+    while ((rec = next_record(base, size, &offset))) {
+        const char *rec_path = (const char *)(rec + 1);
+
+        if (!rec->valid || rec->path_len != key.path_len ||
+            memcmp(rec_path, key.path, key.path_len))
+            continue;
+
+        /* same path, but the file changed since it was probed */
+        if (rec->file_size != key.file_size || rec->mtime_ns != key.mtime_ns
+            || rec->content_hash != key.content_hash) {
+            rec->valid = 0;
+            continue;
+        }
+
+        /* streams created during stream info analysis (e.g. MPEG-TS
+         * without PMT) cannot be restored, treat as a miss */
+        if (apply_record(rec, fmt_ctx) == 0)
+            ret = 1;
+        break;
+    }
+
+    if (ret) {
+        header->hits++;
+        pc->hits++;
+    } else {
+        header->misses++;
+        pc->misses++;
+    }
+    munmap(base, size);
+
+end:
+    flock(pc->fd, LOCK_UN);
+    return ret;
+}
+
+int probe_cache_store(struct probe_cache *pc, const char *path,
+                      const AVFormatContext *fmt_ctx) {
+    int i, ret;
+    uint8_t *base, *buf = NULL;
+    size_t size, offset, rec_size, data_offset, dead = 0;
+    struct cache_key key;
+    struct cache_header *header;
+    struct cache_record *rec;
+    struct cache_stream *cs;
+
+    if (make_key(pc, path, &key) < 0)
+        return 0;
+
+    rec_size = sizeof(*rec) + ALIGN8(key.path_len) +
+               fmt_ctx->nb_streams * sizeof(*cs);
+    for (i = 0; i < fmt_ctx->nb_streams; i++)
+        rec_size += ALIGN8(fmt_ctx->streams[i]->codecpar->extradata_size);
+    if (rec_size > UINT32_MAX)
+        return AVERROR(EINVAL);
+
+    if (!(buf = av_mallocz(rec_size)))
+        return AVERROR(ENOMEM);
+
+    rec = (struct cache_record *)buf;
+    rec->size         = rec_size;
+    rec->valid        = 1;
+    rec->file_size    = key.file_size;
+    rec->mtime_ns     = key.mtime_ns;
+    rec->content_hash = key.content_hash;
+    rec->start_time   = fmt_ctx->start_time;
+    rec->duration     = fmt_ctx->duration;
+    rec->bit_rate     = fmt_ctx->bit_rate;
+    rec->path_len     = key.path_len;
+    rec->nb_streams   = fmt_ctx->nb_streams;
+    memcpy(rec + 1, key.path, key.path_len);
+
+    cs = (struct cache_stream *)(buf + sizeof(*rec) + ALIGN8(key.path_len));
+    data_offset = (uint8_t *)(cs + fmt_ctx->nb_streams) - buf;
+    for (i = 0; i < fmt_ctx->nb_streams; i++, cs++) {
+        const AVStream *st = fmt_ctx->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+
+        cs->bit_rate              = par->bit_rate;
+        cs->start_time            = st->start_time;
+        cs->duration              = st->duration;
+        cs->channel_layout        = par->channel_layout;
+        cs->codec_type            = par->codec_type;
+        cs->codec_id              = par->codec_id;
+        cs->codec_tag             = par->codec_tag;
+        cs->format                = par->format;
+        cs->width                 = par->width;
+        cs->height                = par->height;
+        cs->sample_rate           = par->sample_rate;
+        cs->channels              = par->channels;
+        cs->profile               = par->profile;
+        cs->level                 = par->level;
+        cs->block_align           = par->block_align;
+        cs->frame_size            = par->frame_size;
+        cs->bits_per_coded_sample = par->bits_per_coded_sample;
+        cs->bits_per_raw_sample   = par->bits_per_raw_sample;
+        cs->initial_padding       = par->initial_padding;
+        cs->video_delay           = par->video_delay;
+        cs->sar_num               = par->sample_aspect_ratio.num;
+        cs->sar_den               = par->sample_aspect_ratio.den;
+        cs->tb_num                = st->time_base.num;
+        cs->tb_den                = st->time_base.den;
+        cs->avg_fr_num            = st->avg_frame_rate.num;
+        cs->avg_fr_den            = st->avg_frame_rate.den;
+        cs->r_fr_num              = st->r_frame_rate.num;
+        cs->r_fr_den              = st->r_frame_rate.den;
+        cs->extradata_offset      = data_offset;
+        cs->extradata_size        = par->extradata_size;
+        if (par->extradata_size)
+            memcpy(buf + data_offset, par->extradata, par->extradata_size);
+        data_offset += ALIGN8(par->extradata_size);
+    }
+
+    flock(pc->fd, LOCK_EX);
+    if ((ret = map_cache(pc, &base, &size)) < 0)
+        goto end;
+    header = (struct cache_header *)base;
+
+    offset = sizeof(*header);
+    while ((rec = next_record(base, size, &offset)))
+        if (!rec->valid)
+            dead += rec->size;
+    if (dead > COMPACT_MIN_SIZE && dead > offset - sizeof(*header) - dead)
+        compact_cache(pc, base, offset);
+
+    /* append first, then publish the new end */
+    if (pwrite(pc->fd, buf, rec_size, header->end) != (ssize_t)rec_size) {
+        ret = AVERROR(EIO);
+    } else {
+        offset = sizeof(*header);
+        while ((rec = next_record(base, size, &offset)))
+            if (rec->valid && rec->path_len == key.path_len &&
+                !memcmp(rec + 1, key.path, key.path_len))
+                rec->valid = 0;
+        header->end += rec_size;
+        header->nb_records++;
+    }
+    munmap(base, size);
+
+end:
+    flock(pc->fd, LOCK_UN);
+    av_free(buf);
+    return ret;
+}
+
+int probe_cache_find_stream_info(struct probe_cache *pc, const char *path,
+                                 AVFormatContext *fmt_ctx) {
+    int ret, lookup;
+
+    if ((lookup = probe_cache_lookup(pc, path, fmt_ctx)) > 0)
+        return 0;
+    /* a short or corrupt cache file only costs the cached probe */
+    if (lookup < 0) {
+        pc->misses++;
+        if (!pc->warned++)
+            fprintf(stderr, "Probe cache unusable (%s), probing without "
+                    "it\n", av_err2str(lookup));
+    }
+
+    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+        return ret;
+
+    if (!lookup && probe_cache_store(pc, path, fmt_ctx) < 0)
+        fprintf(stderr, "Could not store '%s' in the probe cache\n", path);
+
+    return ret;
+}
+
+int probe_cache_invalidate(struct probe_cache *pc, const char *path) {
+    int ret, nb_dropped = 0;
+    uint8_t *base;
+    size_t size, offset;
+    size_t path_len = path ? strlen(path) + 1 : 0;
+    struct cache_record *rec;
+
+    flock(pc->fd, LOCK_EX);
+    if ((ret = map_cache(pc, &base, &size)) < 0)
+        goto end;
+
+    offset = sizeof(struct cache_header);
+    while ((rec = next_record(base, size, &offset))) {
+        if (!rec->valid)
+            continue;
+        if (path && (rec->path_len != path_len ||
+                     memcmp(rec + 1, path, path_len)))
+            continue;
+        rec->valid = 0;
+        nb_dropped++;
+    }
+    munmap(base, size);
+    ret = nb_dropped;
+
+end:
+    flock(pc->fd, LOCK_UN);
+    return ret;
+}
+
+void probe_cache_dump_stats(struct probe_cache *pc, FILE *fp) {
+    struct cache_header header = {{0}};
+
+    flock(pc->fd, LOCK_SH);
+    if (pread(pc->fd, &header, sizeof(header), 0) != sizeof(header))
+        memset(&header, 0, sizeof(header));
+    flock(pc->fd, LOCK_UN);
+
+    fprintf(fp,
+            "probe cache: %"PRId64" hits, %"PRId64" misses "
+            "(total %"PRIu64" hits, %"PRIu64" misses, "
+            "%u records, %"PRIu64" bytes)\n",
+            pc->hits, pc->misses, header.hits, header.misses,
+            header.nb_records, header.end);
+}
+
+static int make_key(struct probe_cache *pc, const char *path,
+                    struct cache_key *key) {
+    int fd;
+    struct stat st;
+    uint8_t buf[4096];
+    ssize_t n;
+    off_t offset;
+
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return AVERROR(EINVAL);
+
+    key->path         = path;
+    key->path_len     = strlen(path) + 1;
+    key->file_size    = st.st_size;
+    key->mtime_ns     = st.st_mtim.tv_sec * INT64_C(1000000000) +
+                        st.st_mtim.tv_nsec;
+    key->content_hash = 0;
+
+    if (!pc->hash_content)
+        return 0;
+
+    /* head and tail of the file catch rewrites that kept size and mtime */
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return AVERROR(errno);
+    key->content_hash = fnv1a(UINT64_C(0xcbf29ce484222325),
+                              (const uint8_t *)&key->file_size,
+                              sizeof(key->file_size));
+    for (offset = 0; offset < FFMIN(HASH_SPAN, st.st_size); offset += n) {
+        if ((n = pread(fd, buf, sizeof(buf), offset)) <= 0)
+            break;
+        key->content_hash = fnv1a(key->content_hash, buf, n);
+    }
+    for (offset = FFMAX(HASH_SPAN, st.st_size - HASH_SPAN);
+         offset < st.st_size; offset += n) {
+        if ((n = pread(fd, buf, sizeof(buf), offset)) <= 0)
+            break;
+        key->content_hash = fnv1a(key->content_hash, buf, n);
+    }
+    close(fd);
+
+    return 0;
+}
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size) {
+    while (size--) {
+        hash ^= *data++;
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+static int map_cache(struct probe_cache *pc, uint8_t **base, size_t *size) {
+    struct stat st;
+
+    if (fstat(pc->fd, &st) < 0)
+        return AVERROR(errno);
+    if (st.st_size < sizeof(struct cache_header))
+        return AVERROR_INVALIDDATA;
+
+    *size = st.st_size;
+    *base = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, pc->fd, 0);
+    if (*base == MAP_FAILED)
+        return AVERROR(errno);
+
+    return 0;
+}
+
+static struct cache_record *next_record(uint8_t *base, size_t size,
+                                        size_t *offset) {
+    struct cache_header *header = (struct cache_header *)base;
+    struct cache_record *rec;
+    size_t end = FFMIN(header->end, size);
+
+    if (*offset + sizeof(*rec) > end)
+        return NULL;
+    rec = (struct cache_record *)(base + *offset);
+
+    /* a torn or corrupt record ends the walk */
+    if (rec->size < sizeof(*rec) || rec->size % 8 ||
+        *offset + rec->size > end ||
+        sizeof(*rec) + ALIGN8(rec->path_len) +
+        (uint64_t)rec->nb_streams * sizeof(struct cache_stream) > rec->size)
+        return NULL;
+    *offset += rec->size;
+
+    return rec;
+}
+
+/* the valid records up to end (where the walk stopped) move down over the
+ * invalid ones; the header ends the walk meanwhile, so a process dying
+ * halfway leaves an empty cache rather than mixed up records */
+static void compact_cache(struct probe_cache *pc, uint8_t *base,
+                          size_t end) {
+    uint32_t nb_records = 0, rec_size;
+    size_t offset, new_end = sizeof(struct cache_header);
+    struct cache_header *header = (struct cache_header *)base;
+    struct cache_record *rec;
+
+    header->end = sizeof(*header);
+    for (offset = sizeof(*header); offset < end; offset += rec_size) {
+        rec      = (struct cache_record *)(base + offset);
+        rec_size = rec->size;
+        if (!rec->valid)
+            continue;
+        /* may overlap the record itself, never the next one */
+        memmove(base + new_end, rec, rec_size);
+        new_end += rec_size;
+        nb_records++;
+    }
+    header->end        = new_end;
+    header->nb_records = nb_records;
+    if (ftruncate(pc->fd, new_end) < 0)
+        fprintf(stderr, "Could not truncate the probe cache\n");
+}
+
+static int apply_record(const struct cache_record *rec,
+                        AVFormatContext *fmt_ctx) {
+    int i;
+    const uint8_t *base = (const uint8_t *)rec;
+    const struct cache_stream *cs = (const struct cache_stream *)
+        (base + sizeof(*rec) + ALIGN8(rec->path_len));
+
+    if (rec->nb_streams != fmt_ctx->nb_streams)
+        return AVERROR(EINVAL);
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        enum AVMediaType type = fmt_ctx->streams[i]->codecpar->codec_type;
+        if (type != AVMEDIA_TYPE_UNKNOWN && type != cs[i].codec_type)
+            return AVERROR(EINVAL);
+        if (cs[i].extradata_offset + (uint64_t)cs[i].extradata_size >
+            rec->size)
+            return AVERROR_INVALIDDATA;
+    }
+
+    for (i = 0; i < fmt_ctx->nb_streams; i++, cs++) {
+        AVStream *st = fmt_ctx->streams[i];
+        AVCodecParameters *par = st->codecpar;
+
+        par->codec_type            = cs->codec_type;
+        par->codec_id              = cs->codec_id;
+        par->codec_tag             = cs->codec_tag;
+        par->format                = cs->format;
+        par->bit_rate              = cs->bit_rate;
+        par->width                 = cs->width;
+        par->height                = cs->height;
+        par->sample_rate           = cs->sample_rate;
+        par->channels              = cs->channels;
+        par->channel_layout        = cs->channel_layout;
+        par->profile               = cs->profile;
+        par->level                 = cs->level;
+        par->block_align           = cs->block_align;
+        par->frame_size            = cs->frame_size;
+        par->bits_per_coded_sample = cs->bits_per_coded_sample;
+        par->bits_per_raw_sample   = cs->bits_per_raw_sample;
+        par->initial_padding       = cs->initial_padding;
+        par->video_delay           = cs->video_delay;
+        par->sample_aspect_ratio   = (AVRational){ cs->sar_num, cs->sar_den };
+
+        if (cs->extradata_size) {
+            av_freep(&par->extradata);
+            par->extradata = av_mallocz(cs->extradata_size +
+                                        AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!par->extradata) {
+                par->extradata_size = 0;
+                return AVERROR(ENOMEM);
+            }
+            memcpy(par->extradata, base + cs->extradata_offset,
+                   cs->extradata_size);
+            par->extradata_size = cs->extradata_size;
+        }
+
+        /* the demuxer already set the time base its timestamps use, the
+         * rest is only filled where the header left it unknown */
+        st->avg_frame_rate = (AVRational){ cs->avg_fr_num, cs->avg_fr_den };
+        st->r_frame_rate   = (AVRational){ cs->r_fr_num, cs->r_fr_den };
+        if (!cs->tb_num || !cs->tb_den)
+            continue;
+        if (st->start_time == AV_NOPTS_VALUE &&
+            cs->start_time != AV_NOPTS_VALUE)
+            st->start_time = av_rescale_q(cs->start_time,
+                                          (AVRational){ cs->tb_num,
+                                                        cs->tb_den },
+                                          st->time_base);
+        if (st->duration == AV_NOPTS_VALUE && cs->duration != AV_NOPTS_VALUE)
+            st->duration = av_rescale_q(cs->duration,
+                                        (AVRational){ cs->tb_num,
+                                                      cs->tb_den },
+                                        st->time_base);
+    }
+
+    fmt_ctx->start_time = rec->start_time;
+    fmt_ctx->duration   = rec->duration;
+    fmt_ctx->bit_rate   = rec->bit_rate;
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file probe_cache.h
+ * persistent on-disk cache of stream parameters, so that inputs probed
+ * before can skip avformat_find_stream_info()
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include <stdio.h>
+
+#include <libavformat/avformat.h>
+
+struct probe_cache;
+
+/* open (or create) the cache file, with hash_content set the key also
+ * covers a hash of the first and last 64 KiB of every input */
+int  probe_cache_open(struct probe_cache **pc, const char *filename,
+                      int hash_content);
+
+void probe_cache_close(struct probe_cache **pc);
+
+/* fill the streams of fmt_ctx (after avformat_open_input()) from the
+ * cache, returns 1 on a hit, 0 on a miss and a negative AVERROR on
+ * failure; the key is (path, size, mtime[, content hash]) */
+int  probe_cache_lookup(struct probe_cache *pc, const char *path,
+                        AVFormatContext *fmt_ctx);
+
+/* remember the stream parameters of fmt_ctx, which must have been
+ * analysed by avformat_find_stream_info() */
+int  probe_cache_store(struct probe_cache *pc, const char *path,
+                       const AVFormatContext *fmt_ctx);
+
+/* probe_cache_lookup() and on a miss avformat_find_stream_info() followed
+ * by probe_cache_store(), a drop-in for avformat_find_stream_info() */
+int  probe_cache_find_stream_info(struct probe_cache *pc, const char *path,
+                                  AVFormatContext *fmt_ctx);
+
+/* drop the entries of path, or every entry if path is NULL, returns the
+ * number of dropped entries */
+int  probe_cache_invalidate(struct probe_cache *pc, const char *path);
+
+void probe_cache_dump_stats(struct probe_cache *pc, FILE *fp);
+
+#endif /* PROBE_CACHE_H */
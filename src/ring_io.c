@@ -0,0 +1,379 @@
+/**
+ * @file ring_io.c
+ * AVIOContext fed by a background reader thread through a lock-free
+ * single-producer / single-consumer ring buffer
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include "ring_io.h"
+
+/*
+
+ reader thread                                   demuxer (read_packet)
+ _____________     ____________________________     _____________
+|             |   |      |///////////////|     |   |             |
+| read(fd)    |-->|      |///resident////|     |-->| memcpy(buf) |
+|_____________|   |______|///////////////|_____|   |_____________|
+                         ^tail           ^head
+
+ head and tail are free-running byte counters, only the reader stores
+ head and only read_packet stores tail, so the data path needs no lock.
+ The mutex and the condition variables are only used to sleep when the
+ ring is empty (demuxer side) or full (reader side).
+
+*/
+
+struct ring_io {
+    int      fd;
+    uint8_t *ring;
+    size_t   capacity; /* power of two */
+    int64_t  size;     /* file size, for AVSEEK_SIZE */
+    int64_t  pos;      /* file offset of the byte at tail */
+
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic int eof;   /* the reader stopped, error holds the reason */
+    _Atomic int stop;  /* ask the reader to exit (seek or close) */
+    int error;
+
+    _Atomic int consumer_waiting;
+    _Atomic int producer_waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    pthread_t thread;
+    int running;
+
+    /* counted by the reader thread, which may still run while the stats
+     * are read; copied into stats by ring_io_get_stats() */
+    _Atomic int64_t bytes_read;
+    _Atomic int64_t reader_full_us;
+
+    /* the rest is counted by the read callback, on the demuxer side */
+    struct ring_io_stats stats;
+};
+
+static void   *reader(void *);
+
+static int     start_reader(struct ring_io *, int64_t);
+
+static void    stop_reader(struct ring_io *);
+
+static void    wake(struct ring_io *, _Atomic int *, pthread_cond_t *);
+
+static int     read_packet(void *, uint8_t *, int);
+
+static int64_t seek(void *, int64_t, int);
+
+int ring_io_open(AVIOContext **pb, const char *filename, int readahead) {
+    int ret = 0;
+    struct stat st;
+    struct ring_io *io = NULL;
+    uint8_t *avio_ctx_buffer = NULL;
+
+    *pb = NULL;
+    if (readahead <= 0)
+        readahead = RING_IO_READAHEAD;
+
+    if (!(io = av_mallocz(sizeof(*io))))
+        return AVERROR(ENOMEM);
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->not_empty, NULL);
+    pthread_cond_init(&io->not_full, NULL);
+
+    if ((io->fd = open(filename, O_RDONLY)) < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+    if (fstat(io->fd, &st) < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+    io->size = S_ISREG(st.st_mode) ? st.st_size : -1;
+
+    io->capacity = 1;
+    while (io->capacity < (size_t)readahead)
+        io->capacity <<= 1;
+    if (!(io->ring = av_malloc(io->capacity))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    /* the demuxer side only ever copies out of the ring, a small AVIO
+     * buffer is enough */
+    if (!(avio_ctx_buffer = av_malloc(RING_IO_CHUNK_SIZE))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    if ((ret = start_reader(io, 0)) < 0)
+        goto fail;
+
+    *pb = avio_alloc_context(avio_ctx_buffer, RING_IO_CHUNK_SIZE, 0, io,
+                             &read_packet, NULL, io->size < 0 ? NULL : &seek);
+    if (!*pb) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    av_free(avio_ctx_buffer);
+    stop_reader(io);
+    if (io->fd >= 0)
+        close(io->fd);
+    av_free(io->ring);
+    pthread_cond_destroy(&io->not_full);
+    pthread_cond_destroy(&io->not_empty);
+    pthread_mutex_destroy(&io->lock);
+    av_free(io);
+    return ret;
+}
+
+void ring_io_close(AVIOContext **pb) {
+    struct ring_io *io;
+
+    if (!*pb)
+        return;
+    io = (*pb)->opaque;
+
+    /* note: the internal buffer could have changed,
+     * and be != avio_ctx_buffer */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+
+    stop_reader(io);
+    close(io->fd);
+    av_free(io->ring);
+    pthread_cond_destroy(&io->not_full);
+    pthread_cond_destroy(&io->not_empty);
+    pthread_mutex_destroy(&io->lock);
+    av_free(io);
+}
+
+const struct ring_io_stats *ring_io_get_stats(AVIOContext *pb) {
+    struct ring_io *io = pb->opaque;
+
+    io->stats.bytes_read     = atomic_load_explicit(&io->bytes_read,
+                                                    memory_order_relaxed);
+    io->stats.reader_full_us = atomic_load_explicit(&io->reader_full_us,
+                                                    memory_order_relaxed);
+    return &io->stats;
+}
+
+void ring_io_dump_stats(AVIOContext *pb, FILE *fp) {
+    struct ring_io *io = pb->opaque;
+    const struct ring_io_stats *stats = ring_io_get_stats(pb);
+
+    fprintf(fp,
+            "ring io: %"PRId64" bytes read, %"PRId64" reads, "
+            "%"PRId64" seeks, readahead %zu bytes\n"
+            "ring io: %"PRId64" stalls, %.3f ms stalled, "
+            "reader blocked on full ring %.3f ms\n"
+            "ring io: occupancy avg %.1f%% max %.1f%%\n",
+            stats->bytes_read, stats->nb_reads, stats->nb_seeks,
+            io->capacity, stats->nb_stalls, stats->stall_us / 1000.0,
+            stats->reader_full_us / 1000.0,
+            stats->nb_reads ? 100.0 * stats->occupancy_sum /
+                              stats->nb_reads / io->capacity : 0.0,
+            100.0 * stats->occupancy_max / io->capacity);
+}
+
+static void *reader(void *arg) {
+    struct ring_io *io = arg;
+    uint64_t head = atomic_load_explicit(&io->head, memory_order_relaxed);
+
+    while (!atomic_load(&io->stop)) {
+        uint64_t tail = atomic_load_explicit(&io->tail, memory_order_acquire);
+        size_t   off  = head & (io->capacity - 1);
+        size_t   len  = io->capacity - (head - tail);
+        ssize_t  n;
+
+        if (!len) {
+            int64_t t = av_gettime_relative();
+
+            pthread_mutex_lock(&io->lock);
+            atomic_store(&io->producer_waiting, 1);
+            while (atomic_load(&io->tail) == tail && !atomic_load(&io->stop))
+                pthread_cond_wait(&io->not_full, &io->lock);
+            atomic_store(&io->producer_waiting, 0);
+            pthread_mutex_unlock(&io->lock);
+            atomic_fetch_add_explicit(&io->reader_full_us,
+                                      av_gettime_relative() - t,
+                                      memory_order_relaxed);
+            continue;
+        }
+
+        /* never wrap inside one read(), the next iteration continues at
+         * the start of the ring */
+        len = FFMIN(len, io->capacity - off);
+        len = FFMIN(len, RING_IO_CHUNK_SIZE);
+
+        n = read(io->fd, io->ring + off, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            io->error = n < 0 ? AVERROR(errno) : AVERROR_EOF;
+            atomic_store(&io->eof, 1);
+            wake(io, &io->consumer_waiting, &io->not_empty);
+            break;
+        }
+        atomic_fetch_add_explicit(&io->bytes_read, n, memory_order_relaxed);
+
+        head += n;
+        atomic_store_explicit(&io->head, head, memory_order_release);
+        wake(io, &io->consumer_waiting, &io->not_empty);
+    }
+
+    return NULL;
+}
+
+static int start_reader(struct ring_io *io, int64_t offset) {
+    int ret;
+
+    if (lseek(io->fd, offset, SEEK_SET) < 0 && offset)
+        return AVERROR(errno);
+
+    io->pos = offset;
+    io->error = 0;
+    atomic_store(&io->head, 0);
+    atomic_store(&io->tail, 0);
+    atomic_store(&io->eof, 0);
+    atomic_store(&io->stop, 0);
+
+    if ((ret = pthread_create(&io->thread, NULL, reader, io)))
+        return AVERROR(ret);
+    io->running = 1;
+
+    return 0;
+}
+
+static void stop_reader(struct ring_io *io) {
+    if (!io->running)
+        return;
+
+    atomic_store(&io->stop, 1);
+    pthread_mutex_lock(&io->lock);
+    pthread_cond_signal(&io->not_full);
+    pthread_mutex_unlock(&io->lock);
+
+    pthread_join(io->thread, NULL);
+    io->running = 0;
+}
+
+static void wake(struct ring_io *io, _Atomic int *waiting,
+                 pthread_cond_t *cond) {
+    /* the waiter sets its flag under the lock before re-checking the
+     * counters, so either it sees our store or we see its flag */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load(waiting))
+        return;
+    pthread_mutex_lock(&io->lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&io->lock);
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
+    struct ring_io *io = (struct ring_io *)opaque;
+    uint64_t tail = atomic_load_explicit(&io->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&io->head, memory_order_acquire);
+    size_t   off, len;
+
+    io->stats.nb_reads++;
+    io->stats.occupancy_sum += head - tail;
+    io->stats.occupancy_max  = FFMAX(io->stats.occupancy_max,
+                                     (int64_t)(head - tail));
+
+    if (head == tail) {
+        int64_t t = av_gettime_relative();
+
+        io->stats.nb_stalls++;
+        pthread_mutex_lock(&io->lock);
+        atomic_store(&io->consumer_waiting, 1);
+        while ((head = atomic_load(&io->head)) == tail &&
+               !atomic_load(&io->eof))
+            pthread_cond_wait(&io->not_empty, &io->lock);
+        atomic_store(&io->consumer_waiting, 0);
+        pthread_mutex_unlock(&io->lock);
+        io->stats.stall_us += av_gettime_relative() - t;
+
+        /* the reader publishes its last bytes before raising eof */
+        head = atomic_load_explicit(&io->head, memory_order_acquire);
+        if (head == tail)
+            return io->error;
+    }
+
+    len = FFMIN((size_t)buf_size, head - tail);
+    off = tail & (io->capacity - 1);
+    if (off + len > io->capacity) {
+        size_t first = io->capacity - off;
+        memcpy(buf, io->ring + off, first);
+        memcpy(buf + first, io->ring, len - first);
+    } else {
+        memcpy(buf, io->ring + off, len);
+    }
+
+    io->pos += len;
+    atomic_store_explicit(&io->tail, tail + len, memory_order_release);
+    wake(io, &io->producer_waiting, &io->not_full);
+
+    return len;
+}
+
+static int64_t seek(void *opaque, int64_t offset, int whence) {
+    struct ring_io *io = (struct ring_io *)opaque;
+    uint64_t tail, head;
+    int ret;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return io->size;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += io->pos;
+            break;
+        case SEEK_END:
+            offset += io->size;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+
+    /* a short forward seek inside the resident bytes just drops them */
+    tail = atomic_load_explicit(&io->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&io->head, memory_order_acquire);
+    if (offset >= io->pos && offset - io->pos <= (int64_t)(head - tail)) {
+        atomic_store_explicit(&io->tail, tail + (offset - io->pos),
+                              memory_order_release);
+        io->pos = offset;
+        wake(io, &io->producer_waiting, &io->not_full);
+        return offset;
+    }
+
+    io->stats.nb_seeks++;
+    stop_reader(io);
+    if ((ret = start_reader(io, offset)) < 0)
+        return ret;
+
+    return offset;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file ring_io.h
+ * AVIOContext fed by a background reader thread through a lock-free
+ * single-producer / single-consumer ring buffer
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef RING_IO_H
+#define RING_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavformat/avio.h>
+
+#define RING_IO_READAHEAD  (8 << 20)
+#define RING_IO_CHUNK_SIZE (256 << 10)
+
+struct ring_io_stats {
+    int64_t bytes_read;     /* bytes read from the file by the reader */
+    int64_t nb_reads;       /* calls of the read callback */
+    int64_t nb_seeks;       /* seeks that restarted the reader */
+    int64_t nb_stalls;      /* read callbacks that found the ring empty */
+    int64_t stall_us;       /* time the read callback waited for data */
+    int64_t reader_full_us; /* time the reader waited for free space */
+    int64_t occupancy_sum;  /* ring occupancy sampled at each callback */
+    int64_t occupancy_max;
+};
+
+/* open the file and start the reader thread, readahead is the ring
+ * capacity in bytes (rounded up to a power of two), 0 selects
+ * RING_IO_READAHEAD */
+int  ring_io_open(AVIOContext **pb, const char *filename, int readahead);
+
+/* stop the reader thread, free the AVIOContext and close the file, *pb
+ * is set to NULL */
+void ring_io_close(AVIOContext **pb);
+
+/* from the demuxer thread; the reader side counters are taken at the
+ * time of the call, the reader may still be running */
+const struct ring_io_stats *ring_io_get_stats(AVIOContext *pb);
+
+void ring_io_dump_stats(AVIOContext *pb, FILE *fp);
+
+#endif /* RING_IO_H */
@@ -0,0 +1,166 @@
+/**
+ * @file shm_consumer.c
+ * reference consumer of the shared memory frame ring of demuxing_decoding
+ * (-shm): maps every frame in place, optionally reads it through, and
+ * reports the throughput and the latency from publishing to receiving
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+
+#include "shm_ring.h"
+
+/* how long to wait for the producer to show up, and for each frame */
+#define CONSUMER_TIMEOUT_MS 10000
+
+static uint64_t touch_frame(const struct shm_ring_frame *);
+
+static int      compare_int64(const void *, const void *);
+
+static int64_t  now_ns(void);
+
+int main(int argc, char **argv) {
+    int i, ret;
+    int touch = 0, hold_us = 0, timeout_ms = CONSUMER_TIMEOUT_MS;
+    int64_t t_first = 0, t_last = 0, total_ns = 0;
+    int64_t *latency = NULL;
+    int nb_latency = 0, nb_alloc = 0;
+    uint64_t checksum = 0;
+    double mb, sec;
+    struct shm_ring *ring = NULL;
+    struct shm_ring_frame frame = {0};
+    const struct shm_ring_stats *stats;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-touch"))
+            touch = 1;
+        else if (!strcmp(argv[i], "-hold") && i + 1 < argc)
+            hold_us = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-timeout") && i + 1 < argc)
+            timeout_ms = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (argc - i != 1) {
+        fprintf(stderr,
+                "Usage: %s [-touch] [-hold us] [-timeout ms] <name>\n\n"
+                "Attach to the shared memory frame ring 'name' that \n"
+                "'demuxing_decoding -shm name' publishes into and take \n"
+                "every frame in place, without copying it. With -touch \n"
+                "every byte of every frame is read (a checksum is \n"
+                "printed), with -hold each frame is held that many \n"
+                "microseconds, a slow consumer. Waits up to 'timeout' ms \n"
+                "(default: %d) for the producer and for each frame.\n",
+                argv[0], CONSUMER_TIMEOUT_MS);
+        return 1;
+    }
+
+    if ((ret = shm_ring_open(&ring, argv[i], timeout_ms)) < 0)
+        return ret != AVERROR_EOF;
+
+    while ((ret = shm_ring_next(ring, &frame, timeout_ms)) >= 0) {
+        int64_t t = now_ns();
+
+        if (!t_first) {
+            t_first = t;
+            fprintf(stderr, "consumer: %dx%d %s frames\n", frame.width,
+                    frame.height, av_get_pix_fmt_name(frame.format));
+        }
+        t_last = t;
+
+        /* the clock is the same in every process */
+        if (nb_latency == nb_alloc) {
+            int64_t *p;
+
+            nb_alloc = FFMAX(1024, nb_alloc * 2);
+            if (!(p = av_realloc_array(latency, nb_alloc, sizeof(*p)))) {
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            latency = p;
+        }
+        latency[nb_latency++] = t - frame.publish_ns;
+        total_ns             += t - frame.publish_ns;
+
+        if (touch)
+            checksum += touch_frame(&frame);
+        if (hold_us)
+            av_usleep(hold_us);
+
+        /* overwritten meanwhile in drop mode, counted as stale */
+        shm_ring_release(ring, &frame);
+    }
+    if (ret == AVERROR(EAGAIN))
+        fprintf(stderr, "No frame for %d ms, giving up\n", timeout_ms);
+    else if (ret == AVERROR(EPIPE))
+        fprintf(stderr, "The producer died without closing the ring\n");
+
+    stats = shm_ring_get_stats(ring);
+    mb    = stats->bytes / (1024.0 * 1024.0);
+    sec   = FFMAX(t_last - t_first, 1) / 1e9;
+    fprintf(stderr,
+            "consumer: %"PRId64" frames, %.1f MiB in %.3f s, %.1f MiB/s, "
+            "%.1f frames/s\n",
+            stats->nb_frames, mb, sec, mb / sec, stats->nb_frames / sec);
+    if (nb_latency) {
+        qsort(latency, nb_latency, sizeof(*latency), compare_int64);
+        fprintf(stderr,
+                "latency: mean %.1f us, p50 %.1f us, p90 %.1f us, p99 "
+                "%.1f us, max %.1f us\n",
+                total_ns / 1e3 / nb_latency,
+                latency[nb_latency / 2] / 1e3,
+                latency[(int)(nb_latency * 0.9)] / 1e3,
+                latency[(int)(nb_latency * 0.99)] / 1e3,
+                latency[nb_latency - 1] / 1e3);
+    }
+    if (touch)
+        fprintf(stderr, "checksum: %016"PRIx64"\n", checksum);
+    shm_ring_dump_stats(ring, stderr);
+
+    shm_ring_close(&ring);
+    av_free(latency);
+
+    return ret != AVERROR_EOF;
+}
+
+/* what an analysis pass costs at least: read every byte once */
+static uint64_t touch_frame(const struct shm_ring_frame *frame) {
+    int i;
+    uint64_t sum = 0;
+    const uint64_t *p = (const uint64_t *)frame->data[0];
+
+    /* the planes follow each other, data[0] is 64-byte aligned */
+    for (i = 0; i < frame->size / 8; i++)
+        sum += p[i];
+    for (i *= 8; i < frame->size; i++)
+        sum += frame->data[0][i];
+
+    return sum;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
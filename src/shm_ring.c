@@ -0,0 +1,648 @@
+/**
+ * @file shm_ring.c
+ * ring of decoded video frames in POSIX shared memory, published by one
+ * process and mapped in place by a consumer process, no copy and no disk
+ * in between
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/avstring.h>
+#include <libavutil/imgutils.h>
+
+#include "shm_ring.h"
+
+/*
+
+The shared memory object is a header page, then nb_slots slots of
+slot_size bytes each: a slot header, then the pixels of one frame, planes
+back to back without padding (av_image_copy_to_buffer()).
+
+write_seq counts the frames published, read_seq the frames the consumer
+released; frame n goes to slot n % nb_slots. Only the producer writes
+write_seq and the slots, only the consumer writes read_seq, published with
+release / read with acquire, so a frame is complete before it is seen and
+read before its slot is reused.
+
+Every slot has a seqlock, odd while the producer writes the slot. The
+consumer notes its value when it takes the frame and checks it when it
+releases the frame, which tells whether the frame was overwritten while
+it was in use. That happens in drop mode, and otherwise only around
+attaching: a producer that saw no consumer waits for none. The consumer
+starts past the slot of the frame being published, the seqlock catches
+the rare frame it still takes before the producer notices it.
+
+A side with nothing to do spins a little, then raises its waiting flag and
+sleeps on a futex word of the header; the other side checks the flag after
+publishing its counter (a full fence on both sides orders the flag against
+the counter), bumps the word and wakes it, as packet_queue does with a
+condition variable. The sleep is cut into slices: after each one the
+producer checks that the consumer it waits for still exists, the consumer
+that the producer does, so neither side hangs on one killed without
+closing the ring.
+
+*/
+
+#define HEADER_SIZE     4096
+#define SLOT_HEADER     64
+
+#define STATE_CREATED   1   /* header set, a consumer may attach */
+#define STATE_SIZED     2   /* slots sized by the first frame */
+
+/* a sleeping side checks this often that the other one is alive */
+#define WAIT_SLICE_MS   100
+
+struct shm_header {
+    atomic_uint state;
+    uint32_t    version;
+    int32_t     nb_slots;
+    int32_t     drop;
+    int32_t     time_base_num;
+    int32_t     time_base_den;
+    int32_t     producer_pid;
+
+    /* set by the first frame, before state goes STATE_SIZED */
+    int32_t     width;
+    int32_t     height;
+    int32_t     format;
+    int32_t     frame_size;
+    uint64_t    slot_size;
+    uint64_t    total_size;
+
+    _Alignas(64) _Atomic uint64_t write_seq;  /* producer side */
+    atomic_uint data_word;
+    atomic_int  consumer_waiting;
+    atomic_int  eof;
+
+    _Alignas(64) _Atomic uint64_t read_seq;   /* consumer side */
+    atomic_uint space_word;
+    atomic_int  producer_waiting;
+    atomic_int  consumer_pid;                 /* 0 if none attached */
+};
+
+struct shm_slot {
+    atomic_uint lock;
+    uint64_t    seq;
+    int64_t     pts;
+    int64_t     publish_ns;
+};
+
+struct shm_ring {
+    char    *name;
+    int      producer;
+    int      fd;
+    uint8_t *map;
+    size_t   map_size;
+    struct shm_header *hdr;
+
+    uint64_t next_seq;  /* consumer: the frame shm_ring_next() looks for */
+
+    struct shm_ring_stats stats;
+};
+
+static int              alloc_ring(struct shm_ring **, const char *, int);
+
+static int              map_ring(struct shm_ring *, size_t);
+
+static int              size_ring(struct shm_ring *, const AVFrame *);
+
+static struct shm_slot *slot_of(struct shm_ring *, uint64_t);
+
+static int              wait_space(struct shm_ring *, uint64_t);
+
+static int              wait_data(struct shm_ring *, int);
+
+static void             wake(atomic_uint *, atomic_int *);
+
+static int              gone(int);
+
+static int              futex_wait(atomic_uint *, unsigned, int);
+
+static void             futex_wake(atomic_uint *);
+
+static int64_t          now_ns(void);
+
+int shm_ring_create(struct shm_ring **ring, const char *name, int nb_slots,
+                    int drop, AVRational time_base) {
+    int ret;
+    struct shm_ring *r;
+
+    if ((ret = alloc_ring(&r, name, 1)) < 0)
+        return ret;
+
+    /* a producer that crashed leaves its object behind */
+    shm_unlink(r->name);
+    if ((r->fd = shm_open(r->name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0 ||
+        ftruncate(r->fd, HEADER_SIZE) < 0) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not create shared memory '%s'\n", r->name);
+        goto fail;
+    }
+    if ((ret = map_ring(r, HEADER_SIZE)) < 0)
+        goto fail;
+
+    r->hdr->version       = SHM_RING_VERSION;
+    r->hdr->nb_slots      = nb_slots > 0 ? nb_slots : SHM_RING_SLOTS;
+    r->hdr->drop          = drop;
+    r->hdr->time_base_num = time_base.num;
+    r->hdr->time_base_den = time_base.den;
+    r->hdr->producer_pid  = getpid();
+    atomic_store_explicit(&r->hdr->state, STATE_CREATED,
+                          memory_order_release);
+
+    *ring = r;
+    return 0;
+
+fail:
+    shm_ring_close(&r);
+    return ret;
+}
+
+int shm_ring_publish(struct shm_ring *ring, const AVFrame *frame) {
+    int ret;
+    unsigned lock;
+    uint64_t n;
+    int64_t t;
+    struct shm_header *h = ring->hdr;
+    struct shm_slot *slot;
+
+    if (atomic_load_explicit(&h->state, memory_order_relaxed) !=
+        STATE_SIZED) {
+        if ((ret = size_ring(ring, frame)) < 0)
+            return ret;
+        h = ring->hdr;
+    } else if (frame->width  != h->width  ||
+               frame->height != h->height || frame->format != h->format) {
+        fprintf(stderr,
+                "Error: width, height and pixel format have to be constant "
+                "in a shared memory ring (%dx%d %s, now %dx%d %s)\n",
+                h->width, h->height, av_get_pix_fmt_name(h->format),
+                frame->width, frame->height,
+                av_get_pix_fmt_name(frame->format));
+        return AVERROR(EINVAL);
+    }
+
+    n = atomic_load_explicit(&h->write_seq, memory_order_relaxed);
+    if (!h->drop && (ret = wait_space(ring, n)) < 0)
+        return ret;
+
+    t    = av_gettime_relative();
+    slot = slot_of(ring, n);
+    lock = atomic_load_explicit(&slot->lock, memory_order_relaxed);
+    atomic_store_explicit(&slot->lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->seq = n;
+    slot->pts = frame->best_effort_timestamp;
+    ret = av_image_copy_to_buffer((uint8_t *)slot + SLOT_HEADER,
+                                  h->frame_size,
+                                  (const uint8_t * const *)frame->data,
+                                  frame->linesize, frame->format,
+                                  frame->width, frame->height, 1);
+    slot->publish_ns = now_ns();
+    atomic_store_explicit(&slot->lock, lock + 2, memory_order_release);
+    if (ret < 0)
+        return ret;
+
+    atomic_store_explicit(&h->write_seq, n + 1, memory_order_release);
+    wake(&h->data_word, &h->consumer_waiting);
+
+    ring->stats.copy_us += av_gettime_relative() - t;
+    ring->stats.nb_frames++;
+    ring->stats.bytes += h->frame_size;
+
+    return 0;
+}
+
+int shm_ring_open(struct shm_ring **ring, const char *name,
+                  int timeout_ms) {
+    int ret, pid = 0;
+    uint64_t w;
+    size_t total_size;
+    struct stat st;
+    struct shm_ring *r;
+    int64_t deadline = av_gettime_relative() + timeout_ms * INT64_C(1000);
+
+    if ((ret = alloc_ring(&r, name, 0)) < 0)
+        return ret;
+
+    /* the producer may not be there yet, or still be setting up */
+    for (;;) {
+        if (r->fd < 0 && (r->fd = shm_open(r->name, O_RDWR, 0)) < 0)
+            ret = AVERROR(errno);
+        else if (!r->map && fstat(r->fd, &st) == 0 &&
+                 st.st_size >= HEADER_SIZE)
+            ret = map_ring(r, HEADER_SIZE);
+        if (r->map && atomic_load_explicit(&r->hdr->state,
+                                           memory_order_acquire) >=
+                      STATE_CREATED)
+            break;
+        if (av_gettime_relative() >= deadline) {
+            fprintf(stderr, "No shared memory ring '%s' (%s)\n", r->name,
+                    av_err2str(ret < 0 ? ret : AVERROR(ETIMEDOUT)));
+            ret = ret < 0 ? ret : AVERROR(ETIMEDOUT);
+            goto fail;
+        }
+        av_usleep(1000);
+    }
+    if (r->hdr->version != SHM_RING_VERSION) {
+        fprintf(stderr, "Shared memory ring '%s' is version %u, not %d\n",
+                r->name, r->hdr->version, SHM_RING_VERSION);
+        ret = AVERROR(EINVAL);
+        goto fail;
+    }
+
+    /* a consumer killed without detaching leaves its pid behind, only a
+     * producer held by it would clear it, one in drop mode never is */
+    while (!atomic_compare_exchange_strong(&r->hdr->consumer_pid, &pid,
+                                           getpid())) {
+        if (!gone(pid)) {
+            fprintf(stderr,
+                    "Shared memory ring '%s' is taken by process %d\n",
+                    r->name, pid);
+            ret = AVERROR(EBUSY);
+            goto fail;
+        }
+    }
+    /* start at the oldest frame still there, but past the slot of frame
+     * w, which the producer may be writing without waiting for us */
+    w = atomic_load_explicit(&r->hdr->write_seq, memory_order_acquire);
+    r->next_seq = w >= r->hdr->nb_slots ? w - r->hdr->nb_slots + 1 : 0;
+    atomic_store_explicit(&r->hdr->read_seq, r->next_seq,
+                          memory_order_release);
+    /* a producer may sleep on the consumer it saw before this one */
+    wake(&r->hdr->space_word, &r->hdr->producer_waiting);
+
+    while (atomic_load_explicit(&r->hdr->state, memory_order_acquire) !=
+           STATE_SIZED) {
+        if (atomic_load_explicit(&r->hdr->eof, memory_order_acquire)) {
+            ret = AVERROR_EOF;
+            goto fail;
+        }
+        if (gone(r->hdr->producer_pid)) {
+            fprintf(stderr, "Producer of shared memory ring '%s' is gone\n",
+                    r->name);
+            ret = AVERROR(EPIPE);
+            goto fail;
+        }
+        if (av_gettime_relative() >= deadline) {
+            fprintf(stderr, "No frame in shared memory ring '%s'\n",
+                    r->name);
+            ret = AVERROR(ETIMEDOUT);
+            goto fail;
+        }
+        av_usleep(1000);
+    }
+    total_size = r->hdr->total_size;
+    if ((ret = map_ring(r, total_size)) < 0)
+        goto fail;
+
+    *ring = r;
+    return 0;
+
+fail:
+    shm_ring_close(&r);
+    return ret;
+}
+
+int shm_ring_next(struct shm_ring *ring, struct shm_ring_frame *frame,
+                  int timeout_ms) {
+    int ret;
+    unsigned lock;
+    uint64_t w;
+    struct shm_header *h = ring->hdr;
+    struct shm_slot *slot;
+
+    for (;;) {
+        if ((ret = wait_data(ring, timeout_ms)) < 0)
+            return ret;
+
+        /* lapped by the producer, in drop mode or before attaching */
+        w = atomic_load_explicit(&h->write_seq, memory_order_acquire);
+        if (w - ring->next_seq > (uint64_t)h->nb_slots) {
+            ring->stats.nb_dropped += w - h->nb_slots - ring->next_seq;
+            ring->next_seq          = w - h->nb_slots;
+        }
+
+        slot = slot_of(ring, ring->next_seq);
+        lock = atomic_load_explicit(&slot->lock, memory_order_acquire);
+        if (!(lock & 1) && slot->seq == ring->next_seq)
+            break;
+        /* being overwritten right now */
+        ring->stats.nb_dropped++;
+        ring->next_seq++;
+    }
+
+    frame->seq        = ring->next_seq++;
+    frame->pts        = slot->pts;
+    frame->time_base  = (AVRational){h->time_base_num, h->time_base_den};
+    frame->width      = h->width;
+    frame->height     = h->height;
+    frame->format     = h->format;
+    frame->size       = h->frame_size;
+    frame->publish_ns = slot->publish_ns;
+    frame->lock       = lock;
+    av_image_fill_arrays(frame->data, frame->linesize,
+                         (uint8_t *)slot + SLOT_HEADER, frame->format,
+                         frame->width, frame->height, 1);
+
+    ring->stats.nb_frames++;
+    ring->stats.bytes += frame->size;
+
+    return 0;
+}
+
+int shm_ring_release(struct shm_ring *ring, struct shm_ring_frame *frame) {
+    int stale;
+    struct shm_slot *slot = slot_of(ring, frame->seq);
+
+    /* the reads of the frame happen before the lock is checked again */
+    atomic_thread_fence(memory_order_acquire);
+    stale = atomic_load_explicit(&slot->lock, memory_order_relaxed) !=
+            frame->lock;
+
+    atomic_store_explicit(&ring->hdr->read_seq, frame->seq + 1,
+                          memory_order_release);
+    wake(&ring->hdr->space_word, &ring->hdr->producer_waiting);
+
+    memset(frame->data, 0, sizeof(frame->data));
+    if (stale) {
+        ring->stats.nb_stale++;
+        return AVERROR(ESTALE);
+    }
+    return 0;
+}
+
+void shm_ring_close(struct shm_ring **ring) {
+    int pid = getpid();
+    struct shm_ring *r = *ring;
+
+    if (!r)
+        return;
+
+    if (r->hdr && r->producer) {
+        atomic_store_explicit(&r->hdr->eof, 1, memory_order_release);
+        wake(&r->hdr->data_word, &r->hdr->consumer_waiting);
+    } else if (r->hdr) {
+        /* detach, a producer waiting for this consumer goes on */
+        atomic_compare_exchange_strong(&r->hdr->consumer_pid, &pid, 0);
+        wake(&r->hdr->space_word, &r->hdr->producer_waiting);
+    }
+
+    /* a consumer still attached keeps its mapping */
+    if (r->producer && r->fd >= 0)
+        shm_unlink(r->name);
+    if (r->map)
+        munmap(r->map, r->map_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    av_free(r->name);
+    av_freep(ring);
+}
+
+const struct shm_ring_stats *shm_ring_get_stats(struct shm_ring *ring) {
+    return &ring->stats;
+}
+
+void shm_ring_dump_stats(struct shm_ring *ring, FILE *fp) {
+    const struct shm_ring_stats *stats = &ring->stats;
+    struct shm_header *h = ring->hdr;
+
+    fprintf(fp,
+            "shm ring (%s): %"PRId64" frames, %.1f MiB %s, %d slots of "
+            "%.1f MiB%s, %"PRId64" waits (%.3f ms)",
+            ring->name, stats->nb_frames, stats->bytes / (1024.0 * 1024.0),
+            ring->producer ? "published" : "received", h->nb_slots,
+            h->slot_size / (1024.0 * 1024.0), h->drop ? ", dropping" : "",
+            stats->nb_waits, stats->wait_us / 1000.0);
+    if (ring->producer)
+        fprintf(fp, ", copy %.3f ms, %"PRId64" consumers lost\n",
+                stats->copy_us / 1000.0, stats->nb_lost);
+    else
+        fprintf(fp, ", %"PRId64" dropped, %"PRId64" stale\n",
+                stats->nb_dropped, stats->nb_stale);
+}
+
+static int alloc_ring(struct shm_ring **ring, const char *name,
+                      int producer) {
+    struct shm_ring *r;
+
+    if (!(r = av_mallocz(sizeof(*r))))
+        return AVERROR(ENOMEM);
+    r->fd       = -1;
+    r->producer = producer;
+    if (!(r->name = av_asprintf("/%s", name + (name[0] == '/')))) {
+        av_free(r);
+        return AVERROR(ENOMEM);
+    }
+
+    *ring = r;
+    return 0;
+}
+
+static int map_ring(struct shm_ring *ring, size_t size) {
+    void *map;
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (map == MAP_FAILED)
+        return AVERROR(errno);
+
+    if (ring->map)
+        munmap(ring->map, ring->map_size);
+    ring->map      = map;
+    ring->map_size = size;
+    ring->hdr      = map;
+
+    return 0;
+}
+
+static int size_ring(struct shm_ring *ring, const AVFrame *frame) {
+    int ret, size;
+    struct shm_header *h = ring->hdr;
+
+    if ((size = av_image_get_buffer_size(frame->format, frame->width,
+                                         frame->height, 1)) < 0) {
+        fprintf(stderr, "Pixel format %s cannot be put in a shared memory "
+                "ring\n", av_get_pix_fmt_name(frame->format));
+        return size;
+    }
+
+    h->width      = frame->width;
+    h->height     = frame->height;
+    h->format     = frame->format;
+    h->frame_size = size;
+    h->slot_size  = FFALIGN(SLOT_HEADER + size, HEADER_SIZE);
+    h->total_size = HEADER_SIZE + h->nb_slots * h->slot_size;
+
+    if (ftruncate(ring->fd, h->total_size) < 0) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not size shared memory '%s' to %"PRIu64" "
+                "bytes\n", ring->name, h->total_size);
+        return ret;
+    }
+    if ((ret = map_ring(ring, h->total_size)) < 0)
+        return ret;
+
+    atomic_store_explicit(&ring->hdr->state, STATE_SIZED,
+                          memory_order_release);
+    return 0;
+}
+
+static struct shm_slot *slot_of(struct shm_ring *ring, uint64_t seq) {
+    return (struct shm_slot *)(ring->map + HEADER_SIZE +
+                               seq % ring->hdr->nb_slots *
+                               ring->hdr->slot_size);
+}
+
+/* producer, no drop: wait while the slot of frame n holds a frame the
+ * attached consumer has not released yet */
+static int wait_space(struct shm_ring *ring, uint64_t n) {
+    int i, pid, timed_out;
+    unsigned word;
+    int64_t t;
+    struct shm_header *h = ring->hdr;
+
+    for (i = 0; ; i++) {
+        pid = atomic_load_explicit(&h->consumer_pid, memory_order_acquire);
+        if (!pid || n - atomic_load_explicit(&h->read_seq,
+                                             memory_order_acquire) <
+                    (uint64_t)h->nb_slots)
+            return 0;
+        if (i < SHM_RING_SPIN)
+            continue;
+
+        word = atomic_load_explicit(&h->space_word, memory_order_relaxed);
+        atomic_store_explicit(&h->producer_waiting, 1,
+                              memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (n - atomic_load_explicit(&h->read_seq, memory_order_acquire) <
+            (uint64_t)h->nb_slots) {
+            atomic_store_explicit(&h->producer_waiting, 0,
+                                  memory_order_relaxed);
+            return 0;
+        }
+
+        t = av_gettime_relative();
+        timed_out = futex_wait(&h->space_word, word, WAIT_SLICE_MS) ==
+                    ETIMEDOUT;
+        atomic_store_explicit(&h->producer_waiting, 0,
+                              memory_order_relaxed);
+        ring->stats.nb_waits++;
+        ring->stats.wait_us += av_gettime_relative() - t;
+
+        /* a consumer killed without detaching holds the producer no
+         * more */
+        if (timed_out && gone(pid) &&
+            atomic_compare_exchange_strong(&h->consumer_pid, &pid, 0))
+            ring->stats.nb_lost++;
+    }
+}
+
+/* consumer: wait until frame next_seq is published, or the producer is
+ * done */
+static int wait_data(struct shm_ring *ring, int timeout_ms) {
+    int i, timed_out;
+    unsigned word;
+    int64_t t, now;
+    int64_t deadline = timeout_ms < 0 ? INT64_MAX :
+                       av_gettime_relative() + timeout_ms * INT64_C(1000);
+    struct shm_header *h = ring->hdr;
+
+    for (i = 0; ; i++) {
+        /* eof is raised after the last frame is published */
+        if (atomic_load_explicit(&h->eof, memory_order_acquire) &&
+            atomic_load_explicit(&h->write_seq, memory_order_acquire) <=
+            ring->next_seq)
+            return AVERROR_EOF;
+        if (atomic_load_explicit(&h->write_seq, memory_order_acquire) >
+            ring->next_seq)
+            return 0;
+        if (i < SHM_RING_SPIN)
+            continue;
+
+        if ((now = av_gettime_relative()) >= deadline)
+            return AVERROR(EAGAIN);
+        word = atomic_load_explicit(&h->data_word, memory_order_relaxed);
+        atomic_store_explicit(&h->consumer_waiting, 1,
+                              memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&h->write_seq, memory_order_acquire) >
+            ring->next_seq ||
+            atomic_load_explicit(&h->eof, memory_order_acquire)) {
+            atomic_store_explicit(&h->consumer_waiting, 0,
+                                  memory_order_relaxed);
+            continue;
+        }
+
+        t = now;
+        timed_out = futex_wait(&h->data_word, word,
+                               FFMIN(WAIT_SLICE_MS,
+                                     (deadline - now) / 1000 + 1)) ==
+                    ETIMEDOUT;
+        atomic_store_explicit(&h->consumer_waiting, 0,
+                              memory_order_relaxed);
+        ring->stats.nb_waits++;
+        ring->stats.wait_us += av_gettime_relative() - t;
+
+        /* a producer killed before raising eof publishes nothing more;
+         * what it published last is checked once again first */
+        if (timed_out && gone(h->producer_pid) &&
+            atomic_load_explicit(&h->write_seq, memory_order_acquire) <=
+            ring->next_seq &&
+            !atomic_load_explicit(&h->eof, memory_order_acquire))
+            return AVERROR(EPIPE);
+    }
+}
+
+/* called after publishing a counter: wake the other side if it sleeps */
+static void wake(atomic_uint *word, atomic_int *waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(word, 1, memory_order_release);
+        futex_wake(word);
+    }
+}
+
+/* the process does not exist any more, it cannot have closed the ring */
+static int gone(int pid) {
+    return pid > 0 && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+/* the futexes are shared between processes, not FUTEX_PRIVATE_FLAG */
+static int futex_wait(atomic_uint *word, unsigned val, int timeout_ms) {
+    struct timespec ts = {timeout_ms / 1000, timeout_ms % 1000 * 1000000L};
+
+    if (syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0) < 0)
+        return errno;
+    return 0;
+}
+
+static void futex_wake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
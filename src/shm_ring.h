@@ -0,0 +1,96 @@
+/**
+ * @file shm_ring.h
+ * ring of decoded video frames in POSIX shared memory, published by one
+ * process and mapped in place by a consumer process, no copy and no disk
+ * in between
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+#include <libavutil/pixfmt.h>
+
+#define SHM_RING_SLOTS    8
+#define SHM_RING_VERSION  1
+
+/* times a side polls the ring before it sleeps on a futex */
+#define SHM_RING_SPIN     1000
+
+struct shm_ring_stats {
+    int64_t nb_frames;   /* published, or received by the consumer */
+    int64_t bytes;
+    int64_t nb_dropped;  /* overwritten before the consumer got to them */
+    int64_t nb_stale;    /* overwritten while the consumer held them */
+    int64_t nb_waits;    /* sleeps for a free slot / for a frame */
+    int64_t wait_us;
+    int64_t copy_us;     /* producer: frames copied into the ring */
+    int64_t nb_lost;     /* producer: consumers gone without detaching */
+};
+
+/* a frame in the ring, filled by shm_ring_next(); data points into the
+ * shared mapping and stays valid until shm_ring_release() */
+struct shm_ring_frame {
+    uint64_t   seq;         /* number of the frame since the ring started */
+    int64_t    pts;         /* best effort, in time_base */
+    AVRational time_base;
+    int        width;
+    int        height;
+    enum AVPixelFormat format;
+    uint8_t   *data[4];     /* planes without padding, palette if any */
+    int        linesize[4];
+    int        size;
+    int64_t    publish_ns;  /* CLOCK_MONOTONIC, when it was published */
+    uint32_t   lock;        /* seqlock of the slot when it was taken */
+};
+
+struct shm_ring;
+
+/* producer: create the shared memory object '/name' (replacing a stale
+ * one), slots sized by the first frame; 0 nb_slots selects
+ * SHM_RING_SLOTS; without drop, a full ring holds the producer until the
+ * consumer, if one is attached, releases a frame, with drop the oldest
+ * frame is overwritten instead */
+int  shm_ring_create(struct shm_ring **ring, const char *name, int nb_slots,
+                     int drop, AVRational time_base);
+
+/* producer: copy the frame into the next slot and publish it; geometry
+ * and pixel format have to stay those of the first frame */
+int  shm_ring_publish(struct shm_ring *ring, const AVFrame *frame);
+
+/* consumer: attach to '/name', waiting up to timeout_ms for the producer
+ * to create it and size its slots; a ring takes one consumer at a time,
+ * which starts at the oldest frame still in it, and takes over from one
+ * killed without detaching */
+int  shm_ring_open(struct shm_ring **ring, const char *name,
+                   int timeout_ms);
+
+/* consumer: wait up to timeout_ms (< 0: for ever) for the next frame;
+ * AVERROR_EOF once the producer is done and every frame was taken,
+ * AVERROR(EAGAIN) on timeout, AVERROR(EPIPE) if the producer died without
+ * closing the ring */
+int  shm_ring_next(struct shm_ring *ring, struct shm_ring_frame *frame,
+                   int timeout_ms);
+
+/* consumer: done with the frame, its slot goes back to the producer;
+ * AVERROR(ESTALE) if it was overwritten meanwhile (drop mode, or a frame
+ * taken right after attaching) */
+int  shm_ring_release(struct shm_ring *ring, struct shm_ring_frame *frame);
+
+/* producer: mark the end of the stream, wake the consumer and remove the
+ * name; consumer: detach; both unmap the ring */
+void shm_ring_close(struct shm_ring **ring);
+
+const struct shm_ring_stats *shm_ring_get_stats(struct shm_ring *ring);
+
+void shm_ring_dump_stats(struct shm_ring *ring, FILE *fp);
+
+#endif /* SHM_RING_H */
@@ -0,0 +1,163 @@
+/**
+ * @file thumbnail.c
+ * keyframe-only decoder setup and downscaled PPM thumbnails
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mathematics.h>
+#include <libswscale/swscale.h>
+
+#include "thumbnail.h"
+
+struct thumbnailer {
+    char   *prefix;
+    int     width;
+    int     height;               /* of the thumbnails, from the frames */
+
+    /* conversion of the current source geometry */
+    struct SwsContext *sws_ctx;
+    int     src_width;
+    int     src_height;
+    enum AVPixelFormat src_pix_fmt;
+    uint8_t *rgb_data[4];         /* packed RGB24, no line padding */
+    int      rgb_linesize[4];
+    int      rgb_size;
+
+    struct thumbnailer_stats stats;
+};
+
+static int setup(struct thumbnailer *, const AVFrame *);
+
+int thumbnailer_open(struct thumbnailer **th, const char *prefix,
+                     int width) {
+    struct thumbnailer *t;
+
+    if (!(t = av_mallocz(sizeof(*t))))
+        return AVERROR(ENOMEM);
+    t->width       = FFALIGN(width > 0 ? width : THUMBNAIL_WIDTH, 2);
+    t->src_pix_fmt = AV_PIX_FMT_NONE;
+    if (!(t->prefix = av_strdup(prefix))) {
+        av_free(t);
+        return AVERROR(ENOMEM);
+    }
+
+    *th = t;
+    return 0;
+}
+
+int thumbnailer_write(struct thumbnailer *th, const AVFrame *frame) {
+    int ret;
+    FILE *fp;
+    char filename[1024];
+    int64_t t0, t1;
+
+    if ((frame->width  != th->src_width  ||
+         frame->height != th->src_height || frame->format != th->src_pix_fmt)
+        && (ret = setup(th, frame)) < 0)
+        return ret;
+
+    t0 = av_gettime_relative();
+    sws_scale(th->sws_ctx, (const uint8_t *const *)frame->data,
+              frame->linesize, 0, frame->height,
+              th->rgb_data, th->rgb_linesize);
+    t1 = av_gettime_relative();
+
+    snprintf(filename, sizeof(filename), "%s-%05"PRId64".ppm",
+             th->prefix, th->stats.nb_thumbs + 1);
+    if (!(fp = fopen(filename, "wb"))) {
+        fprintf(stderr, "Could not open '%s'\n", filename);
+        return AVERROR(errno);
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", th->width, th->height);
+    fwrite(th->rgb_data[0], 1, th->rgb_size, fp);
+    if (ferror(fp) | fclose(fp)) {
+        fprintf(stderr, "Could not write '%s'\n", filename);
+        return AVERROR(EIO);
+    }
+
+    th->stats.nb_thumbs++;
+    th->stats.scale_us += t1 - t0;
+    th->stats.write_us += av_gettime_relative() - t1;
+
+    return 0;
+}
+
+void thumbnailer_close(struct thumbnailer **th) {
+    if (!*th)
+        return;
+
+    sws_freeContext((*th)->sws_ctx);
+    av_free((*th)->rgb_data[0]);
+    av_free((*th)->prefix);
+    av_freep(th);
+}
+
+const struct thumbnailer_stats *thumbnailer_get_stats(
+        struct thumbnailer *th) {
+    return &th->stats;
+}
+
+void thumbnailer_dump_stats(struct thumbnailer *th, FILE *fp) {
+    const struct thumbnailer_stats *stats = &th->stats;
+
+    fprintf(fp,
+            "thumbnails: %"PRId64" images %dx%d, scale %.3f ms, "
+            "write %.3f ms\n",
+            stats->nb_thumbs, th->width, th->height,
+            stats->scale_us / 1000.0, stats->write_us / 1000.0);
+}
+
+void thumbnail_setup_decoder(AVCodecContext *dec_ctx) {
+    /* both are looked at per frame, so an opened decoder is fine */
+    dec_ctx->skip_frame       = AVDISCARD_NONKEY;
+    dec_ctx->skip_loop_filter = AVDISCARD_ALL;
+}
+
+static int setup(struct thumbnailer *th, const AVFrame *frame) {
+    int ret;
+    AVRational sar = frame->sample_aspect_ratio;
+
+    if (sar.num <= 0 || sar.den <= 0)
+        sar = (AVRational){1, 1};
+
+    /* the height keeps the display aspect ratio, rounded to even for
+     * the viewers that insist on it */
+    th->height = av_rescale(th->width, (int64_t)frame->height * sar.den,
+                            (int64_t)frame->width * sar.num);
+    th->height = FFMAX(2, th->height & ~1);
+
+    th->sws_ctx = sws_getCachedContext(th->sws_ctx,
+                                       frame->width, frame->height,
+                                       frame->format,
+                                       th->width, th->height,
+                                       AV_PIX_FMT_RGB24, SWS_BILINEAR,
+                                       NULL, NULL, NULL);
+    if (!th->sws_ctx) {
+        fprintf(stderr, "Could not scale %dx%d frames to %dx%d\n",
+                frame->width, frame->height, th->width, th->height);
+        return AVERROR(EINVAL);
+    }
+
+    av_freep(&th->rgb_data[0]);
+    if ((ret = av_image_alloc(th->rgb_data, th->rgb_linesize,
+                              th->width, th->height,
+                              AV_PIX_FMT_RGB24, 1)) < 0)
+        return ret;
+    th->rgb_size = ret;
+
+    th->src_width   = frame->width;
+    th->src_height  = frame->height;
+    th->src_pix_fmt = frame->format;
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file thumbnail.h
+ * keyframe-only decoder setup and downscaled PPM thumbnails
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+
+#define THUMBNAIL_WIDTH 160
+
+struct thumbnailer_stats {
+    int64_t nb_thumbs;
+    int64_t scale_us; /* time spent in swscale */
+    int64_t write_us; /* time spent writing the PPM files */
+};
+
+struct thumbnailer;
+
+/* thumbnails are written to '<prefix>-<n>.ppm', width wide (0 selects
+ * THUMBNAIL_WIDTH) with the height following the display aspect ratio */
+int  thumbnailer_open(struct thumbnailer **th, const char *prefix,
+                      int width);
+
+int  thumbnailer_write(struct thumbnailer *th, const AVFrame *frame);
+
+void thumbnailer_close(struct thumbnailer **th);
+
+const struct thumbnailer_stats *thumbnailer_get_stats(
+        struct thumbnailer *th);
+
+void thumbnailer_dump_stats(struct thumbnailer *th, FILE *fp);
+
+/* make dec_ctx output key frames only and skip its loop filter, which
+ * only pays off when the pictures are kept as references */
+void thumbnail_setup_decoder(AVCodecContext *dec_ctx);
+
+#endif /* THUMBNAIL_H */
@@ -0,0 +1,307 @@
+/**
+ * @file trace.c
+ * per-stage latency histograms and Chrome trace_event export of the
+ * decode pipelines, compiled in with ENABLE_TRACE (make TRACE=1)
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <libavutil/error.h>
+
+#include "trace.h"
+
+#if ENABLE_TRACE
+
+#include <pthread.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/common.h>
+
+#define CALIBRATE_LOOPS 10000
+
+struct event {
+    int64_t start_ns;
+    int32_t dur_ns;
+    int32_t stage;
+};
+
+/* everything a thread records, without any lock; the thread appends it
+ * to the list once, at its first event */
+struct trace_thread {
+    int      tid;
+    int64_t  count[TRACE_NB_STAGES];
+    int64_t  total_ns[TRACE_NB_STAGES];
+    int64_t  max_ns[TRACE_NB_STAGES];
+    int64_t  hist[TRACE_NB_STAGES][TRACE_NB_BUCKETS];
+
+    struct event *events;
+    int           nb_events;
+    int           nb_alloc;
+    int64_t       nb_lost;  /* past TRACE_MAX_EVENTS or out of memory */
+
+    struct trace_thread *next;
+};
+
+int trace_enabled;
+
+static struct {
+    pthread_mutex_t      lock;
+    struct trace_thread *threads;
+    int                  nb_threads;
+    char                *json_filename;
+    int64_t              t0_ns;
+    double               event_ns;  /* cost of one traced stage */
+} trace = {PTHREAD_MUTEX_INITIALIZER};
+
+static __thread struct trace_thread *self;
+
+static const char *const stage_names[TRACE_NB_STAGES] = {
+    "read", "parse", "send_packet", "receive_frame", "copy", "write",
+};
+
+static struct trace_thread *thread_register(void);
+
+static void   record(struct trace_thread *, enum trace_stage, int64_t,
+                     int64_t);
+
+static int    bucket_of(uint64_t);
+
+static double bucket_value(int);
+
+static double percentile(const int64_t *, int64_t, double);
+
+static int    write_json(const char *);
+
+int trace_init(const char *json_filename) {
+    int i;
+    int64_t t;
+    struct trace_thread *dummy;
+
+    if (json_filename &&
+        !(trace.json_filename = av_strdup(json_filename)))
+        return AVERROR(ENOMEM);
+
+    /* what TRACE_BEGIN / TRACE_END cost, both clock reads and the
+     * histogram update, to tell the overhead at the end */
+    if (!(dummy = av_mallocz(sizeof(*dummy))))
+        return AVERROR(ENOMEM);
+    t = trace_now();
+    for (i = 0; i < CALIBRATE_LOOPS; i++) {
+        int64_t start = trace_now();
+
+        record(dummy, TRACE_READ, start, trace_now());
+    }
+    trace.event_ns = (trace_now() - t) / (double)CALIBRATE_LOOPS;
+    av_free(dummy->events);
+    av_free(dummy);
+
+    trace.t0_ns   = trace_now();
+    trace_enabled = 1;
+
+    return 0;
+}
+
+void trace_event(enum trace_stage stage, int64_t start_ns) {
+    int64_t end_ns = trace_now();
+    struct trace_thread *t = self ? self : thread_register();
+
+    if (t)
+        record(t, stage, start_ns, end_ns);
+}
+
+void trace_dump(FILE *fp) {
+    int i, b;
+    int64_t nb_events = 0, nb_lost = 0;
+    int64_t wall_ns = trace_now() - trace.t0_ns;
+    int64_t hist[TRACE_NB_BUCKETS];
+    struct trace_thread *t, *next;
+
+    if (!trace_enabled)
+        return;
+    trace_enabled = 0;
+
+    pthread_mutex_lock(&trace.lock);
+    fprintf(fp, "trace: %-13s %9s %10s %9s %9s %9s %9s %9s %9s\n",
+            "stage", "count", "total ms", "mean us", "p50 us", "p90 us",
+            "p99 us", "p99.9 us", "max us");
+    for (i = 0; i < TRACE_NB_STAGES; i++) {
+        int64_t count = 0, total = 0, max = 0;
+
+        memset(hist, 0, sizeof(hist));
+        for (t = trace.threads; t; t = t->next) {
+            count += t->count[i];
+            total += t->total_ns[i];
+            max    = FFMAX(max, t->max_ns[i]);
+            for (b = 0; b < TRACE_NB_BUCKETS; b++)
+                hist[b] += t->hist[i][b];
+        }
+        nb_events += count;
+        if (!count)
+            continue;
+
+        fprintf(fp,
+                "trace: %-13s %9"PRId64" %10.3f %9.3f %9.3f %9.3f %9.3f "
+                "%9.3f %9.3f\n",
+                stage_names[i], count, total / 1e6, total / 1e3 / count,
+                percentile(hist, count, 0.5) / 1e3,
+                percentile(hist, count, 0.9) / 1e3,
+                percentile(hist, count, 0.99) / 1e3,
+                percentile(hist, count, 0.999) / 1e3, max / 1e3);
+    }
+    for (t = trace.threads; t; t = t->next)
+        nb_lost += t->nb_lost;
+
+    fprintf(fp,
+            "trace: %"PRId64" events on %d threads (%"PRId64" left out of "
+            "the Chrome trace), overhead ~%.3f ms, %.2f%% of %.3f s\n",
+            nb_events, trace.nb_threads, nb_lost,
+            nb_events * trace.event_ns / 1e6,
+            100.0 * nb_events * trace.event_ns / FFMAX(wall_ns, 1),
+            wall_ns / 1e9);
+    if (trace.json_filename && write_json(trace.json_filename) >= 0)
+        fprintf(fp, "trace: Chrome trace written to '%s'\n",
+                trace.json_filename);
+
+    for (t = trace.threads; t; t = next) {
+        next = t->next;
+        av_free(t->events);
+        av_free(t);
+    }
+    trace.threads    = NULL;
+    trace.nb_threads = 0;
+    self = NULL;
+    av_freep(&trace.json_filename);
+    pthread_mutex_unlock(&trace.lock);
+}
+
+static struct trace_thread *thread_register(void) {
+    struct trace_thread *t;
+
+    if (!(t = av_mallocz(sizeof(*t))))
+        return NULL;
+
+    pthread_mutex_lock(&trace.lock);
+    t->tid        = ++trace.nb_threads;
+    t->next       = trace.threads;
+    trace.threads = t;
+    pthread_mutex_unlock(&trace.lock);
+
+    return self = t;
+}
+
+static void record(struct trace_thread *t, enum trace_stage stage,
+                   int64_t start_ns, int64_t end_ns) {
+    int64_t dur = end_ns - start_ns;
+
+    t->count[stage]++;
+    t->total_ns[stage] += dur;
+    if (dur > t->max_ns[stage])
+        t->max_ns[stage] = dur;
+    t->hist[stage][bucket_of(dur)]++;
+
+    if (!trace.json_filename)
+        return;
+    if (t->nb_events == t->nb_alloc) {
+        int nb_alloc = FFMIN(FFMAX(4096, t->nb_alloc * 2), TRACE_MAX_EVENTS);
+        struct event *events;
+
+        if (nb_alloc == t->nb_alloc ||
+            !(events = av_realloc_array(t->events, nb_alloc,
+                                        sizeof(*events)))) {
+            t->nb_lost++;
+            return;
+        }
+        t->events   = events;
+        t->nb_alloc = nb_alloc;
+    }
+    t->events[t->nb_events++] = (struct event){start_ns, FFMIN(dur,
+                                               INT32_MAX), stage};
+}
+
+/* values below 2^TRACE_SUB_BITS have a bucket each, above that every power
+ * of two is cut into 2^TRACE_SUB_BITS buckets */
+static int bucket_of(uint64_t v) {
+    int e;
+
+    if (v < (1 << TRACE_SUB_BITS))
+        return v;
+    e = 63 - __builtin_clzll(v);
+    return ((e - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS) +
+           ((v >> (e - TRACE_SUB_BITS)) & ((1 << TRACE_SUB_BITS) - 1));
+}
+
+/* the middle of the bucket */
+static double bucket_value(int b) {
+    int e, m;
+
+    if (b < (1 << TRACE_SUB_BITS))
+        return b;
+    e = (b >> TRACE_SUB_BITS) + TRACE_SUB_BITS - 1;
+    m = b & ((1 << TRACE_SUB_BITS) - 1);
+    return (double)(((1 << TRACE_SUB_BITS) + m) * 2 + 1) *
+           (UINT64_C(1) << (e - TRACE_SUB_BITS)) / 2;
+}
+
+static double percentile(const int64_t *hist, int64_t count, double p) {
+    int b;
+    int64_t seen = 0, rank = FFMAX((int64_t)(count * p + 0.5), 1);
+
+    for (b = 0; b < TRACE_NB_BUCKETS; b++)
+        if ((seen += hist[b]) >= rank)
+            return bucket_value(b);
+
+    return 0;
+}
+
+/* complete ('X') events, microseconds from trace_init(), one track per
+ * thread; caller holds the lock */
+static int write_json(const char *filename) {
+    int i, first = 1;
+    FILE *fp;
+    struct trace_thread *t;
+
+    if (!(fp = fopen(filename, "w"))) {
+        fprintf(stderr, "Could not open trace file '%s'\n", filename);
+        return AVERROR(errno);
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (t = trace.threads; t; t = t->next) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first ? "" : ",\n", t->tid, t->tid);
+        first = 0;
+        for (i = 0; i < t->nb_events; i++) {
+            const struct event *e = &t->events[i];
+
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    stage_names[e->stage], t->tid,
+                    (e->start_ns - trace.t0_ns) / 1e3, e->dur_ns / 1e3);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Could not write trace file '%s'\n", filename);
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+#else /* !ENABLE_TRACE */
+
+int trace_init(const char *json_filename) {
+    return AVERROR(ENOSYS);
+}
+
+void trace_dump(FILE *fp) {
+}
+
+#endif /* ENABLE_TRACE */
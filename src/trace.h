@@ -0,0 +1,76 @@
+/**
+ * @file trace.h
+ * per-stage latency histograms and Chrome trace_event export of the
+ * decode pipelines, compiled in with ENABLE_TRACE (make TRACE=1)
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* set by the Makefile with TRACE=1; without it TRACE_BEGIN / TRACE_END
+ * compile to nothing and trace_init() fails with AVERROR(ENOSYS) */
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 0
+#endif
+
+/* log-linear histogram buckets: 2^TRACE_SUB_BITS per power of two, so a
+ * latency is known within 1 / 2^TRACE_SUB_BITS (6%) whatever its size */
+#define TRACE_SUB_BITS    4
+#define TRACE_NB_BUCKETS  ((64 - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS)
+
+/* events kept per thread for the Chrome trace, later ones are only
+ * counted in the histograms */
+#define TRACE_MAX_EVENTS  (1 << 20)
+
+enum trace_stage {
+    TRACE_READ,     /* av_read_frame(), fread() of the input */
+    TRACE_PARSE,    /* av_parser_parse2() */
+    TRACE_SEND,     /* avcodec_send_packet() */
+    TRACE_RECEIVE,  /* avcodec_receive_frame() */
+    TRACE_COPY,     /* staging copies, interleaving, downscaling */
+    TRACE_WRITE,    /* writev() / fwrite() of the output */
+    TRACE_NB_STAGES
+};
+
+#if ENABLE_TRACE
+#include <time.h>
+
+/* set by trace_init(), read by TRACE_BEGIN on every thread */
+extern int trace_enabled;
+
+static inline int64_t trace_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+/* record the stage as lasting from start_ns (trace_now()) to now, in the
+ * histogram and the event buffer of the calling thread */
+void trace_event(enum trace_stage stage, int64_t start_ns);
+
+/* declares t, the start of a stage, and closes it; a single load and
+ * branch when tracing was not asked for at run time */
+#define TRACE_BEGIN(t)      int64_t t = trace_enabled ? trace_now() : 0
+#define TRACE_END(stage, t) do { if (t) trace_event(stage, t); } while (0)
+#else
+#define TRACE_BEGIN(t)
+#define TRACE_END(stage, t)
+#endif
+
+/* start recording, before any thread to trace is started; the Chrome
+ * trace goes to json_filename at trace_dump(), none if NULL */
+int  trace_init(const char *json_filename);
+
+/* once the traced threads are done: the summary table of every stage to
+ * fp, the Chrome trace to its file; frees everything, tracing stops */
+void trace_dump(FILE *fp);
+
+#endif /* TRACE_H */
@@ -0,0 +1,429 @@
+/**
+ * @file uring_io.c
+ * AVIOContext keeping several aligned reads in flight with io_uring,
+ * optionally bypassing the page cache with O_DIRECT
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* O_DIRECT */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include "uring_io.h"
+
+#if HAVE_LIBURING
+
+#include <liburing.h>
+
+/*
+
+ blocks are used as a circle, block 'head' holds the read position and
+ the following ones hold the next block_size stretches of the file
+
+          head
+ ________ ________ ________ ________
+| READY  |INFLIGHT|INFLIGHT|  IDLE  |  <- IDLE blocks are queued again
+|________|________|________|________|     at next_offset by refill()
+   ^pos
+
+*/
+
+enum block_state {
+    BLOCK_IDLE,
+    BLOCK_INFLIGHT,
+    BLOCK_READY,
+};
+
+struct block {
+    uint8_t *data;
+    int64_t  offset; /* file offset of data[0] */
+    int      want;   /* bytes requested */
+    int      filled; /* bytes completed so far */
+    int      error;  /* negative errno of a failed read */
+    enum block_state state;
+};
+
+struct uring_io {
+    int fd;
+    int direct;
+    int64_t size;
+    int64_t pos;         /* file offset of the next byte handed out */
+    int64_t next_offset; /* file offset of the next block to queue */
+
+    struct io_uring ring;
+    uint8_t      *pool;  /* nb_blocks * block_size, URING_IO_ALIGN aligned */
+    struct block *blocks;
+    int nb_blocks;
+    int block_size;
+    int head;
+    int inflight;
+
+    struct uring_io_stats stats;
+};
+
+static int     submit_block(struct uring_io *, struct block *);
+
+static int     refill(struct uring_io *);
+
+static int     reap(struct uring_io *, int);
+
+static int     restart(struct uring_io *, int64_t);
+
+static int     read_packet(void *, uint8_t *, int);
+
+static int64_t seek(void *, int64_t, int);
+
+int uring_io_open(AVIOContext **pb, const char *filename,
+                  int depth, int block_size, int direct) {
+    int i, ret = 0;
+    struct stat st;
+    struct uring_io *io = NULL;
+    uint8_t *avio_ctx_buffer = NULL;
+
+    *pb = NULL;
+    if (depth <= 0)
+        depth = URING_IO_DEPTH;
+    if (block_size <= 0)
+        block_size = URING_IO_BLOCK_SIZE;
+    block_size = FFALIGN(block_size, URING_IO_ALIGN);
+
+    if (!(io = av_mallocz(sizeof(*io))))
+        return AVERROR(ENOMEM);
+    io->fd         = -1;
+    io->direct     = direct;
+    io->nb_blocks  = depth;
+    io->block_size = block_size;
+
+    if ((io->fd = open(filename, O_RDONLY | (direct ? O_DIRECT : 0))) < 0) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open '%s'%s\n",
+                filename, direct ? " with O_DIRECT" : "");
+        goto fail;
+    }
+    if (fstat(io->fd, &st) < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+    io->size = st.st_size;
+
+    /* O_DIRECT wants buffer, offset and length aligned to the logical
+     * block size of the device, a page covers every common device */
+    if ((ret = posix_memalign((void **)&io->pool, URING_IO_ALIGN,
+                              (size_t)depth * block_size))) {
+        io->pool = NULL;
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if (!(io->blocks = av_mallocz_array(depth, sizeof(*io->blocks)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (i = 0; i < depth; i++)
+        io->blocks[i].data = io->pool + (size_t)i * block_size;
+
+    if ((ret = io_uring_queue_init(depth, &io->ring, 0)) < 0) {
+        fprintf(stderr, "Could not set up io_uring (%s)\n", av_err2str(ret));
+        ret = AVERROR(-ret);
+        goto fail;
+    }
+
+    if ((ret = restart(io, 0)) < 0)
+        goto fail_ring;
+
+    if (!(avio_ctx_buffer = av_malloc(block_size))) {
+        ret = AVERROR(ENOMEM);
+        goto fail_ring;
+    }
+    *pb = avio_alloc_context(avio_ctx_buffer, block_size,
+                             0, io, &read_packet, NULL, &seek);
+    if (!*pb) {
+        ret = AVERROR(ENOMEM);
+        goto fail_ring;
+    }
+
+    return 0;
+
+fail_ring:
+    while (io->inflight && reap(io, 1) >= 0)
+        ;
+    io_uring_queue_exit(&io->ring);
+fail:
+    av_free(avio_ctx_buffer);
+    if (io->fd >= 0)
+        close(io->fd);
+    free(io->pool);
+    av_free(io->blocks);
+    av_free(io);
+    return ret;
+}
+
+void uring_io_close(AVIOContext **pb) {
+    struct uring_io *io;
+
+    if (!*pb)
+        return;
+    io = (*pb)->opaque;
+
+    /* note: the internal buffer could have changed,
+     * and be != avio_ctx_buffer */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+
+    /* the kernel may still write into the blocks until completion */
+    while (io->inflight && reap(io, 1) >= 0)
+        ;
+    io_uring_queue_exit(&io->ring);
+    close(io->fd);
+    free(io->pool);
+    av_free(io->blocks);
+    av_free(io);
+}
+
+const struct uring_io_stats *uring_io_get_stats(AVIOContext *pb) {
+    return &((struct uring_io *)pb->opaque)->stats;
+}
+
+void uring_io_dump_stats(AVIOContext *pb, FILE *fp) {
+    struct uring_io *io = pb->opaque;
+    const struct uring_io_stats *stats = &io->stats;
+
+    fprintf(fp,
+            "uring io: %"PRId64" bytes read, %"PRId64" reads, "
+            "%"PRId64" seeks, %"PRId64" submits, depth %d x %d bytes%s\n"
+            "uring io: %"PRId64" waits, %.3f ms waited\n",
+            stats->bytes_read, stats->nb_reads, stats->nb_seeks,
+            stats->nb_submits, io->nb_blocks, io->block_size,
+            io->direct ? ", O_DIRECT" : "",
+            stats->nb_waits, stats->wait_us / 1000.0);
+}
+
+static int submit_block(struct uring_io *io, struct block *b) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&io->ring);
+
+    /* the ring has one entry per block, so this cannot run dry */
+    if (!sqe)
+        return AVERROR(EAGAIN);
+    io_uring_prep_read(sqe, io->fd, b->data + b->filled, b->want - b->filled,
+                       b->offset + b->filled);
+    io_uring_sqe_set_data(sqe, b);
+
+    b->state = BLOCK_INFLIGHT;
+    io->inflight++;
+    io->stats.nb_submits++;
+
+    return 0;
+}
+
+static int refill(struct uring_io *io) {
+    int i, ret, queued = 0;
+
+    /* idle blocks always sit at the end of the circle, queueing them in
+     * order keeps file offsets increasing from head on */
+    for (i = 0; i < io->nb_blocks && io->next_offset < io->size; i++) {
+        struct block *b = &io->blocks[(io->head + i) % io->nb_blocks];
+
+        if (b->state != BLOCK_IDLE)
+            continue;
+        b->offset = io->next_offset;
+        b->filled = 0;
+        b->error  = 0;
+        /* O_DIRECT reads whole aligned blocks, the kernel stops at EOF */
+        b->want   = io->direct ? io->block_size :
+                    FFMIN(io->block_size, io->size - io->next_offset);
+        if ((ret = submit_block(io, b)) < 0)
+            return ret;
+        io->next_offset += io->block_size;
+        queued++;
+    }
+
+    if (queued && (ret = io_uring_submit(&io->ring)) < 0)
+        return ret;
+
+    return 0;
+}
+
+static int reap(struct uring_io *io, int wait) {
+    int ret, resubmit = 0;
+    struct io_uring_cqe *cqe;
+
+    for (;;) {
+        struct block *b;
+        int res;
+
+        ret = wait ? io_uring_wait_cqe(&io->ring, &cqe)
+                   : io_uring_peek_cqe(&io->ring, &cqe);
+        if (ret == -EAGAIN)
+            break;
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return ret;
+        wait = 0;
+
+        b   = io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(&io->ring, cqe);
+        io->inflight--;
+
+        if (res == -EAGAIN || res == -EINTR) {
+            resubmit |= submit_block(io, b) == 0;
+            continue;
+        }
+        if (res < 0) {
+            b->error = res;
+            b->state = BLOCK_READY;
+            continue;
+        }
+
+        b->filled += res;
+        io->stats.bytes_read += res;
+        /* a short read before EOF (it does happen for buffered reads)
+         * queues the remainder again */
+        if (res && b->filled < b->want && b->offset + b->filled < io->size) {
+            resubmit |= submit_block(io, b) == 0;
+            continue;
+        }
+        b->state = BLOCK_READY;
+    }
+
+    if (resubmit && (ret = io_uring_submit(&io->ring)) < 0)
+        return ret;
+
+    return 0;
+}
+
+static int restart(struct uring_io *io, int64_t offset) {
+    int i, ret;
+
+    while (io->inflight)
+        if ((ret = reap(io, 1)) < 0)
+            return AVERROR(-ret);
+
+    for (i = 0; i < io->nb_blocks; i++)
+        io->blocks[i].state = BLOCK_IDLE;
+    io->head        = 0;
+    io->pos         = offset;
+    io->next_offset = offset - offset % io->block_size;
+
+    if ((ret = refill(io)) < 0)
+        return AVERROR(-ret);
+
+    return 0;
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
+    struct uring_io *io = (struct uring_io *)opaque;
+    struct block *b = &io->blocks[io->head];
+    int64_t off;
+    int ret, len;
+
+    io->stats.nb_reads++;
+
+    if ((ret = reap(io, 0)) < 0)
+        return AVERROR(-ret);
+    if (b->state == BLOCK_INFLIGHT) {
+        int64_t t = av_gettime_relative();
+
+        io->stats.nb_waits++;
+        while (b->state == BLOCK_INFLIGHT)
+            if ((ret = reap(io, 1)) < 0)
+                return AVERROR(-ret);
+        io->stats.wait_us += av_gettime_relative() - t;
+    }
+
+    /* nothing queued at head means the position is past the end */
+    if (b->state == BLOCK_IDLE)
+        return AVERROR_EOF;
+    if (b->error)
+        return AVERROR(-b->error);
+
+    off = io->pos - b->offset;
+    if (off >= b->filled)
+        return AVERROR_EOF;
+    len = FFMIN(buf_size, b->filled - off);
+
+    memcpy(buf, b->data + off, len);
+    io->pos += len;
+
+    /* block drained, queue it again behind the others */
+    if (off + len == b->filled) {
+        b->state = BLOCK_IDLE;
+        io->head = (io->head + 1) % io->nb_blocks;
+        if ((ret = refill(io)) < 0)
+            return AVERROR(-ret);
+    }
+
+    return len;
+}
+
+static int64_t seek(void *opaque, int64_t offset, int whence) {
+    struct uring_io *io = (struct uring_io *)opaque;
+    struct block *b = &io->blocks[io->head];
+    int ret;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return io->size;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += io->pos;
+            break;
+        case SEEK_END:
+            offset += io->size;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+
+    /* inside the block at head nothing has to be read again */
+    if (b->state == BLOCK_READY && !b->error &&
+        offset >= b->offset && offset < b->offset + b->filled) {
+        io->pos = offset;
+        return offset;
+    }
+
+    io->stats.nb_seeks++;
+    if ((ret = restart(io, offset)) < 0)
+        return ret;
+
+    return offset;
+}
+
+#else /* !HAVE_LIBURING */
+
+int uring_io_open(AVIOContext **pb, const char *filename,
+                  int depth, int block_size, int direct) {
+    *pb = NULL;
+    fprintf(stderr, "uring io: built without liburing\n");
+    return AVERROR(ENOSYS);
+}
+
+void uring_io_close(AVIOContext **pb) {
+}
+
+const struct uring_io_stats *uring_io_get_stats(AVIOContext *pb) {
+    return NULL;
+}
+
+void uring_io_dump_stats(AVIOContext *pb, FILE *fp) {
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,52 @@
+/**
+ * @file uring_io.h
+ * AVIOContext keeping several aligned reads in flight with io_uring,
+ * optionally bypassing the page cache with O_DIRECT
+ *
+ * @author  duruyao
+ * @version 1.0  26-10-16
+ * @update  [id] [yy-mm-dd] [author] [description]
+ */
+
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libavformat/avio.h>
+
+/* set by the Makefile when liburing is installed, without it
+ * uring_io_open() fails with AVERROR(ENOSYS) */
+#ifndef HAVE_LIBURING
+#define HAVE_LIBURING 0
+#endif
+
+#define URING_IO_DEPTH      8
+#define URING_IO_BLOCK_SIZE (256 << 10)
+#define URING_IO_ALIGN      4096
+
+struct uring_io_stats {
+    int64_t bytes_read;   /* bytes completed by the kernel */
+    int64_t nb_reads;     /* calls of the read callback */
+    int64_t nb_seeks;     /* seeks that dropped the reads in flight */
+    int64_t nb_submits;   /* read requests queued on the ring */
+    int64_t nb_waits;     /* read callbacks that waited for a completion */
+    int64_t wait_us;      /* time the read callback waited */
+};
+
+/* open the file and queue 'depth' reads of block_size bytes ahead of the
+ * demuxer, block_size is rounded up to URING_IO_ALIGN; 0 selects the
+ * defaults above; with direct set the file is opened with O_DIRECT */
+int  uring_io_open(AVIOContext **pb, const char *filename,
+                   int depth, int block_size, int direct);
+
+/* wait for the reads in flight, free the AVIOContext and close the file,
+ * *pb is set to NULL */
+void uring_io_close(AVIOContext **pb);
+
+const struct uring_io_stats *uring_io_get_stats(AVIOContext *pb);
+
+void uring_io_dump_stats(AVIOContext *pb, FILE *fp);
+
+#endif /* URING_IO_H */